@@ -8,14 +8,11 @@
  *
  */
 
-#ifdef __KERNEL__
-#include <linux/string.h>
-#else
-#include <string.h>
-#endif
-
 #include "aesd-circular-buffer.h"
 
+AESD_RING_INDEXED_OPS( aesd_ring, aesd_circular_buffer, struct aesd_buffer_entry,
+                       AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, AESD_BUFFER_ENTRY_SIZE )
+
 /**
  * @param buffer the buffer to search for corresponding offset.  Any necessary locking must be performed by caller.
  * @param char_offset the position to search for in the buffer list, describing the zero referenced
@@ -31,32 +28,7 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(
     , size_t char_offset
     , size_t *entry_offset_byte_rtn )
 {
-    size_t total_bytes_size = 0;
-    uint8_t index = buffer->out_offs;
-    uint8_t count = 0;
-
-    while (count < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
-        struct aesd_buffer_entry *entry = &buffer->entry[index];
-
-        if (entry->size == 0) {
-            return NULL; // No more valid entries
-        }
-
-        if (total_bytes_size + entry->size > char_offset) {
-            *entry_offset_byte_rtn = char_offset - total_bytes_size;
-            return entry;
-        }
-
-        total_bytes_size += entry->size;
-        index = (index + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        count++;
-
-        if (index == buffer->in_offs && !buffer->full) {
-            break; // Reached the end of valid entries
-        }
-    }
-
-    return NULL; // char_offset not found
+    return aesd_ring_find( buffer, char_offset, entry_offset_byte_rtn );
 }
 
 /**
@@ -68,28 +40,13 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(
 */
 const char* aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
 {
-    char const* old_buff = NULL;
-    struct aesd_buffer_entry * e = &( buffer->entry[ buffer->in_offs ] );
+    struct aesd_buffer_entry evicted;
 
-    if ( buffer->full ){
-        old_buff = e->buffptr;
+    if( aesd_ring_push_indexed( buffer, add_entry, &evicted ) ){
+        return evicted.buffptr;
     }
 
-    e->buffptr = add_entry->buffptr;
-    e->size = add_entry->size;
-    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-
-    if (buffer->full) {
-        buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    }
-
-    if (buffer->in_offs == buffer->out_offs) {
-        buffer->full = true;
-    } else {
-        buffer->full = false;
-    }
-
-    return old_buff;
+    return NULL;
 }
 
 /**
@@ -97,60 +54,40 @@ const char* aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
-    memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    aesd_ring_init( buffer );
 }
 
+/**
+ * @return the total number of bytes held by @param buffer, in constant time.
+ * Any necessary locking must be performed by caller.
+ */
 size_t aesd_circular_buffer_size( struct aesd_circular_buffer *buffer ){
-    size_t sz = 0;
-    int i = 0;
-
-    for( ; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i ++ ){
-        struct aesd_buffer_entry* e = &( buffer->entry[ i ] );
-
-        if( e->buffptr ){
-            sz += e->size;
-        }else{
-            break;
-        }
-    }
-
-    return sz;
+    return aesd_ring_bytes( buffer );
 }
 
+/**
+ * @return the number of valid entries in @param buffer.
+ */
 size_t aesd_circullar_buffer_size( struct aesd_circular_buffer* buffer ){
-    size_t sz = 0;
-    int i = 0;
-
-    for( ; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i ++ ){
-        struct aesd_buffer_entry* e = &( buffer->entry[ i ] );
-
-        if( e->buffptr ){
-            sz ++;
-        }else{
-            break;
-        }
-    }
+    return buffer->count;
+}
 
-    return sz;
+/**
+ * @return the entry at zero referenced @param index counted from the oldest entry, or NULL
+ * when there are not that many entries.
+ */
+struct aesd_buffer_entry* aesd_circular_buffer_get( struct aesd_circular_buffer* buffer, uint32_t index ){
+    return aesd_ring_at( buffer, index );
 }
 
+/**
+ * @return the offset of the first byte of the zero referenced write @param command counted from
+ * the oldest entry, or 0 when the command is out of range.  Constant time.
+ */
 size_t aesd_circular_buffer_seek( struct aesd_circular_buffer* buffer, uint32_t command ){
-    size_t off = 0;
-    int i = 0;
-
-    if( command >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ){
-        return off;
+    if( command >= buffer->count ){
+        return 0;
     }
 
-    for( ; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i ++ ){
-        struct aesd_buffer_entry* e = &( buffer->entry[ i ] );
-
-        if( !e->buffptr || i == command ){
-            break;
-        }else{
-            off += e->size;
-        }
-    }
-
-    return off;
-}
\ No newline at end of file
+    return aesd_ring_offset_of( buffer, command );
+}
@@ -16,6 +16,8 @@
 #include <stdbool.h>
 #endif
 
+#include "aesd-ring.h"
+
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
 
 struct aesd_buffer_entry
@@ -28,31 +30,23 @@ struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
-};
-
-struct aesd_circular_buffer
-{
-    /**
-     * An array of pointers to memory allocated for the most recent write operations
-     */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
-    /**
-     * The current location in the entry structure where the next write should
-     * be stored.
-     */
-    uint8_t in_offs;
     /**
-     * The first location in the entry structure to read from
+     * Number of bytes actually held at buffptr when the entry is stored compressed, 0 when
+     * buffptr holds the raw bytes.  size and all buffer offsets always refer to the uncompressed
+     * record, so lookups by file position are not affected by compression.
      */
-    uint8_t out_offs;
-    /**
-     * set to true when the buffer entry structure is full
-     */
-    bool full;
-
-    // size_t elements;
+    size_t stored_size;
 };
 
+#define AESD_BUFFER_ENTRY_SIZE( e ) ( ( e )->size )
+
+/**
+ * The ring of the most recent write operations, see AESD_RING_FIELDS for the members.
+ * The prefix size index keeps size and seek queries O(1), count is the number of valid entries
+ * and seq the sequence number of the newest entry (the oldest one is seq - count + 1).
+ */
+AESD_RING_INDEXED_STRUCT( aesd_circular_buffer, struct aesd_buffer_entry, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, uint8_t );
+
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer
                                                                                     ,size_t char_offset
                                                                                     , size_t *entry_offset_byte_rtn );
@@ -66,6 +60,8 @@ extern size_t aesd_circular_buffer_size( struct aesd_circular_buffer *buffer );
 extern size_t aesd_circullar_buffer_size( struct aesd_circular_buffer* buffer );
 
 extern size_t aesd_circular_buffer_seek( struct aesd_circular_buffer* buffer, uint32_t command );
+
+extern struct aesd_buffer_entry* aesd_circular_buffer_get( struct aesd_circular_buffer* buffer, uint32_t index );
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
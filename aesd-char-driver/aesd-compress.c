@@ -0,0 +1,103 @@
+/**
+ * @file aesd-compress.c
+ * @brief LZ4 compression of aesd circular buffer records, backed by the kernel lz4 library
+ *
+ * Compression is only built when the kernel provides LZ4_COMPRESS and LZ4_DECOMPRESS,
+ * otherwise every record is kept raw.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+
+#if IS_ENABLED(CONFIG_LZ4_COMPRESS) && IS_ENABLED(CONFIG_LZ4_DECOMPRESS)
+#define AESD_HAVE_LZ4 1
+#include <linux/lz4.h>
+#endif
+
+#include "aesd-compress.h"
+
+#ifdef AESD_HAVE_LZ4
+static void* lz4_wrkmem = NULL;
+#endif
+
+bool aesd_compress_available( void ){
+#ifdef AESD_HAVE_LZ4
+    return lz4_wrkmem != NULL;
+#else
+    return false;
+#endif
+}
+
+int aesd_compress_init( void ){
+#ifdef AESD_HAVE_LZ4
+    lz4_wrkmem = kmalloc( LZ4_MEM_COMPRESS, GFP_KERNEL );
+
+    if( !lz4_wrkmem ){
+        return -ENOMEM;
+    }
+
+    return 0;
+#else
+    // the load path clears the compress parameter on failure
+    return -EOPNOTSUPP;
+#endif
+}
+
+void aesd_compress_cleanup( void ){
+#ifdef AESD_HAVE_LZ4
+    kfree( lz4_wrkmem );
+    lz4_wrkmem = NULL;
+#endif
+}
+
+int aesd_compress_record( const char* src, size_t len, struct aesd_buffer_entry* entry ){
+#ifdef AESD_HAVE_LZ4
+    int bound, csize;
+    char* dst;
+
+    if( !lz4_wrkmem ){
+        return -EOPNOTSUPP;
+    }
+
+    if( len < AESD_COMPRESS_MIN_RECORD || len > LZ4_MAX_INPUT_SIZE ){
+        return -EINVAL;
+    }
+
+    bound = LZ4_compressBound( len );
+    dst = kmalloc( bound, GFP_KERNEL );
+
+    if( !dst ){
+        return -ENOMEM;
+    }
+
+    csize = LZ4_compress_default( src, dst, len, bound, lz4_wrkmem );
+
+    if( csize <= 0 || csize >= len ){
+        kfree( dst );
+        return -E2BIG;
+    }
+
+    // give back the slack between the bound and the real compressed size
+    entry->buffptr = krealloc( dst, csize, GFP_KERNEL ) ?: dst;
+    entry->size = len;
+    entry->stored_size = csize;
+    return 0;
+#else
+    return -EOPNOTSUPP;
+#endif
+}
+
+int aesd_decompress_record( const struct aesd_buffer_entry* entry, char* dst ){
+#ifdef AESD_HAVE_LZ4
+    int n = LZ4_decompress_safe( entry->buffptr, dst, entry->stored_size, entry->size );
+
+    if( n < 0 || n != entry->size ){
+        return -EIO;
+    }
+
+    return 0;
+#else
+    return -EOPNOTSUPP;
+#endif
+}
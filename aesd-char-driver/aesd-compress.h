@@ -0,0 +1,39 @@
+/*
+ * aesd-compress.h
+ *
+ *  @brief Optional per-record compression for entries held in the aesd circular buffer
+ */
+
+#ifndef AESD_COMPRESS_H
+#define AESD_COMPRESS_H
+
+#include <linux/types.h>
+#include "aesd-circular-buffer.h"
+
+/**
+ * Records shorter than this are always stored raw, LZ4 only emits literals for them.  Longer ones
+ * are still kept raw when they do not shrink.
+ */
+#define AESD_COMPRESS_MIN_RECORD 13
+
+bool aesd_compress_available( void );
+
+int aesd_compress_init( void );
+
+void aesd_compress_cleanup( void );
+
+/**
+ * Tries to compress @param src of @param len bytes.  On success @param entry describes a newly
+ * kmalloc'ed compressed copy (entry->size == len, entry->stored_size < len) and 0 is returned.
+ * Returns a negative errno when the record is not worth compressing or compression is unavailable,
+ * in that case @param entry is left untouched.  Caller must hold the device lock.
+ */
+int aesd_compress_record( const char* src, size_t len, struct aesd_buffer_entry* entry );
+
+/**
+ * Expands the compressed @param entry into @param dst which must hold at least entry->size bytes.
+ * @return 0 on success or a negative errno.
+ */
+int aesd_decompress_record( const struct aesd_buffer_entry* entry, char* dst );
+
+#endif /* AESD_COMPRESS_H */
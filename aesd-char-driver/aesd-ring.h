@@ -0,0 +1,156 @@
+/*
+ * aesd-ring.h
+ *
+ *  @brief Header only, compile time sized ring used by aesd-circular-buffer and by user space services.
+ *
+ *  A ring is declared for an element type and a capacity known at compile time, then a set of
+ *  static inline operations is generated for it under a chosen prefix:
+ *
+ *      AESD_RING_STRUCT(my_ring, struct my_item, 64, uint8_t);
+ *      AESD_RING_OPS(my_ring, my_ring, struct my_item, 64)
+ *
+ *      struct my_ring r;
+ *      my_ring_init( &r );
+ *      my_ring_push( &r, &item, NULL );
+ *
+ *  When the capacity is a power of two the index wrap is a mask, otherwise it is a single
+ *  conditional subtraction, no division is performed in either case.
+ *
+ *  AESD_RING_INDEXED_STRUCT / AESD_RING_INDEXED_OPS additionally keep the stream position of every
+ *  element, given a SIZE_OF(elem_ptr) expression, so byte size queries and seeks by record are O(1)
+ *  and lookups by byte offset are a binary search instead of a walk.
+ *
+ *  No locking is done here, any necessary locking must be performed by the caller.
+ */
+
+#ifndef AESD_RING_H
+#define AESD_RING_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#endif
+
+#define AESD_RING_IS_POW2( cap ) ( ( ( cap ) & ( ( cap ) - 1 ) ) == 0 )
+
+/**
+ * Wraps @param i, which must be below 2 * cap, into [0, cap).
+ */
+#define AESD_RING_WRAP( i, cap ) \
+    ( AESD_RING_IS_POW2( cap ) ? ( ( i ) & ( ( cap ) - 1 ) ) : ( ( i ) >= ( cap ) ? ( i ) - ( cap ) : ( i ) ) )
+
+/**
+ * Members shared by every ring:
+ *  entry     storage for the elements
+ *  in_offs   the location in entry where the next element is stored
+ *  out_offs  the location of the oldest element
+ *  full      set when every slot holds a valid element
+ *  count     number of valid elements
+ *  seq       number of elements pushed since init, the sequence number of the newest element
+ */
+#define AESD_RING_FIELDS( type, cap, idx_t ) \
+    type        entry[ cap ]; \
+    idx_t       in_offs; \
+    idx_t       out_offs; \
+    bool        full; \
+    idx_t       count; \
+    uint64_t    seq;
+
+/**
+ * Members of the prefix size index:
+ *  start     stream position of the first byte of the element held in each slot
+ *  end_pos   stream position one past the newest element, i.e. bytes pushed since init
+ */
+#define AESD_RING_INDEX_FIELDS( cap ) \
+    uint64_t    start[ cap ]; \
+    uint64_t    end_pos;
+
+#define AESD_RING_STRUCT( name, type, cap, idx_t ) \
+    struct name { \
+        AESD_RING_FIELDS( type, cap, idx_t ) \
+    }
+
+#define AESD_RING_INDEXED_STRUCT( name, type, cap, idx_t ) \
+    struct name { \
+        AESD_RING_FIELDS( type, cap, idx_t ) \
+        AESD_RING_INDEX_FIELDS( cap ) \
+    }
+
+/**
+ * Generates the basic operations @param fn##_init, _at, _push for struct @param name.
+ * _push stores a copy of the element, when the ring was full the overwritten oldest element is
+ * copied to @param evicted (if not NULL) and true is returned.
+ */
+#define AESD_RING_OPS( fn, name, type, cap ) \
+    static inline uint32_t fn##_wrap( uint32_t i ){ \
+        return AESD_RING_WRAP( i, ( uint32_t )( cap ) ); \
+    } \
+    static inline void fn##_init( struct name* r ){ \
+        memset( r, 0, sizeof( *r ) ); \
+    } \
+    static inline type* fn##_at( struct name* r, uint32_t i ){ \
+        return i < r->count ? &r->entry[ fn##_wrap( r->out_offs + i ) ] : NULL; \
+    } \
+    static inline bool fn##_push( struct name* r, const type* e, type* evicted ){ \
+        bool was_full = r->full; \
+        type* slot = &r->entry[ r->in_offs ]; \
+        if( was_full && evicted ){ \
+            *evicted = *slot; \
+        } \
+        *slot = *e; \
+        r->in_offs = fn##_wrap( r->in_offs + 1 ); \
+        if( was_full ){ \
+            r->out_offs = r->in_offs; \
+        }else{ \
+            r->count ++; \
+        } \
+        r->full = r->in_offs == r->out_offs; \
+        r->seq ++; \
+        return was_full; \
+    }
+
+/**
+ * Generates AESD_RING_OPS plus the prefix size index operations for a ring declared with
+ * AESD_RING_INDEXED_STRUCT.  @param size_of is applied to an element pointer and yields its size.
+ *  fn##_push_indexed  as _push, also records the stream position of the element
+ *  fn##_bytes         total size of the valid elements
+ *  fn##_offset_of     offset of the first byte of the i-th oldest element
+ *  fn##_find          element holding byte @param off, relative offset stored to @param rel
+ */
+#define AESD_RING_INDEXED_OPS( fn, name, type, cap, size_of ) \
+    AESD_RING_OPS( fn, name, type, cap ) \
+    static inline bool fn##_push_indexed( struct name* r, const type* e, type* evicted ){ \
+        r->start[ r->in_offs ] = r->end_pos; \
+        r->end_pos += size_of( e ); \
+        return fn##_push( r, e, evicted ); \
+    } \
+    static inline uint64_t fn##_bytes( const struct name* r ){ \
+        return r->count ? r->end_pos - r->start[ r->out_offs ] : 0; \
+    } \
+    static inline uint64_t fn##_offset_of( const struct name* r, uint32_t i ){ \
+        return r->start[ fn##_wrap( r->out_offs + i ) ] - r->start[ r->out_offs ]; \
+    } \
+    static inline type* fn##_find( struct name* r, uint64_t off, size_t* rel ){ \
+        uint32_t lo = 0, hi; \
+        if( off >= fn##_bytes( r ) ){ \
+            return NULL; \
+        } \
+        hi = r->count - 1; \
+        while( lo < hi ){ \
+            uint32_t mid = lo + ( hi - lo + 1 ) / 2; \
+            if( fn##_offset_of( r, mid ) <= off ){ \
+                lo = mid; \
+            }else{ \
+                hi = mid - 1; \
+            } \
+        } \
+        *rel = off - fn##_offset_of( r, lo ); \
+        return fn##_at( r, lo ); \
+    }
+
+#endif /* AESD_RING_H */
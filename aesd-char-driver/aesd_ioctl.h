@@ -33,14 +33,51 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * Compression statistics of the records held by the driver, returned by AESDCHAR_IOCGCOMPSTATS.
+ * The live_* counters describe the records currently in the buffer, so
+ * live_raw_bytes / live_stored_bytes is the current compression ratio.
+ */
+struct aesd_compress_stats {
+    uint64_t live_raw_bytes;
+    uint64_t live_stored_bytes;
+    uint64_t records_compressed;
+    uint64_t records_raw;
+    /**
+     * Accumulated CPU time spent in compression and decompression, in nanoseconds
+     */
+    uint64_t compress_ns;
+    uint64_t decompress_ns;
+    uint64_t decompress_calls;
+    /**
+     * Non zero when the driver was loaded with compress=1 and LZ4 is available
+     */
+    uint32_t enabled;
+    uint32_t reserved;
+};
+
+/**
+ * Snapshot of the driver contents returned by AESDCHAR_IOCGINFO, taken under the device lock.
+ * Sequence numbers count every record ever committed starting at 1, both are 0 while empty.
+ */
+struct aesd_info {
+    uint64_t size;
+    uint64_t oldest_seq;
+    uint64_t newest_seq;
+    uint32_t records;
+    uint32_t reserved;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+#define AESDCHAR_IOCGCOMPSTATS _IOR(AESD_IOC_MAGIC, 2, struct aesd_compress_stats)
+#define AESDCHAR_IOCGINFO _IOR(AESD_IOC_MAGIC, 3, struct aesd_info)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 3
 
 #endif /* AESD_IOCTL_H */
@@ -10,6 +10,7 @@
 
 #include <linux/cdev.h>
 #include <linux/mutex.h>
+#include "aesd_ioctl.h"
 
 #define AESD_DEBUG 1  //Remove comment on this line to enable debug
 
@@ -29,6 +30,7 @@
 struct aesd_dev{
     struct mutex    mtx;
     struct cdev     cdev;     /* Char device structure      */
+    struct aesd_compress_stats cstats; /* protected by mtx */
 };
 
 
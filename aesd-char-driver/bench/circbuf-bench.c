@@ -0,0 +1,175 @@
+/*
+ * circbuf-bench.c
+ *
+ *  @brief Microbenchmarks for the aesd-circular-buffer functions.
+ *
+ *  Times add_entry, find_entry_offset_for_fpos, aesd_circular_buffer_size and aesd_circular_buffer_seek
+ *  for every fill depth of the ring, several record sizes and three access patterns:
+ *      seq     offsets walk the buffer from start to end
+ *      random  uniformly random offsets / write commands
+ *      tail    90% of the lookups hit the newest 10% of the bytes
+ *
+ *  usage: circbuf-bench [--json] [iterations]
+ *  Results go to stdout as CSV (default) or as a JSON array, one row per measurement, so runs
+ *  can be diffed across commits.
+ */
+#include "../aesd-circular-buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum pattern { PAT_SEQ, PAT_RANDOM, PAT_TAIL, PAT_COUNT };
+static char const* pattern_names[ PAT_COUNT ] = { "seq", "random", "tail" };
+
+static const size_t record_sizes[] = { 16, 256, 4096 };
+
+static bool         json = false;
+static bool         first_row = true;
+static long         iterations = 1000000;
+static volatile size_t sink;
+static uint32_t     rng_state = 2463534242u;
+
+static uint32_t xorshift( void ){
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static double now_ns( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report( char const* op, int depth, size_t rec_size, char const* pattern, double ns_per_op ){
+    if( json ){
+        printf( "%s\n  {\"op\":\"%s\",\"depth\":%d,\"record_size\":%zu,\"pattern\":\"%s\",\"ns_per_op\":%.2f}",
+                first_row ? "[" : ",", op, depth, rec_size, pattern, ns_per_op );
+    }else{
+        if( first_row ){
+            printf( "op,depth,record_size,pattern,ns_per_op\n" );
+        }
+
+        printf( "%s,%d,%zu,%s,%.2f\n", op, depth, rec_size, pattern, ns_per_op );
+    }
+
+    first_row = false;
+}
+
+static void fill( struct aesd_circular_buffer* buffer, char const* data, size_t rec_size, int depth ){
+    struct aesd_buffer_entry e = { data, rec_size, 0 };
+    aesd_circular_buffer_init( buffer );
+
+    for( int i = 0; i < depth; i ++ ){
+        aesd_circular_buffer_add_entry( buffer, &e );
+    }
+}
+
+static size_t next_offset( enum pattern p, size_t total, size_t i ){
+    switch( p ){
+    case PAT_SEQ:
+        return i % total;
+    case PAT_RANDOM:
+        return xorshift() % total;
+    default:
+        if( xorshift() % 10 ){
+            return total - 1 - xorshift() % ( total / 10 + 1 );
+        }
+
+        return xorshift() % total;
+    }
+}
+
+static void bench_add( char const* data, size_t rec_size ){
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry e = { data, rec_size, 0 };
+    fill( &buffer, data, rec_size, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED );
+    double t0 = now_ns();
+
+    for( long i = 0; i < iterations; i ++ ){
+        sink += ( size_t )aesd_circular_buffer_add_entry( &buffer, &e );
+    }
+
+    report( "add_entry", AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, rec_size, "seq", ( now_ns() - t0 ) / iterations );
+}
+
+static void bench_depth( char const* data, size_t rec_size, int depth ){
+    struct aesd_circular_buffer buffer;
+    size_t total = rec_size * depth;
+    size_t* offsets = malloc( iterations * sizeof( size_t ) );
+    fill( &buffer, data, rec_size, depth );
+
+    for( int p = 0; p < PAT_COUNT; p ++ ){
+        size_t rel;
+
+        // pre-generate so the generator is not part of the measurement
+        for( long i = 0; i < iterations; i ++ ){
+            offsets[ i ] = next_offset( p, total, i );
+        }
+
+        double t0 = now_ns();
+
+        for( long i = 0; i < iterations; i ++ ){
+            sink += ( size_t )aesd_circular_buffer_find_entry_offset_for_fpos( &buffer, offsets[ i ], &rel );
+        }
+
+        report( "find_entry_offset_for_fpos", depth, rec_size, pattern_names[ p ], ( now_ns() - t0 ) / iterations );
+
+        for( long i = 0; i < iterations; i ++ ){
+            offsets[ i ] = next_offset( p, depth, i );
+        }
+
+        t0 = now_ns();
+
+        for( long i = 0; i < iterations; i ++ ){
+            sink += aesd_circular_buffer_seek( &buffer, offsets[ i ] );
+        }
+
+        report( "seek", depth, rec_size, pattern_names[ p ], ( now_ns() - t0 ) / iterations );
+    }
+
+    double t0 = now_ns();
+
+    for( long i = 0; i < iterations; i ++ ){
+        sink += aesd_circular_buffer_size( &buffer );
+    }
+
+    report( "size", depth, rec_size, "seq", ( now_ns() - t0 ) / iterations );
+    free( offsets );
+}
+
+int main( int argc, char** argv ){
+    for( int i = 1; i < argc; i ++ ){
+        if( 0 == strcmp( argv[ i ], "--json" ) ){
+            json = true;
+        }else{
+            iterations = atol( argv[ i ] );
+        }
+    }
+
+    if( iterations <= 0 ){
+        fprintf( stderr, "usage: %s [--json] [iterations]\n", argv[ 0 ] );
+        return 1;
+    }
+
+    for( size_t s = 0; s < sizeof( record_sizes ) / sizeof( record_sizes[ 0 ] ); s ++ ){
+        char* data = malloc( record_sizes[ s ] );
+        memset( data, 'a', record_sizes[ s ] );
+        bench_add( data, record_sizes[ s ] );
+
+        for( int depth = 1; depth <= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; depth ++ ){
+            bench_depth( data, record_sizes[ s ], depth );
+        }
+
+        free( data );
+    }
+
+    if( json ){
+        printf( "\n]\n" );
+    }
+
+    return 0;
+}
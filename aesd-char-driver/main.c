@@ -18,10 +18,14 @@
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
 #include <linux/slab.h>         // kmalloc()
+#include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <asm/ioctls.h>         // FIONREAD
 
 #include "aesdchar.h"
 #include "aesd-circular-buffer.h"
 #include "aesd_ioctl.h"
+#include "aesd-compress.h"
 
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
@@ -33,12 +37,22 @@ struct aesd_dev                 aesd_device;
 struct aesd_circular_buffer     circular_buf;
 static char*                    g_buff = NULL;
 static size_t                   g_len = 0;
+// last decompressed record, reads walk a record in several chunks
+static char*                    g_plain = NULL;
+static size_t                   g_plain_cap = 0;
+static const char*              g_plain_src = NULL;
+
+static bool compress = false;
+module_param( compress, bool, 0444 );
+MODULE_PARM_DESC( compress, "Store records LZ4 compressed and expand them on read" );
 
 static loff_t aesd_seek( struct file* filp, loff_t offset, int whence );
 static long aesd_unlocked_ioctl( struct file* filep, unsigned int cmd, unsigned long arg );
 static int aesd_release(struct inode *inode, struct file *filp);
 static ssize_t aesd_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos);
 static ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos);
+static const char* aesd_entry_data( struct aesd_buffer_entry* entry );
+static void aesd_commit_record( char* record, size_t len );
 
 static int aesd_open(struct inode *inode, struct file *filp){
     PDEBUG("open");
@@ -70,12 +84,18 @@ static ssize_t aesd_read(struct file *filp, char __user *buf, size_t count, loff
 
     while( entry && bytes_read < count ){
         size_t cpsz = entry->size - entry_offset_byte_rtn;
+        const char* data = aesd_entry_data( entry );
+
+        if( !data ){
+            mutex_unlock( &aesd_device.mtx );
+            return bytes_read ? bytes_read : -EIO;
+        }
 
         if( cpsz > count - bytes_read ){
             cpsz = count - bytes_read;
         }
 
-        if( copy_to_user( buf + bytes_read, entry->buffptr + entry_offset_byte_rtn, cpsz ) ){
+        if( copy_to_user( buf + bytes_read, data + entry_offset_byte_rtn, cpsz ) ){
             mutex_unlock( &aesd_device.mtx );
             return -EFAULT;
         }
@@ -128,31 +148,115 @@ static ssize_t aesd_write(struct file *filp, const char __user *buf, size_t coun
         wr_len ++;
 
         if( wbuff[ i ] == '\n' ){
-            struct aesd_buffer_entry e = {
-                .buffptr = g_buff,
-                .size = g_len
-            };
-            char const* old_buff = aesd_circular_buffer_add_entry( &circular_buf, &e );
-
-            if( old_buff ){
-                kfree( old_buff );
-            }
-
+            aesd_commit_record( g_buff, g_len );
             g_buff = NULL;
             g_len = 0;
         }
     }
 
+    i_size_write( file_inode( filp ), aesd_circular_buffer_size( &circular_buf ) );
+
     mutex_unlock( &aesd_device.mtx );
     kfree( wbuff );
     return wr_len;
 }
 
+/**
+ * Adds the completed @param record to the circular buffer, compressed when enabled and worthwhile,
+ * and releases the evicted entry.  Takes ownership of record.  Caller must hold aesd_device.mtx.
+ */
+static void aesd_commit_record( char* record, size_t len ){
+    struct aesd_compress_stats* st = &aesd_device.cstats;
+    struct aesd_buffer_entry e = {
+        .buffptr = record,
+        .size = len,
+        .stored_size = 0
+    };
+    char const* old_buff;
+
+    if( compress ){
+        u64 t0 = ktime_get_ns();
+
+        if( aesd_compress_record( record, len, &e ) == 0 ){
+            kfree( record );
+            st->records_compressed ++;
+        }else{
+            st->records_raw ++;
+        }
+
+        st->compress_ns += ktime_get_ns() - t0;
+    }else{
+        st->records_raw ++;
+    }
+
+    if( circular_buf.full ){
+        struct aesd_buffer_entry* victim = &circular_buf.entry[ circular_buf.in_offs ];
+        st->live_raw_bytes -= victim->size;
+        st->live_stored_bytes -= victim->stored_size ? victim->stored_size : victim->size;
+    }
+
+    st->live_raw_bytes += e.size;
+    st->live_stored_bytes += e.stored_size ? e.stored_size : e.size;
+    old_buff = aesd_circular_buffer_add_entry( &circular_buf, &e );
+
+    if( old_buff ){
+        if( old_buff == g_plain_src ){
+            g_plain_src = NULL;
+        }
+
+        kfree( old_buff );
+    }
+}
+
+/**
+ * @return the uncompressed bytes of @param entry, expanding compressed entries into g_plain.
+ * NULL on failure.  Caller must hold aesd_device.mtx.
+ */
+static const char* aesd_entry_data( struct aesd_buffer_entry* entry ){
+    u64 t0;
+
+    if( !entry->stored_size ){
+        return entry->buffptr;
+    }
+
+    if( g_plain_src == entry->buffptr ){
+        return g_plain;
+    }
+
+    if( g_plain_cap < entry->size ){
+        char* b = krealloc( g_plain, entry->size, GFP_KERNEL );
+
+        if( !b ){
+            return NULL;
+        }
+
+        g_plain = b;
+        g_plain_cap = entry->size;
+    }
+
+    t0 = ktime_get_ns();
+
+    if( aesd_decompress_record( entry, g_plain ) ){
+        g_plain_src = NULL;
+        return NULL;
+    }
+
+    aesd_device.cstats.decompress_ns += ktime_get_ns() - t0;
+    aesd_device.cstats.decompress_calls ++;
+    g_plain_src = entry->buffptr;
+    return g_plain;
+}
+
 static loff_t aesd_seek( struct file* filp, loff_t offset, int whence ){
     loff_t np = 0;
-    size_t buff_size = 0;
+    loff_t buff_size = 0;
+
+    if( mutex_lock_interruptible( &aesd_device.mtx ) ){
+        return -ERESTARTSYS;
+    }
 
     buff_size = aesd_circular_buffer_size( &circular_buf );
+    mutex_unlock( &aesd_device.mtx );
 
     switch ( whence )
     {
@@ -189,8 +293,8 @@ static loff_t aesd_seek( struct file* filp, loff_t offset, int whence ){
 
 static long aesd_unlocked_ioctl( struct file* filep, unsigned int cmd, unsigned long arg ){
     struct aesd_seekto seekCmd;
+    struct aesd_buffer_entry* e;
     loff_t np = 0;
-    size_t buf_cmd_size = aesd_circullar_buffer_size( &circular_buf );
 
     switch( cmd ){
         case AESDCHAR_IOCSEEKTO:
@@ -198,18 +302,81 @@ static long aesd_unlocked_ioctl( struct file* filep, unsigned int cmd, unsigned
                 return -EFAULT;
             }
 
-            if( seekCmd.write_cmd >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED || seekCmd.write_cmd >= buf_cmd_size ){
-                return -EINVAL;
+            if( mutex_lock_interruptible( &aesd_device.mtx ) ){
+                return -ERESTARTSYS;
             }
 
-            if( circular_buf.entry[ seekCmd.write_cmd ].size < seekCmd.write_cmd_offset ){
+            e = aesd_circular_buffer_get( &circular_buf, seekCmd.write_cmd );
+
+            if( !e || e->size < seekCmd.write_cmd_offset ){
+                mutex_unlock( &aesd_device.mtx );
                 return -EINVAL;
             }
 
             np = aesd_circular_buffer_seek( &circular_buf, seekCmd.write_cmd );
             np += seekCmd.write_cmd_offset;
+            mutex_unlock( &aesd_device.mtx );
             break;
 
+        case AESDCHAR_IOCGINFO:{
+            struct aesd_info info = { 0 };
+
+            if( mutex_lock_interruptible( &aesd_device.mtx ) ){
+                return -ERESTARTSYS;
+            }
+
+            info.size = aesd_circular_buffer_size( &circular_buf );
+            info.records = circular_buf.count;
+
+            if( circular_buf.count ){
+                info.newest_seq = circular_buf.seq;
+                info.oldest_seq = circular_buf.seq - circular_buf.count + 1;
+            }
+
+            mutex_unlock( &aesd_device.mtx );
+
+            if( copy_to_user( ( struct aesd_info __user * )arg, &info, sizeof( info ) ) ){
+                return -EFAULT;
+            }
+
+            return 0;
+        }
+
+        case FIONREAD:{
+            loff_t avail;
+
+            if( mutex_lock_interruptible( &aesd_device.mtx ) ){
+                return -ERESTARTSYS;
+            }
+
+            avail = ( loff_t )aesd_circular_buffer_size( &circular_buf ) - filep->f_pos;
+            mutex_unlock( &aesd_device.mtx );
+
+            if( avail < 0 ){
+                avail = 0;
+            }
+
+            return put_user( ( int )min_t( loff_t, avail, INT_MAX ), ( int __user * )arg );
+        }
+
+        case AESDCHAR_IOCGCOMPSTATS:{
+            struct aesd_compress_stats st;
+
+            if( mutex_lock_interruptible( &aesd_device.mtx ) ){
+                return -ERESTARTSYS;
+            }
+
+            st = aesd_device.cstats;
+            mutex_unlock( &aesd_device.mtx );
+            st.enabled = compress && aesd_compress_available();
+
+            if( copy_to_user( ( struct aesd_compress_stats __user * )arg, &st, sizeof( st ) ) ){
+                return -EFAULT;
+            }
+
+            return 0;
+        }
+
         default:
             return -EINVAL;
     }
@@ -256,6 +423,12 @@ static int aesd_init_module(void)
         return result;
     }
     memset(&aesd_device,0,sizeof(struct aesd_dev));
+    mutex_init( &aesd_device.mtx );
+
+    if( compress && aesd_compress_init() ){
+        printk(KERN_WARNING "aesdchar: compression unavailable, storing records raw\n");
+        compress = false;
+    }
 
     result = aesd_setup_cdev(&aesd_device);
 
@@ -285,6 +458,10 @@ static void aesd_cleanup_module(void){
         g_buff = NULL;
     }
 
+    kfree( g_plain );
+    g_plain = NULL;
+    aesd_compress_cleanup();
+
     unregister_chrdev_region(devno, 1);
 }
 
@@ -0,0 +1,1084 @@
+#define _GNU_SOURCE
+#include "aesd_client.h"
+#include "aesd_proto.h"
+#include "../aesd-char-driver/aesd_ioctl.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_PORT    "9000"
+#define IN_SIZE         ( 64 * 1024 )
+#define OUT_HIGH_WATER  ( 256 * 1024 )  /* queued bytes a new request tries to send right away */
+
+enum kind {
+    KIND_FRAMED = 0,
+    KIND_TEXT,
+    KIND_DEVICE
+};
+
+enum state {
+    REQ_WAITING = 0,    /* queued or sent, no reply yet */
+    REQ_READY,          /* complete, the callback is due */
+    REQ_DONE            /* the callback ran */
+};
+
+struct request {
+    uint64_t        seq;
+    aesd_client_cb  cb;
+    void*           arg;
+    enum state      state;
+    int             status;
+    int             fd;         /* text protocol reply connection, -1 otherwise */
+    bool            append;     /* text protocol append, complete when its round is closed */
+    char*           cmd;        /* text protocol command held back until earlier appends completed */
+    char*           data;
+    size_t          len;
+    size_t          size;
+};
+
+struct aesd_client {
+    enum kind               kind;
+    int                     fd;
+    int                     error;      /* negative errno once the connection failed */
+    struct sockaddr_storage addr;       /* of the server, for text protocol replies */
+    socklen_t               addrlen;
+
+    /* requests in seq order, reqs[ i ] has seq base + i, those before first are gone */
+    struct request*         reqs;
+    size_t                  first;
+    size_t                  count;
+    size_t                  cap;
+    uint64_t                base;
+    size_t                  outstanding;    /* callbacks not run yet */
+    size_t                  ready;          /* callbacks due */
+    size_t                  replies;        /* text protocol reply connections */
+    size_t                  held;           /* text protocol commands not sent yet */
+    bool                    closing;        /* text protocol round half closed, see round_close() */
+    uint64_t                round_end;      /* first seq after the appends of the closing round */
+
+    char*                   out;        /* unsent bytes are out[ out_off, out_len ) */
+    size_t                  out_off;
+    size_t                  out_len;
+    size_t                  out_size;
+
+    char*                   in;
+    size_t                  in_len;
+    bool                    magic;      /* the server confirmed framing */
+    bool                    in_frame;   /* frame holds the header of the payload being read */
+    struct aesd_frame       frame;
+    size_t                  frame_left;
+
+    struct pollfd*          pfds;
+    uint64_t*               pseqs;      /* request of pfds[ i + 1 ] */
+    size_t                  npfds;
+};
+
+struct aesd_pool {
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;       /* a client was put back or closed */
+    char*                   target;
+    int                     flags;
+    unsigned                size;
+    unsigned                open;       /* clients idle or in use */
+    unsigned                nidle;
+    struct aesd_client**    idle;
+};
+
+static int connect_to( struct sockaddr const* addr, socklen_t len );
+
+static bool buf_add( char** buf, size_t* len, size_t* size, void const* src, size_t n ){
+    if( n == 0 ){
+        return true;
+    }
+
+    if( *len + n > *size ){
+        size_t want = *size ? *size : 256;
+        char* grown;
+
+        while( want < *len + n ){
+            want *= 2;
+        }
+
+        if( ( grown = realloc( *buf, want ) ) == NULL ){
+            return false;
+        }
+
+        *buf = grown;
+        *size = want;
+    }
+
+    memcpy( *buf + *len, src, n );
+    *len += n;
+    return true;
+}
+
+static struct request* find( struct aesd_client* c, uint64_t seq ){
+    if( seq < c->base + c->first || seq >= c->base + c->count ){
+        return NULL;
+    }
+
+    return &c->reqs[ seq - c->base ];
+}
+
+static struct request* new_request( struct aesd_client* c, aesd_client_cb cb, void* arg ){
+    struct request* r;
+
+    if( c->count == c->cap ){
+        size_t cap = c->cap ? 2 * c->cap : 64;
+        struct request* grown = realloc( c->reqs, cap * sizeof( *grown ) );
+
+        if( !grown ){
+            return NULL;
+        }
+
+        c->reqs = grown;
+        c->cap = cap;
+    }
+
+    r = &c->reqs[ c->count ++ ];
+    memset( r, 0, sizeof( *r ) );
+    r->seq = c->base + c->count - 1;
+    r->cb = cb;
+    r->arg = arg;
+    r->fd = -1;
+    c->outstanding ++;
+    return r;
+}
+
+static void complete( struct aesd_client* c, struct request* r, int status ){
+    if( r->state != REQ_WAITING ){
+        return;
+    }
+
+    if( r->fd >= 0 ){
+        close( r->fd );
+        r->fd = -1;
+        c->replies --;
+    }
+
+    if( r->cmd ){
+        free( r->cmd );
+        r->cmd = NULL;
+        c->held --;
+    }
+
+    r->state = REQ_READY;
+    r->status = status;
+    c->ready ++;
+}
+
+// every request still waiting fails with @param err
+static void fail( struct aesd_client* c, int err ){
+    if( c->error == 0 ){
+        c->error = err;
+    }
+
+    for( size_t i = c->first; i < c->count; i ++ ){
+        complete( c, &c->reqs[ i ], err );
+    }
+
+    if( c->fd >= 0 ){
+        close( c->fd );
+        c->fd = -1;
+    }
+}
+
+/**
+ * Runs the due callbacks in seq order and forgets the requests in front that are done.
+ * @return the callbacks run.
+ */
+static int deliver( struct aesd_client* c ){
+    int ran = 0;
+
+    // a callback may queue requests and grow reqs, so nothing is kept across the call
+    for( size_t i = c->first; i < c->count && c->ready > 0; i ++ ){
+        struct request r = c->reqs[ i ];
+
+        if( r.state != REQ_READY ){
+            continue;
+        }
+
+        c->reqs[ i ].state = REQ_DONE;
+        c->reqs[ i ].data = NULL;
+        c->ready --;
+        c->outstanding --;
+
+        if( r.cb ){
+            r.cb( r.arg, r.status, r.data, r.len );
+        }
+
+        free( r.data );
+        ran ++;
+    }
+
+    while( c->first < c->count && c->reqs[ c->first ].state == REQ_DONE ){
+        c->first ++;
+    }
+
+    if( c->first == c->count ){
+        c->base += c->count;
+        c->first = c->count = 0;
+    }else if( c->first > c->cap / 2 ){
+        memmove( c->reqs, c->reqs + c->first, ( c->count - c->first ) * sizeof( *c->reqs ) );
+        c->base += c->first;
+        c->count -= c->first;
+        c->first = 0;
+    }
+
+    return ran;
+}
+
+static bool queue_out( struct aesd_client* c, void const* head, size_t head_len, void const* body, size_t body_len ){
+    if( c->out_off > 0 && c->out_len + head_len + body_len > c->out_size ){
+        c->out_len -= c->out_off;
+        memmove( c->out, c->out + c->out_off, c->out_len );
+        c->out_off = 0;
+    }
+
+    if( !buf_add( &c->out, &c->out_len, &c->out_size, head, head_len ) ){
+        return false;
+    }
+
+    if( !buf_add( &c->out, &c->out_len, &c->out_size, body, body_len ) ){
+        c->out_len -= head_len;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Text protocol appends go out in rounds, each on a connection of its own.  Once everything queued
+ * is sent the connection is half closed, the server closes it after the replay that follows the
+ * last record, so then every append of the round is committed and answered.  Appends queued
+ * meanwhile wait for the next round.
+ */
+static void round_close( struct aesd_client* c ){
+    if( c->fd >= 0 && !c->closing && c->out_off == c->out_len ){
+        if( shutdown( c->fd, SHUT_WR ) < 0 ){
+            fail( c, -errno );
+            return;
+        }
+
+        c->closing = true;
+        c->round_end = c->base + c->count;
+    }
+}
+
+static void round_closed( struct aesd_client* c ){
+    for( size_t i = c->first; i < c->count && c->reqs[ i ].seq < c->round_end; i ++ ){
+        if( c->reqs[ i ].append ){
+            complete( c, &c->reqs[ i ], AESD_STATUS_OK );
+        }
+    }
+
+    close( c->fd );
+    c->fd = -1;
+    c->closing = false;
+}
+
+/**
+ * Opens the connection of the next text protocol round.
+ * @return false when the client failed.
+ */
+static bool round_open( struct aesd_client* c ){
+    if( c->fd < 0 && ( ( c->fd = connect_to( ( struct sockaddr* )&c->addr, c->addrlen ) ) < 0 ||
+                       fcntl( c->fd, F_SETFL, O_NONBLOCK ) < 0 ) ){
+        fail( c, -errno );
+    }
+
+    return c->error == 0;
+}
+
+static void send_out( struct aesd_client* c ){
+    while( c->fd >= 0 && !c->closing && c->out_off < c->out_len ){
+        ssize_t n = send( c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL | MSG_DONTWAIT );
+
+        if( n < 0 ){
+            if( errno == EINTR ){
+                continue;
+            }
+
+            if( errno != EAGAIN ){
+                fail( c, -errno );
+            }
+
+            break;
+        }
+
+        c->out_off += n;
+    }
+
+    if( c->out_off == c->out_len ){
+        c->out_off = c->out_len = 0;
+    }
+
+    if( c->kind == KIND_TEXT ){
+        round_close( c );
+    }
+}
+
+// a full pipeline is pushed out early so the queue does not grow without bound
+static void queued( struct aesd_client* c ){
+    if( c->out_len - c->out_off >= OUT_HIGH_WATER ){
+        send_out( c );
+    }
+}
+
+static bool frame_payload( struct aesd_client* c, char const* p, size_t n ){
+    struct request* r = find( c, c->frame.seq );
+
+    // replies to requests that already failed are dropped
+    return !r || r->state != REQ_WAITING || buf_add( &r->data, &r->len, &r->size, p, n );
+}
+
+static void parse_frames( struct aesd_client* c ){
+    size_t pos = 0, take;
+    struct request* r;
+
+    if( !c->magic ){
+        if( c->in_len < AESD_PROTO_MAGIC_LEN ){
+            if( !aesd_proto_is_magic( c->in, c->in_len ) ){
+                fail( c, -EPROTO );
+            }
+
+            return;
+        }
+
+        if( !aesd_proto_is_magic( c->in, c->in_len ) ){
+            fail( c, -EPROTO );
+            return;
+        }
+
+        c->magic = true;
+        pos = AESD_PROTO_MAGIC_LEN;
+    }
+
+    for( ;; ){
+        if( !c->in_frame ){
+            if( c->in_len - pos < AESD_FRAME_HDR_LEN ){
+                break;
+            }
+
+            aesd_frame_decode( ( uint8_t const* )c->in + pos, &c->frame );
+            pos += AESD_FRAME_HDR_LEN;
+
+            if( !( c->frame.op & AESD_OP_REPLY ) ){
+                fail( c, -EPROTO );
+                return;
+            }
+
+            c->in_frame = true;
+            c->frame_left = c->frame.len;
+        }
+
+        take = c->in_len - pos < c->frame_left ? c->in_len - pos : c->frame_left;
+
+        if( take > 0 && !frame_payload( c, c->in + pos, take ) ){
+            fail( c, -ENOMEM );
+            return;
+        }
+
+        pos += take;
+        c->frame_left -= take;
+
+        if( c->frame_left > 0 ){
+            break;
+        }
+
+        c->in_frame = false;
+
+        if( !( c->frame.flags & AESD_FLAG_MORE ) && ( r = find( c, c->frame.seq ) ) != NULL ){
+            complete( c, r, c->frame.status );
+        }
+    }
+
+    c->in_len -= pos;
+    memmove( c->in, c->in + pos, c->in_len );
+}
+
+static void read_server( struct aesd_client* c ){
+    ssize_t n;
+
+    while( c->fd >= 0 ){
+        if( c->kind == KIND_TEXT ){
+            // the log the server streams back after every record
+            n = recv( c->fd, c->in, IN_SIZE, MSG_DONTWAIT );
+        }else{
+            n = recv( c->fd, c->in + c->in_len, IN_SIZE - c->in_len, MSG_DONTWAIT );
+        }
+
+        if( n == 0 && c->closing ){
+            round_closed( c );
+
+            if( c->out_off < c->out_len && round_open( c ) ){
+                send_out( c );
+            }
+        }else if( n == 0 ){
+            fail( c, -ECONNRESET );
+        }else if( n < 0 ){
+            if( errno != EAGAIN && errno != EINTR ){
+                fail( c, -errno );
+            }
+
+            if( errno != EINTR ){
+                break;
+            }
+        }else if( c->kind == KIND_FRAMED ){
+            c->in_len += n;
+            parse_frames( c );
+        }
+    }
+}
+
+static void read_reply( struct aesd_client* c, struct request* r ){
+    char buf[ 16 * 1024 ];
+    ssize_t n;
+
+    while( r->fd >= 0 ){
+        if( ( n = recv( r->fd, buf, sizeof( buf ), MSG_DONTWAIT ) ) == 0 ){
+            complete( c, r, AESD_STATUS_OK );
+        }else if( n < 0 ){
+            if( errno != EAGAIN && errno != EINTR ){
+                complete( c, r, -errno );
+            }
+
+            if( errno != EINTR ){
+                break;
+            }
+        }else if( !buf_add( &r->data, &r->len, &r->size, buf, n ) ){
+            complete( c, r, -ENOMEM );
+        }
+    }
+}
+
+static int connect_to( struct sockaddr const* addr, socklen_t len ){
+    int on = 1, fd = socket( addr->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+    if( fd < 0 ){
+        return -1;
+    }
+
+    while( connect( fd, addr, len ) < 0 ){
+        if( errno != EINTR ){
+            int err = errno;
+
+            close( fd );
+            errno = err;
+            return -1;
+        }
+    }
+
+    // requests are batched by the client, Nagle would only hold the last one back
+    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+    return fd;
+}
+
+/**
+ * Resolves "host[:port]" or "[v6]:port" and connects the client to the first address that works.
+ * @return false with errno set.
+ */
+static bool connect_server( struct aesd_client* c, char const* target ){
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res, *ai;
+    char* host = strdup( target );
+    char const* port = DEFAULT_PORT;
+    char* colon;
+    int rc;
+
+    if( !host ){
+        return false;
+    }
+
+    if( host[ 0 ] == '[' && ( colon = strchr( host, ']' ) ) != NULL ){
+        *colon = '\0';
+        port = colon[ 1 ] == ':' ? colon + 2 : port;
+        memmove( host, host + 1, strlen( host + 1 ) + 1 );
+    }else if( ( colon = strchr( host, ':' ) ) != NULL && colon == strrchr( host, ':' ) ){
+        *colon = '\0';
+        port = colon + 1;
+    }
+
+    if( ( rc = getaddrinfo( host, port, &hints, &res ) ) != 0 ){
+        free( host );
+        errno = rc == EAI_SYSTEM ? errno : EHOSTUNREACH;
+        return false;
+    }
+
+    free( host );
+    errno = EHOSTUNREACH;
+
+    for( ai = res; ai; ai = ai->ai_next ){
+        if( ( c->fd = connect_to( ai->ai_addr, ai->ai_addrlen ) ) >= 0 ){
+            memcpy( &c->addr, ai->ai_addr, ai->ai_addrlen );
+            c->addrlen = ai->ai_addrlen;
+            break;
+        }
+    }
+
+    freeaddrinfo( res );
+    return c->fd >= 0 && fcntl( c->fd, F_SETFL, O_NONBLOCK ) == 0;
+}
+
+struct aesd_client* aesd_client_open( char const* target, int flags ){
+    struct aesd_client* c = calloc( 1, sizeof( *c ) );
+    int err;
+
+    if( !c ){
+        return NULL;
+    }
+
+    c->fd = -1;
+
+    if( target[ 0 ] == '/' ){
+        c->kind = KIND_DEVICE;
+        c->fd = open( target, O_RDWR | O_CLOEXEC );
+
+        if( c->fd >= 0 ){
+            return c;
+        }
+    }else{
+        c->kind = flags & AESD_CLIENT_TEXT ? KIND_TEXT : KIND_FRAMED;
+
+        // the magic goes out with the first requests
+        if( ( c->in = malloc( IN_SIZE ) ) != NULL && connect_server( c, target ) &&
+            ( c->kind == KIND_TEXT || queue_out( c, AESD_PROTO_MAGIC, AESD_PROTO_MAGIC_LEN, NULL, 0 ) ) ){
+            return c;
+        }
+    }
+
+    err = errno ? errno : ENOMEM;
+
+    if( c->fd >= 0 ){
+        close( c->fd );
+    }
+
+    free( c->in );
+    free( c->out );
+    free( c );
+    errno = err;
+    return NULL;
+}
+
+void aesd_client_close( struct aesd_client* c ){
+    if( !c ){
+        return;
+    }
+
+    if( c->outstanding > 0 ){
+        int fd = c->fd;
+
+        // a device is never failed, only its requests are cancelled
+        c->fd = -1;
+        fail( c, -ECANCELED );
+        c->fd = fd;
+        deliver( c );
+    }
+
+    if( c->fd >= 0 ){
+        close( c->fd );
+    }
+
+    free( c->reqs );
+    free( c->out );
+    free( c->in );
+    free( c->pfds );
+    free( c->pseqs );
+    free( c );
+}
+
+int aesd_client_fd( struct aesd_client const* c ){
+    return c->kind == KIND_DEVICE ? -1 : c->fd;
+}
+
+short aesd_client_events( struct aesd_client const* c ){
+    if( c->kind == KIND_DEVICE || c->fd < 0 ){
+        return 0;
+    }
+
+    return POLLIN | ( c->out_off < c->out_len && !c->closing ? POLLOUT : 0 );
+}
+
+size_t aesd_client_pending( struct aesd_client const* c ){
+    return c->outstanding;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// requests
+
+/**
+ * Queues a frame of @param op, or fails the request at once when the connection is gone.
+ */
+static int64_t request_frame( struct aesd_client* c, uint8_t op, void const* payload, size_t len,
+                              aesd_client_cb cb, void* arg ){
+    uint8_t hdr[ AESD_FRAME_HDR_LEN ];
+    struct aesd_frame f = { op, 0, 0, len, 0 };
+    struct request* r;
+
+    if( len > UINT32_MAX ){
+        return -EMSGSIZE;
+    }
+
+    if( ( r = new_request( c, cb, arg ) ) == NULL ){
+        return -ENOMEM;
+    }
+
+    f.seq = r->seq;
+    aesd_frame_encode( &f, hdr );
+
+    if( c->error ){
+        complete( c, r, c->error );
+    }else if( !queue_out( c, hdr, sizeof( hdr ), payload, len ) ){
+        c->count --;
+        c->outstanding --;
+        return -ENOMEM;
+    }
+
+    queued( c );
+    return f.seq;
+}
+
+/**
+ * Sends the held command of @param r on a connection of its own, the reply ends with it.
+ * @return 0 or a negative errno.
+ */
+static int send_text( struct aesd_client* c, struct request* r ){
+    size_t len = strlen( r->cmd );
+    int fd, err;
+
+    if( ( fd = connect_to( ( struct sockaddr* )&c->addr, c->addrlen ) ) < 0 ){
+        return -errno;
+    }
+
+    for( size_t off = 0; off < len; ){
+        ssize_t n = send( fd, r->cmd + off, len - off, MSG_NOSIGNAL );
+
+        if( n < 0 && errno != EINTR ){
+            err = -errno;
+            close( fd );
+            return err;
+        }
+
+        off += n > 0 ? n : 0;
+    }
+
+    if( shutdown( fd, SHUT_WR ) < 0 || fcntl( fd, F_SETFL, O_NONBLOCK ) < 0 ){
+        err = -errno;
+        close( fd );
+        return err;
+    }
+
+    free( r->cmd );
+    r->cmd = NULL;
+    c->held --;
+    r->fd = fd;
+    c->replies ++;
+    return 0;
+}
+
+// a command must see the appends queued before it, so it waits until their rounds are closed
+static void send_held( struct aesd_client* c ){
+    int err;
+
+    for( size_t i = c->first; i < c->count && c->held > 0; i ++ ){
+        struct request* r = &c->reqs[ i ];
+
+        if( r->state != REQ_WAITING ){
+            continue;
+        }
+
+        if( r->append ){
+            break;
+        }
+
+        if( r->cmd && ( err = send_text( c, r ) ) < 0 ){
+            complete( c, r, err );
+        }
+    }
+}
+
+/**
+ * Queues the text command @param cmd, sent once every earlier append completed.
+ */
+static int64_t request_text( struct aesd_client* c, char const* cmd, aesd_client_cb cb, void* arg ){
+    struct request* r;
+
+    if( c->error ){
+        return c->error;
+    }
+
+    if( ( r = new_request( c, cb, arg ) ) == NULL ){
+        return -ENOMEM;
+    }
+
+    if( ( r->cmd = strdup( cmd ) ) == NULL ){
+        c->count --;
+        c->outstanding --;
+        return -ENOMEM;
+    }
+
+    c->held ++;
+    send_held( c );
+    return r->seq;
+}
+
+// the device answers right away, the callback waits for the next poll
+static int64_t request_done( struct aesd_client* c, struct request* r, int status ){
+    if( status != 0 ){
+        free( r->data );
+        r->data = NULL;
+        r->len = 0;
+    }
+
+    complete( c, r, status );
+    return r->seq;
+}
+
+static int read_device( int fd, struct request* r, bool positioned, uint64_t off ){
+    char buf[ 16 * 1024 ];
+    ssize_t n;
+
+    for( ;; ){
+        n = positioned ? pread( fd, buf, sizeof( buf ), off + r->len ) : read( fd, buf, sizeof( buf ) );
+
+        if( n == 0 ){
+            return 0;
+        }
+
+        if( n < 0 ){
+            if( errno == EINTR ){
+                continue;
+            }
+
+            return -errno;
+        }
+
+        if( !buf_add( &r->data, &r->len, &r->size, buf, n ) ){
+            return -ENOMEM;
+        }
+    }
+}
+
+int64_t aesd_client_append( struct aesd_client* c, void const* buf, size_t len, aesd_client_cb cb, void* arg ){
+    struct request* r;
+
+    if( c->kind == KIND_FRAMED ){
+        return request_frame( c, AESD_OP_APPEND, buf, len, cb, arg );
+    }
+
+    if( ( r = new_request( c, cb, arg ) ) == NULL ){
+        return -ENOMEM;
+    }
+
+    if( c->kind == KIND_DEVICE ){
+        for( size_t off = 0; off < len; ){
+            ssize_t n = write( c->fd, ( char const* )buf + off, len - off );
+
+            if( n < 0 && errno != EINTR ){
+                return request_done( c, r, -errno );
+            }
+
+            off += n > 0 ? n : 0;
+        }
+
+        return request_done( c, r, 0 );
+    }
+
+    if( c->error || !round_open( c ) ){
+        return request_done( c, r, c->error );
+    }
+
+    if( !queue_out( c, buf, len, NULL, 0 ) ){
+        c->count --;
+        c->outstanding --;
+        return -ENOMEM;
+    }
+
+    r->append = true;
+    queued( c );
+    return r->seq;
+}
+
+int64_t aesd_client_replay_from( struct aesd_client* c, uint64_t off, aesd_client_cb cb, void* arg ){
+    uint8_t payload[ 8 ];
+    char cmd[ 64 ];
+    struct request* r;
+
+    switch( c->kind ){
+    case KIND_FRAMED:
+        aesd_proto_put_u64( payload, off );
+        return request_frame( c, AESD_OP_REPLAY_FROM, payload, sizeof( payload ), cb, arg );
+    case KIND_TEXT:
+        snprintf( cmd, sizeof( cmd ), "AESDCHAR_REPLAY_FROM:%llu\n", ( unsigned long long )off );
+        return request_text( c, cmd, cb, arg );
+    default:
+        if( ( r = new_request( c, cb, arg ) ) == NULL ){
+            return -ENOMEM;
+        }
+
+        return request_done( c, r, read_device( c->fd, r, true, off ) );
+    }
+}
+
+int64_t aesd_client_seek( struct aesd_client* c, uint32_t write_cmd, uint32_t write_cmd_offset,
+                          aesd_client_cb cb, void* arg ){
+    struct aesd_seekto seekto = { write_cmd, write_cmd_offset };
+    uint8_t payload[ 8 ];
+    char cmd[ 64 ];
+    struct request* r;
+
+    switch( c->kind ){
+    case KIND_FRAMED:
+        aesd_proto_put_u32( payload, write_cmd );
+        aesd_proto_put_u32( payload + 4, write_cmd_offset );
+        return request_frame( c, AESD_OP_SEEK, payload, sizeof( payload ), cb, arg );
+    case KIND_TEXT:
+        snprintf( cmd, sizeof( cmd ), "AESDCHAR_IOCSEEKTO:%u,%u\n", write_cmd, write_cmd_offset );
+        return request_text( c, cmd, cb, arg );
+    default:
+        if( ( r = new_request( c, cb, arg ) ) == NULL ){
+            return -ENOMEM;
+        }
+
+        if( ioctl( c->fd, AESDCHAR_IOCSEEKTO, &seekto ) < 0 ){
+            return request_done( c, r, -errno );
+        }
+
+        return request_done( c, r, read_device( c->fd, r, false, 0 ) );
+    }
+}
+
+int64_t aesd_client_stats( struct aesd_client* c, aesd_client_cb cb, void* arg ){
+    struct aesd_info info;
+    char stats[ 160 ];
+    struct request* r;
+    int len;
+
+    switch( c->kind ){
+    case KIND_FRAMED:
+        return request_frame( c, AESD_OP_STATS, NULL, 0, cb, arg );
+    case KIND_TEXT:
+        return request_text( c, "AESDCHAR_STATS\n", cb, arg );
+    default:
+        if( ( r = new_request( c, cb, arg ) ) == NULL ){
+            return -ENOMEM;
+        }
+
+        if( ioctl( c->fd, AESDCHAR_IOCGINFO, &info ) < 0 ){
+            return request_done( c, r, -errno );
+        }
+
+        len = snprintf( stats, sizeof( stats ), "bytes %llu\nrecords %u\noldest_seq %llu\nnewest_seq %llu\n",
+                        ( unsigned long long )info.size, info.records, ( unsigned long long )info.oldest_seq,
+                        ( unsigned long long )info.newest_seq );
+        return request_done( c, r, buf_add( &r->data, &r->len, &r->size, stats, len ) ? 0 : -ENOMEM );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// event loop
+
+static bool grow_pfds( struct aesd_client* c, size_t n ){
+    struct pollfd* pfds;
+    uint64_t* pseqs;
+
+    if( n <= c->npfds ){
+        return true;
+    }
+
+    if( ( pfds = realloc( c->pfds, n * sizeof( *pfds ) ) ) != NULL ){
+        c->pfds = pfds;
+    }
+
+    if( ( pseqs = realloc( c->pseqs, n * sizeof( *pseqs ) ) ) != NULL ){
+        c->pseqs = pseqs;
+    }
+
+    if( !pfds || !pseqs ){
+        return false;
+    }
+
+    c->npfds = n;
+    return true;
+}
+
+int aesd_client_poll( struct aesd_client* c, int timeout_ms ){
+    size_t n = 1;
+    int ran;
+
+    if( c->kind == KIND_DEVICE ){
+        return deliver( c );
+    }
+
+    send_out( c );
+    send_held( c );
+
+    if( c->fd < 0 && c->replies == 0 ){
+        ran = deliver( c );
+        return c->error ? c->error : ran;
+    }
+
+    if( !grow_pfds( c, c->replies + 1 ) ){
+        return -ENOMEM;
+    }
+
+    c->pfds[ 0 ].fd = c->fd;
+    c->pfds[ 0 ].events = aesd_client_events( c );
+
+    for( size_t i = c->first; i < c->count && n < c->replies + 1; i ++ ){
+        if( c->reqs[ i ].fd >= 0 ){
+            c->pfds[ n ].fd = c->reqs[ i ].fd;
+            c->pfds[ n ].events = POLLIN;
+            c->pseqs[ n ++ ] = c->reqs[ i ].seq;
+        }
+    }
+
+    if( poll( c->pfds, n, c->ready > 0 ? 0 : timeout_ms ) > 0 ){
+        if( c->pfds[ 0 ].revents & ( POLLIN | POLLHUP | POLLERR ) ){
+            read_server( c );
+        }
+
+        if( c->pfds[ 0 ].revents & POLLOUT ){
+            send_out( c );
+        }
+
+        for( size_t i = 1; i < n; i ++ ){
+            if( c->pfds[ i ].revents ){
+                read_reply( c, find( c, c->pseqs[ i ] ) );
+            }
+        }
+
+        send_held( c );
+    }
+
+    ran = deliver( c );
+    return c->error ? c->error : ran;
+}
+
+static int64_t now_ms( void ){
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+int aesd_client_drain( struct aesd_client* c, int timeout_ms ){
+    int64_t deadline = now_ms() + timeout_ms, left = timeout_ms;
+    int rc = 0;
+
+    while( c->outstanding > 0 ){
+        if( timeout_ms >= 0 && ( left = deadline - now_ms() ) < 0 ){
+            return -ETIMEDOUT;
+        }
+
+        if( ( rc = aesd_client_poll( c, timeout_ms < 0 ? -1 : left ) ) < 0 && c->outstanding == 0 ){
+            return rc;
+        }
+    }
+
+    return c->error;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// pool
+
+struct aesd_pool* aesd_pool_create( char const* target, int flags, unsigned size ){
+    struct aesd_pool* p = calloc( 1, sizeof( *p ) );
+
+    if( !p ){
+        return NULL;
+    }
+
+    p->target = strdup( target );
+    p->idle = calloc( size, sizeof( *p->idle ) );
+
+    if( !p->target || !p->idle || size == 0 ){
+        free( p->target );
+        free( p->idle );
+        free( p );
+        return NULL;
+    }
+
+    pthread_mutex_init( &p->lock, NULL );
+    pthread_cond_init( &p->cond, NULL );
+    p->flags = flags;
+    p->size = size;
+    return p;
+}
+
+void aesd_pool_destroy( struct aesd_pool* p ){
+    if( !p ){
+        return;
+    }
+
+    while( p->nidle > 0 ){
+        aesd_client_close( p->idle[ -- p->nidle ] );
+    }
+
+    pthread_cond_destroy( &p->cond );
+    pthread_mutex_destroy( &p->lock );
+    free( p->idle );
+    free( p->target );
+    free( p );
+}
+
+struct aesd_client* aesd_pool_get( struct aesd_pool* p ){
+    struct aesd_client* c = NULL;
+    int err;
+
+    pthread_mutex_lock( &p->lock );
+
+    while( p->nidle == 0 && p->open == p->size ){
+        pthread_cond_wait( &p->cond, &p->lock );
+    }
+
+    if( p->nidle > 0 ){
+        c = p->idle[ -- p->nidle ];
+    }else{
+        p->open ++;
+    }
+
+    pthread_mutex_unlock( &p->lock );
+
+    // connecting is left out of the lock
+    if( !c && ( c = aesd_client_open( p->target, p->flags ) ) == NULL ){
+        err = errno;
+        pthread_mutex_lock( &p->lock );
+        p->open --;
+        pthread_cond_signal( &p->cond );
+        pthread_mutex_unlock( &p->lock );
+        errno = err;
+    }
+
+    return c;
+}
+
+void aesd_pool_put( struct aesd_pool* p, struct aesd_client* c ){
+    bool failed = aesd_client_drain( c, -1 ) < 0;
+
+    if( failed ){
+        aesd_client_close( c );
+    }
+
+    pthread_mutex_lock( &p->lock );
+
+    if( failed ){
+        p->open --;
+    }else{
+        p->idle[ p->nidle ++ ] = c;
+    }
+
+    pthread_cond_signal( &p->cond );
+    pthread_mutex_unlock( &p->lock );
+}
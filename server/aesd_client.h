@@ -0,0 +1,128 @@
+#pragma once
+/*
+ * libaesdclient, a client of aesdsocket and of the aesdchar device.
+ *
+ * A client is opened on a target, "host[:port]" for a server or the path of a device such as
+ * /dev/aesdchar when running next to the driver.  Requests never block: they are queued, sent by
+ * aesd_client_poll() and answered through a callback run from aesd_client_poll(), so any number of
+ * them may be in flight on one connection.  A client belongs to one thread at a time, the pool
+ * hands clients out to threads.
+ *
+ * With a server the client speaks the framed protocol of aesd_proto.h and matches replies by seq.
+ * AESD_CLIENT_TEXT selects the newline protocol instead for servers without framing.  Text replies
+ * carry no length, so connections are half closed and a reply ends with its connection.  Appends
+ * are pipelined in rounds on one connection that is half closed once all of them are sent, they
+ * complete when the server closes it after replaying the log for the last one, the replays are
+ * dropped.  Replays, seeks and stats each take a connection of their own, opened once every
+ * earlier append completed, and an empty reply is all a failed command gets.  The device serves
+ * every request right away through write(), pread() and the AESDCHAR_IOCSEEKTO and
+ * AESDCHAR_IOCGINFO ioctls, the callbacks still run from aesd_client_poll().
+ *
+ * Request functions return the seq of the request or a negative errno.  A callback gets the status
+ * of the reply, an enum aesd_proto_status or a negative errno for local and connection failures,
+ * and the reply payload, valid for the duration of the call.  A callback may queue further requests
+ * but must neither poll nor close the client.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AESD_CLIENT_TEXT    0x1     /* newline protocol instead of frames */
+
+struct aesd_client;
+struct aesd_pool;
+
+typedef void ( *aesd_client_cb )( void* arg, int status, char const* data, size_t len );
+
+/**
+ * Connects to the server or opens the device named by @param target.
+ * @return the client, NULL with errno set on failure.
+ */
+struct aesd_client* aesd_client_open( char const* target, int flags );
+
+/**
+ * Closes @param c, callbacks of requests still outstanding run with -ECANCELED first.
+ */
+void aesd_client_close( struct aesd_client* c );
+
+/**
+ * @return the socket to watch in an event loop of the caller, -1 for a device.  With
+ * AESD_CLIENT_TEXT it changes from one round of appends to the next and replies arrive on sockets
+ * of their own, only aesd_client_poll() waits for all of them.
+ */
+int aesd_client_fd( struct aesd_client const* c );
+
+/**
+ * @return the poll() events the client waits for, POLLOUT only while requests are unsent.
+ */
+short aesd_client_events( struct aesd_client const* c );
+
+/**
+ * @return requests whose callback has not run yet.
+ */
+size_t aesd_client_pending( struct aesd_client const* c );
+
+/**
+ * Appends @param len bytes of @param buf to the log, records end with a newline as always.
+ */
+int64_t aesd_client_append( struct aesd_client* c, void const* buf, size_t len, aesd_client_cb cb, void* arg );
+
+/**
+ * Asks for the log from byte @param off on.
+ */
+int64_t aesd_client_replay_from( struct aesd_client* c, uint64_t off, aesd_client_cb cb, void* arg );
+
+/**
+ * Asks for the log from byte @param write_cmd_offset of record @param write_cmd on, as
+ * AESDCHAR_IOCSEEKTO.
+ */
+int64_t aesd_client_seek( struct aesd_client* c, uint32_t write_cmd, uint32_t write_cmd_offset,
+                          aesd_client_cb cb, void* arg );
+
+/**
+ * Asks for the "name value" statistics lines of the server or the device.
+ */
+int64_t aesd_client_stats( struct aesd_client* c, aesd_client_cb cb, void* arg );
+
+/**
+ * Sends what is queued, reads what has arrived and runs the callbacks of completed requests,
+ * waiting up to @param timeout_ms (-1 forever) when there is nothing to do yet.
+ * @return the callbacks run, a negative errno once the connection failed.
+ */
+int aesd_client_poll( struct aesd_client* c, int timeout_ms );
+
+/**
+ * Polls until no request is outstanding.
+ * @return 0, -ETIMEDOUT after @param timeout_ms or the errno of a failed connection.
+ */
+int aesd_client_drain( struct aesd_client* c, int timeout_ms );
+
+/**
+ * Creates a pool of up to @param size clients of @param target, connected when first needed.
+ * @return NULL when out of memory.
+ */
+struct aesd_pool* aesd_pool_create( char const* target, int flags, unsigned size );
+
+/**
+ * Closes the idle clients and frees @param p, every client has to be put back before.
+ */
+void aesd_pool_destroy( struct aesd_pool* p );
+
+/**
+ * Takes a client from @param p, waiting while all are in use.
+ * @return NULL with errno set when a new client could not be opened.
+ */
+struct aesd_client* aesd_pool_get( struct aesd_pool* p );
+
+/**
+ * Returns @param c to @param p after draining it, a failed client is closed and replaced on a
+ * later aesd_pool_get().
+ */
+void aesd_pool_put( struct aesd_pool* p, struct aesd_client* c );
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,223 @@
+#pragma once
+/*
+ * RAII wrapper of libaesdclient, see aesd_client.h.  Requests take a callback or return a future,
+ * both are completed by poll(), drain() or get() on the thread that owns the client, so waiting
+ * on a future without polling never returns.  Failures to open or to queue throw
+ * std::system_error, failed requests complete with a negative status.
+ */
+#include "aesd_client.h"
+
+#include <cerrno>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+
+namespace aesd {
+
+struct Reply {
+    int             status;     /* enum aesd_proto_status, negative errno for local failures */
+    std::string     data;
+
+    bool ok() const { return status == 0; }
+};
+
+using Callback = std::function<void( Reply&& )>;
+
+/*
+ * The requests of a client owned elsewhere, a Client or a Pool::Lease.
+ */
+class ClientRef {
+public:
+    explicit ClientRef( aesd_client* c ) : c_( c ) {}
+
+    aesd_client* get() const { return c_; }
+    int fd() const { return aesd_client_fd( c_ ); }
+    size_t pending() const { return aesd_client_pending( c_ ); }
+
+    void append( std::string const& data, Callback cb ){
+        submit( std::move( cb ), [ & ]( aesd_client_cb f, void* arg ){
+            return aesd_client_append( c_, data.data(), data.size(), f, arg );
+        } );
+    }
+
+    void replay_from( uint64_t off, Callback cb ){
+        submit( std::move( cb ), [ & ]( aesd_client_cb f, void* arg ){
+            return aesd_client_replay_from( c_, off, f, arg );
+        } );
+    }
+
+    void seek( uint32_t write_cmd, uint32_t write_cmd_offset, Callback cb ){
+        submit( std::move( cb ), [ & ]( aesd_client_cb f, void* arg ){
+            return aesd_client_seek( c_, write_cmd, write_cmd_offset, f, arg );
+        } );
+    }
+
+    void stats( Callback cb ){
+        submit( std::move( cb ), [ & ]( aesd_client_cb f, void* arg ){
+            return aesd_client_stats( c_, f, arg );
+        } );
+    }
+
+    std::future<Reply> append( std::string const& data ){
+        return promised( [ & ]( Callback cb ){ append( data, std::move( cb ) ); } );
+    }
+
+    std::future<Reply> replay_from( uint64_t off ){
+        return promised( [ & ]( Callback cb ){ replay_from( off, std::move( cb ) ); } );
+    }
+
+    std::future<Reply> seek( uint32_t write_cmd, uint32_t write_cmd_offset ){
+        return promised( [ & ]( Callback cb ){ seek( write_cmd, write_cmd_offset, std::move( cb ) ); } );
+    }
+
+    std::future<Reply> stats(){
+        return promised( [ & ]( Callback cb ){ stats( std::move( cb ) ); } );
+    }
+
+    /**
+     * As aesd_client_poll(), a failed connection is reported through the requests.
+     */
+    int poll( int timeout_ms = -1 ){
+        return aesd_client_poll( c_, timeout_ms );
+    }
+
+    /**
+     * @return false on timeout or a failed connection.
+     */
+    bool drain( int timeout_ms = -1 ){
+        return aesd_client_drain( c_, timeout_ms ) == 0;
+    }
+
+    /**
+     * Polls until @param f is ready.
+     */
+    Reply get( std::future<Reply>& f ){
+        while( f.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready ){
+            poll();
+        }
+
+        return f.get();
+    }
+
+protected:
+    aesd_client* c_;
+
+private:
+    static void trampoline( void* arg, int status, char const* data, size_t len ){
+        std::unique_ptr<Callback> cb( static_cast<Callback*>( arg ) );
+
+        ( *cb )( Reply{ status, std::string( data ? data : "", len ) } );
+    }
+
+    template<class Request>
+    void submit( Callback cb, Request request ){
+        std::unique_ptr<Callback> owned( new Callback( std::move( cb ) ) );
+        int64_t seq = request( &ClientRef::trampoline, owned.get() );
+
+        if( seq < 0 ){
+            throw std::system_error( static_cast<int>( -seq ), std::generic_category(), "aesd request" );
+        }
+
+        owned.release();
+    }
+
+    template<class Request>
+    static std::future<Reply> promised( Request request ){
+        auto promise = std::make_shared<std::promise<Reply>>();
+
+        request( [ promise ]( Reply&& r ){ promise->set_value( std::move( r ) ); } );
+        return promise->get_future();
+    }
+};
+
+class Client : public ClientRef {
+public:
+    /**
+     * Connects to "host[:port]" or opens a device path, @param flags as for aesd_client_open().
+     */
+    explicit Client( std::string const& target, int flags = 0 ) : ClientRef( aesd_client_open( target.c_str(), flags ) ){
+        if( !c_ ){
+            throw std::system_error( errno, std::generic_category(), "aesd_client_open " + target );
+        }
+    }
+
+    Client( Client&& other ) noexcept : ClientRef( other.c_ ){
+        other.c_ = nullptr;
+    }
+
+    Client& operator=( Client&& other ) noexcept {
+        std::swap( c_, other.c_ );
+        return *this;
+    }
+
+    Client( Client const& ) = delete;
+    Client& operator=( Client const& ) = delete;
+
+    ~Client(){
+        aesd_client_close( c_ );
+    }
+};
+
+class Pool {
+public:
+    /*
+     * A client taken from the pool, put back when the lease ends.
+     */
+    class Lease : public ClientRef {
+    public:
+        Lease( Lease&& other ) noexcept : ClientRef( other.c_ ), pool_( other.pool_ ){
+            other.c_ = nullptr;
+        }
+
+        Lease( Lease const& ) = delete;
+        Lease& operator=( Lease const& ) = delete;
+        Lease& operator=( Lease&& ) = delete;
+
+        ~Lease(){
+            if( c_ ){
+                aesd_pool_put( pool_, c_ );
+            }
+        }
+
+    private:
+        friend class Pool;
+
+        Lease( aesd_pool* pool, aesd_client* c ) : ClientRef( c ), pool_( pool ) {}
+
+        aesd_pool* pool_;
+    };
+
+    Pool( std::string const& target, unsigned size, int flags = 0 ) : p_( aesd_pool_create( target.c_str(), flags, size ) ){
+        if( !p_ ){
+            throw std::system_error( ENOMEM, std::generic_category(), "aesd_pool_create" );
+        }
+    }
+
+    Pool( Pool const& ) = delete;
+    Pool& operator=( Pool const& ) = delete;
+
+    ~Pool(){
+        aesd_pool_destroy( p_ );
+    }
+
+    /**
+     * Waits for a free client, every lease has to end before the pool.
+     */
+    Lease lease(){
+        aesd_client* c = aesd_pool_get( p_ );
+
+        if( !c ){
+            throw std::system_error( errno, std::generic_category(), "aesd_pool_get" );
+        }
+
+        return Lease( p_, c );
+    }
+
+private:
+    aesd_pool* p_;
+};
+
+} // namespace aesd
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "aesd_cmd.h"
+
+#include <string.h>
+#include <unistd.h>
+
+struct cmd_spec {
+    char const*         name;   /* after the prefix, including the ':' of commands with arguments */
+    size_t              len;
+    enum aesd_cmd_id    id;
+    unsigned            nargs;  /* decimal arguments, separated by ',' */
+};
+
+#define CMD_SPEC( name, id, nargs ) { name, sizeof( name ) - 1, id, nargs }
+
+static const struct cmd_spec specs[] = {
+    CMD_SPEC( "IOCSEEKTO:", AESD_CMD_SEEKTO, 2 ),
+    CMD_SPEC( "STATS", AESD_CMD_STATS, 0 ),
+    CMD_SPEC( "SIZE", AESD_CMD_SIZE, 0 ),
+    CMD_SPEC( "REPLAY_FROM:", AESD_CMD_REPLAY_FROM, 1 ),
+    CMD_SPEC( "TAIL:", AESD_CMD_TAIL, 1 ),
+    CMD_SPEC( "LATENCY", AESD_CMD_LATENCY, 0 ),
+};
+
+/**
+ * Parses a decimal number at *@param p, advancing it.
+ * @return false when there is no digit or the value overflows.
+ */
+static bool parse_u64( char const** p, char const* end, uint64_t* out ){
+    char const* s = *p;
+    uint64_t v = 0;
+
+    for( ; s < end && *s >= '0' && *s <= '9'; s ++ ){
+        if( v > ( UINT64_MAX - ( *s - '0' ) ) / 10 ){
+            return false;
+        }
+
+        v = v * 10 + ( *s - '0' );
+    }
+
+    if( s == *p ){
+        return false;
+    }
+
+    *p = s;
+    *out = v;
+    return true;
+}
+
+enum aesd_cmd_id aesd_cmd_parse( char const* buf, size_t len, struct aesd_cmd* cmd ){
+    char const* end = buf + len;
+
+    cmd->id = AESD_CMD_NONE;
+
+    // the only cost for a log record
+    if( len <= AESD_CMD_PREFIX_LEN || buf[ 0 ] != 'A' || memcmp( buf, AESD_CMD_PREFIX, AESD_CMD_PREFIX_LEN ) != 0 ){
+        return AESD_CMD_NONE;
+    }
+
+    buf += AESD_CMD_PREFIX_LEN;
+
+    if( end[ -1 ] == '\n' ){
+        end --;
+    }
+
+    for( size_t i = 0; i < sizeof( specs ) / sizeof( specs[ 0 ] ); i ++ ){
+        struct cmd_spec const* s = &specs[ i ];
+        char const* p = buf + s->len;
+
+        if( ( size_t )( end - buf ) < s->len || memcmp( buf, s->name, s->len ) != 0 ){
+            continue;
+        }
+
+        for( unsigned a = 0; a < s->nargs; a ++ ){
+            if( ( a > 0 && ( p == end || *p ++ != ',' ) ) || !parse_u64( &p, end, &cmd->arg[ a ] ) ){
+                return AESD_CMD_NONE;
+            }
+        }
+
+        if( p != end ){
+            return AESD_CMD_NONE;
+        }
+
+        cmd->id = s->id;
+        return cmd->id;
+    }
+
+    return AESD_CMD_NONE;
+}
+
+uint64_t aesd_cmd_reply_base( char const* buf, size_t len, uint64_t lines_end, uint64_t start ){
+    char const* nl = memrchr( buf, '\n', len );
+    uint64_t counted = nl ? ( uint64_t )( nl - buf ) + 1 : 0;
+
+    return lines_end >= start + counted ? lines_end - counted : start;
+}
+
+bool aesd_cmd_tail_offset( int fd, uint64_t end, uint64_t records, char* scratch, size_t scratch_len,
+                           uint64_t* off ){
+    uint64_t pos = end, seen = 0;
+
+    // the newline ending the last record is the first one seen, records + 1 newlines back is the start
+    while( pos > 0 ){
+        size_t want = pos < scratch_len ? pos : scratch_len;
+        size_t got = 0;
+
+        while( got < want ){
+            ssize_t rn = pread( fd, scratch + got, want - got, pos - want + got );
+
+            if( rn <= 0 ){
+                return false;
+            }
+
+            got += rn;
+        }
+
+        for( char const* p = scratch + want; ( p = memrchr( scratch, '\n', p - scratch ) ) != NULL; ){
+            if( ++ seen > records ){
+                *off = pos - want + ( p - scratch ) + 1;
+                return true;
+            }
+        }
+
+        pos -= want;
+    }
+
+    *off = 0;
+    return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Commands of the text protocol.  A message starting with AESD_CMD_PREFIX is looked up in a
+ * table of command names, anything else is a log record, so ordinary lines cost one compare of
+ * their first bytes.  Every engine keeps its own handler table indexed by enum aesd_cmd_id.
+ *
+ *  AESDCHAR_IOCSEEKTO:<cmd>,<off>  device contents from that position on, see aesd_ioctl.h
+ *  AESDCHAR_STATS                  "name value" lines
+ *  AESDCHAR_SIZE                   log size in bytes
+ *  AESDCHAR_REPLAY_FROM:<off>      the log from byte <off> on
+ *  AESDCHAR_TAIL:<n>               the last <n> records of the log
+ *  AESDCHAR_LATENCY                per stage latency, see aesd_latency.h
+ */
+
+#define AESD_CMD_PREFIX     "AESDCHAR_"
+#define AESD_CMD_PREFIX_LEN ( sizeof( AESD_CMD_PREFIX ) - 1 )
+
+enum aesd_cmd_id {
+    AESD_CMD_NONE = 0,
+    AESD_CMD_SEEKTO,
+    AESD_CMD_STATS,
+    AESD_CMD_SIZE,
+    AESD_CMD_REPLAY_FROM,
+    AESD_CMD_TAIL,
+    AESD_CMD_LATENCY,
+    AESD_CMD_COUNT
+};
+
+struct aesd_cmd {
+    enum aesd_cmd_id    id;
+    uint64_t            arg[ 2 ];
+};
+
+/**
+ * Parses a command from the message @param buf, a trailing newline is optional.
+ * @return the command, AESD_CMD_NONE when the message is a log record.
+ */
+enum aesd_cmd_id aesd_cmd_parse( char const* buf, size_t len, struct aesd_cmd* cmd );
+
+/**
+ * Finds where a chunk @param buf just written starts in a log that only counts complete records,
+ * as the device does, from @param lines_end, the log size after the write.  The partial line
+ * after the last newline of @param buf is not part of it yet.
+ * @return the offset of the first byte of @param buf, not before @param start.
+ */
+uint64_t aesd_cmd_reply_base( char const* buf, size_t len, uint64_t lines_end, uint64_t start );
+
+/**
+ * Finds where the last @param records records of the log end at @param end start, by reading
+ * @param fd backwards into @param scratch.
+ * @return false on a read error.
+ */
+bool aesd_cmd_tail_offset( int fd, uint64_t end, uint64_t records, char* scratch, size_t scratch_len,
+                           uint64_t* off );
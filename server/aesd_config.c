@@ -0,0 +1,390 @@
+#include "aesd_config.h"
+#include "aesdsocket_cfg.h"
+
+#include <ctype.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+enum {
+    OPT_MAXLINE = 256,
+    OPT_BUFFSIZE,
+    OPT_OUTQ_HIGH_WATER,
+    OPT_TIMESTAMPS,
+    OPT_NO_TIMESTAMPS,
+    OPT_TIMER_INTERVAL,
+    OPT_WORKER_AFFINITY,
+    OPT_DRAIN_TIMEOUT,
+    OPT_CONTROL_SOCKET,
+    OPT_TAKEOVER,
+    OPT_LOG,
+    OPT_MIRROR_SIZE,
+    OPT_REPLAY_WINDOW,
+    OPT_INDEX_FILE,
+    OPT_SEGMENT_SIZE,
+    OPT_RETAIN_BYTES,
+    OPT_RETAIN_SECS,
+    OPT_STATS_SOCKET,
+    OPT_CLIENT_RATE,
+    OPT_CLIENT_BURST,
+    OPT_IP_RATE,
+    OPT_IP_BURST
+};
+
+static const struct option long_options[] = {
+    { "daemon",             no_argument,        NULL, 'd' },
+    { "config",             required_argument,  NULL, 'c' },
+    { "port",               required_argument,  NULL, 'p' },
+    { "backlog",            required_argument,  NULL, 'b' },
+    { "backend",            required_argument,  NULL, 'f' },
+    { "engine",             required_argument,  NULL, 'e' },
+    { "durability",         required_argument,  NULL, 's' },
+    { "workers",            required_argument,  NULL, 'w' },
+    { "worker-affinity",    no_argument,        NULL, OPT_WORKER_AFFINITY },
+    { "maxline",            required_argument,  NULL, OPT_MAXLINE },
+    { "buffsize",           required_argument,  NULL, OPT_BUFFSIZE },
+    { "outq-high-water",    required_argument,  NULL, OPT_OUTQ_HIGH_WATER },
+    { "mirror-size",        required_argument,  NULL, OPT_MIRROR_SIZE },
+    { "replay-window",      required_argument,  NULL, OPT_REPLAY_WINDOW },
+    { "index-file",         required_argument,  NULL, OPT_INDEX_FILE },
+    { "segment-size",       required_argument,  NULL, OPT_SEGMENT_SIZE },
+    { "retain-bytes",       required_argument,  NULL, OPT_RETAIN_BYTES },
+    { "retain-secs",        required_argument,  NULL, OPT_RETAIN_SECS },
+    { "client-rate",        required_argument,  NULL, OPT_CLIENT_RATE },
+    { "client-burst",       required_argument,  NULL, OPT_CLIENT_BURST },
+    { "ip-rate",            required_argument,  NULL, OPT_IP_RATE },
+    { "ip-burst",           required_argument,  NULL, OPT_IP_BURST },
+    { "timestamps",         no_argument,        NULL, OPT_TIMESTAMPS },
+    { "no-timestamps",      no_argument,        NULL, OPT_NO_TIMESTAMPS },
+    { "timer-interval",     required_argument,  NULL, OPT_TIMER_INTERVAL },
+    { "drain-timeout",      required_argument,  NULL, OPT_DRAIN_TIMEOUT },
+    { "control-socket",     required_argument,  NULL, OPT_CONTROL_SOCKET },
+    { "takeover",           no_argument,        NULL, OPT_TAKEOVER },
+    { "stats-socket",       required_argument,  NULL, OPT_STATS_SOCKET },
+    { "log",                required_argument,  NULL, OPT_LOG },
+    { NULL, 0, NULL, 0 }
+};
+
+static const char short_options[] = "dc:p:b:f:e:s:w:";
+
+static bool timestamps_set = false;
+
+static void usage( char const* prog ){
+    fprintf( stderr,
+        "usage: %s [-d] [-c file] [-p port] [-b backlog] [-f backend] [-e threads|epoll]\n"
+        "          [-s none|interval=<ms>|every-record] [-w workers] [--worker-affinity]\n"
+        "          [--maxline n] [--buffsize n] [--mirror-size n] [--replay-window us]\n"
+        "          [--outq-high-water n] [--timestamps|--no-timestamps] [--timer-interval s]\n"
+        "          [--index-file path] [--segment-size n] [--retain-bytes n] [--retain-secs s]\n"
+        "          [--client-rate bytes/s] [--client-burst n] [--ip-rate bytes/s] [--ip-burst n]\n"
+        "          [--drain-timeout ms] [--control-socket path [--takeover]] [--stats-socket path]\n"
+        "          [--log syslog|stderr]\n"
+        "config file lines are <long option> = <value>, # starts a comment\n", prog );
+}
+
+static bool parse_size( char const* name, char const* value, size_t min, size_t* out ){
+    char* end = NULL;
+    unsigned long long v = strtoull( value, &end, 10 );
+
+    if( end == value || *end != '\0' || v < min ){
+        fprintf( stderr, "invalid %s: %s\n", name, value );
+        return false;
+    }
+
+    *out = v;
+    return true;
+}
+
+static bool set_option( struct aesd_config* cfg, int opt, char const* name, char const* value ){
+    size_t v;
+
+    switch( opt ){
+    case 'd':
+        cfg->daemon = true;
+        break;
+    case 'p':
+        if( !parse_size( name, value, 1, &v ) || v > 65535 ){
+            return false;
+        }
+        cfg->port = v;
+        break;
+    case 'b':
+        if( !parse_size( name, value, 1, &v ) ){
+            return false;
+        }
+        cfg->backlog = v;
+        break;
+    case 'f':
+        free( cfg->backend );
+        cfg->backend = strdup( value );
+        break;
+    case 'e':
+        if( 0 == strcmp( value, "threads" ) ){
+            cfg->engine = AESD_ENGINE_THREADS;
+        }else if( 0 == strcmp( value, "epoll" ) ){
+            cfg->engine = AESD_ENGINE_EPOLL;
+        }else{
+            fprintf( stderr, "invalid engine %s, use threads or epoll\n", value );
+            return false;
+        }
+        break;
+    case 's':
+        if( !aesd_durability_parse( value, &cfg->durability ) ){
+            fprintf( stderr, "invalid durability policy %s, use none, interval=<ms> or every-record\n", value );
+            return false;
+        }
+        break;
+    case 'w':
+        if( !parse_size( name, value, 1, &v ) || v > 1024 ){
+            return false;
+        }
+        cfg->workers = v;
+        break;
+    case OPT_WORKER_AFFINITY:
+        cfg->worker_affinity = true;
+        break;
+    case OPT_MAXLINE:
+        return parse_size( name, value, 2, &cfg->maxline );
+    case OPT_BUFFSIZE:
+        return parse_size( name, value, 1, &cfg->buffsize );
+    case OPT_OUTQ_HIGH_WATER:
+        return parse_size( name, value, 1, &cfg->outq_high_water );
+    case OPT_MIRROR_SIZE:
+        return parse_size( name, value, 0, &cfg->mirror_size );
+    case OPT_REPLAY_WINDOW:
+        if( !parse_size( name, value, 0, &v ) ){
+            return false;
+        }
+        cfg->replay_window_us = v;
+        break;
+    case OPT_TIMESTAMPS:
+    case OPT_NO_TIMESTAMPS:
+        cfg->timestamps = opt == OPT_TIMESTAMPS;
+        timestamps_set = true;
+        break;
+    case OPT_TIMER_INTERVAL:
+        if( !parse_size( name, value, 1, &v ) ){
+            return false;
+        }
+        cfg->timer_interval = v;
+        break;
+    case OPT_DRAIN_TIMEOUT:
+        if( !parse_size( name, value, 0, &v ) ){
+            return false;
+        }
+        cfg->drain_timeout_ms = v;
+        break;
+    case OPT_CONTROL_SOCKET:
+        free( cfg->control_socket );
+        cfg->control_socket = strdup( value );
+        break;
+    case OPT_TAKEOVER:
+        cfg->takeover = true;
+        break;
+    case OPT_STATS_SOCKET:
+        free( cfg->stats_socket );
+        cfg->stats_socket = strdup( value );
+        break;
+    case OPT_INDEX_FILE:
+        free( cfg->index_file );
+        cfg->index_file = strdup( value );
+        break;
+    case OPT_SEGMENT_SIZE:
+        return parse_size( name, value, 0, &cfg->segment_size );
+    case OPT_RETAIN_BYTES:
+        return parse_size( name, value, 0, &cfg->retain_bytes );
+    case OPT_CLIENT_RATE:
+        return parse_size( name, value, 0, &cfg->client_rate );
+    case OPT_CLIENT_BURST:
+        return parse_size( name, value, 0, &cfg->client_burst );
+    case OPT_IP_RATE:
+        return parse_size( name, value, 0, &cfg->ip_rate );
+    case OPT_IP_BURST:
+        return parse_size( name, value, 0, &cfg->ip_burst );
+    case OPT_RETAIN_SECS:
+        if( !parse_size( name, value, 0, &v ) ){
+            return false;
+        }
+        cfg->retain_secs = v;
+        break;
+    case OPT_LOG:
+        if( 0 == strcmp( value, "syslog" ) ){
+            cfg->log_sink = AESD_LOG_SYSLOG;
+        }else if( 0 == strcmp( value, "stderr" ) ){
+            cfg->log_sink = AESD_LOG_STDERR;
+        }else{
+            fprintf( stderr, "invalid log sink %s, use syslog or stderr\n", value );
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+static char* trim( char* s ){
+    char* end;
+
+    while( isspace( ( unsigned char )*s ) ){
+        s ++;
+    }
+
+    end = s + strlen( s );
+
+    while( end > s && isspace( ( unsigned char )end[ -1 ] ) ){
+        *-- end = '\0';
+    }
+
+    return s;
+}
+
+static bool load_file( struct aesd_config* cfg, char const* path ){
+    char line[ 512 ];
+    int lineno = 0;
+    FILE* f = fopen( path, "r" );
+
+    if( !f ){
+        perror( path );
+        return false;
+    }
+
+    while( fgets( line, sizeof( line ), f ) ){
+        char* hash = strchr( line, '#' );
+        char* key = line;
+        char* value = NULL;
+        const struct option* o;
+        lineno ++;
+
+        if( hash ){
+            *hash = '\0';
+        }
+
+        if( ( value = strchr( line, '=' ) ) ){
+            *value ++ = '\0';
+            value = trim( value );
+        }
+
+        key = trim( key );
+
+        if( *key == '\0' ){
+            continue;
+        }
+
+        for( o = long_options; o->name && strcmp( o->name, key ); o ++ ){
+        }
+
+        if( !o->name || o->val == 'c' || ( o->has_arg == required_argument && !value ) ||
+            !set_option( cfg, o->val, key, value ) ){
+            fprintf( stderr, "%s:%d: invalid setting %s\n", path, lineno, key );
+            fclose( f );
+            return false;
+        }
+    }
+
+    fclose( f );
+    return true;
+}
+
+void aesd_config_defaults( struct aesd_config* cfg ){
+    memset( cfg, 0, sizeof( *cfg ) );
+    cfg->port = SERV_PORT;
+    cfg->backlog = LISTENQ;
+    cfg->maxline = MAXLINE;
+    cfg->buffsize = BUFFSIZE;
+    cfg->outq_high_water = OUTQ_HIGH_WATER;
+    cfg->mirror_size = MIRROR_SIZE;
+    cfg->replay_window_us = REPLAY_WINDOW_US;
+    cfg->backend = strdup( LOG_PATH );
+    cfg->timer_interval = LOG_TIMER_INT;
+    cfg->engine = AESD_ENGINE_THREADS;
+    cfg->workers = WORKERS;
+    cfg->drain_timeout_ms = DRAIN_TIMEOUT_MS;
+    cfg->segment_size = SEGMENT_SIZE;
+    cfg->retain_bytes = RETAIN_BYTES;
+    cfg->retain_secs = RETAIN_SECS;
+    cfg->client_rate = CLIENT_RATE;
+    cfg->ip_rate = IP_RATE;
+    aesd_durability_parse( AESD_DURABILITY_DEFAULT, &cfg->durability );
+}
+
+bool aesd_config_parse( struct aesd_config* cfg, int argc, char** argv ){
+    int opt;
+    struct stat st;
+
+    // the config file first, so that flags override it wherever they appear
+    while( ( opt = getopt_long( argc, argv, short_options, long_options, NULL ) ) != -1 ){
+        if( opt == '?' ){
+            usage( argv[ 0 ] );
+            return false;
+        }
+
+        if( opt == 'c' && !load_file( cfg, optarg ) ){
+            return false;
+        }
+    }
+
+    optind = 1;
+
+    while( ( opt = getopt_long( argc, argv, short_options, long_options, NULL ) ) != -1 ){
+        if( opt != 'c' && !set_option( cfg, opt, argv[ optind - 1 ], optarg ) ){
+            usage( argv[ 0 ] );
+            return false;
+        }
+    }
+
+    if( optind < argc ){
+        usage( argv[ 0 ] );
+        return false;
+    }
+
+    if( !cfg->backend ){
+        fprintf( stderr, "out of memory\n" );
+        return false;
+    }
+
+    if( cfg->takeover && !cfg->control_socket ){
+        fprintf( stderr, "--takeover needs the --control-socket of the running server\n" );
+        return false;
+    }
+
+    if( ( cfg->retain_bytes > 0 || cfg->retain_secs > 0 ) && cfg->segment_size == 0 ){
+        fprintf( stderr, "--retain-bytes and --retain-secs need a --segment-size\n" );
+        return false;
+    }
+
+    if( ( cfg->client_burst > 0 && cfg->client_rate == 0 ) || ( cfg->ip_burst > 0 && cfg->ip_rate == 0 ) ){
+        fprintf( stderr, "--client-burst and --ip-burst need the matching rate\n" );
+        return false;
+    }
+
+    if( cfg->segment_size > 0 && stat( cfg->backend, &st ) == 0 && S_ISCHR( st.st_mode ) ){
+        fprintf( stderr, "--segment-size needs a file backend\n" );
+        return false;
+    }
+
+    // the char device keeps its own history, timestamps only go to file backends by default
+    if( !timestamps_set ){
+        if( stat( cfg->backend, &st ) == 0 ){
+            cfg->timestamps = !S_ISCHR( st.st_mode );
+        }else{
+            cfg->timestamps = strncmp( cfg->backend, "/dev/", 5 ) != 0;
+        }
+    }
+
+    return true;
+}
+
+void aesd_config_free( struct aesd_config* cfg ){
+    free( cfg->backend );
+    free( cfg->control_socket );
+    free( cfg->index_file );
+    free( cfg->stats_socket );
+    cfg->backend = NULL;
+    cfg->control_socket = NULL;
+    cfg->index_file = NULL;
+    cfg->stats_socket = NULL;
+}
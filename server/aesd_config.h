@@ -0,0 +1,55 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "aesd_durability.h"
+#include "aesd_logger.h"
+
+enum aesd_engine {
+    AESD_ENGINE_THREADS = 0,    /* one thread per connection, aesd_server_thrd.c */
+    AESD_ENGINE_EPOLL           /* single threaded event loop, aesdsocket.c */
+};
+
+/*
+ * Runtime settings of aesdsocket.  Defaults come from aesdsocket_cfg.h, then the config file
+ * given with -c, then the remaining command line flags, later sources win.
+ */
+struct aesd_config {
+    int                     port;
+    int                     backlog;
+    size_t                  maxline;            /* size of the per connection read buffer */
+    size_t                  buffsize;           /* chunk size used to replay the log */
+    size_t                  outq_high_water;    /* epoll engine: stop reading above this many pending bytes */
+    size_t                  mirror_size;        /* threads engine: bytes of the log kept in memory, 0 = off */
+    unsigned                replay_window_us;   /* threads engine: overlapping replays wait this long to share a snapshot */
+    char*                   backend;            /* log path, /dev/aesdchar or a regular file */
+    char*                   index_file;         /* file backends: sidecar keeping the record index, NULL = memory only */
+    size_t                  segment_size;       /* file backends: bytes per segment file, 0 = a single file */
+    size_t                  retain_bytes;       /* segmented logs: bytes kept, 0 = no limit */
+    unsigned                retain_secs;        /* segmented logs: age of the oldest segment kept, 0 = no limit */
+    size_t                  client_rate;        /* bytes per second a connection may cost, 0 = no limit */
+    size_t                  client_burst;       /* 0 = one second of client_rate */
+    size_t                  ip_rate;            /* as client_rate, shared by all connections of a source address */
+    size_t                  ip_burst;
+    bool                    timestamps;         /* write timestamp records, default on for file backends */
+    unsigned                timer_interval;     /* seconds between timestamp records */
+    enum aesd_engine        engine;
+    unsigned                workers;            /* threads engine: accept loops, one listener each */
+    bool                    worker_affinity;    /* pin accept loop i to cpu i and steer its connections */
+    bool                    daemon;
+    unsigned                drain_timeout_ms;   /* on exit, time open connections get to finish */
+    char*                   control_socket;     /* Unix socket a successor takes the listeners from */
+    bool                    takeover;           /* start by taking the listeners of the running server */
+    char*                   stats_socket;       /* Unix socket serving the counters, see aesd_metrics.h */
+    enum aesd_log_sink      log_sink;           /* where the log drain thread writes */
+    struct aesd_durability  durability;
+};
+
+void aesd_config_defaults( struct aesd_config* cfg );
+
+/**
+ * Fills @param cfg from the config file named by -c (if any) and the command line.
+ * @return false on invalid input, a message has been printed to stderr.
+ */
+bool aesd_config_parse( struct aesd_config* cfg, int argc, char** argv );
+
+void aesd_config_free( struct aesd_config* cfg );
@@ -0,0 +1,152 @@
+#include "aesd_durability.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct aesd_durability   policy_;
+static atomic_int               sync_fd = -1;
+static atomic_bool              dirty = false;
+static bool                     thread_running = false;
+static pthread_t                sync_tid;
+static pthread_mutex_t          stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           stop_cond;
+static bool                     stop_requested = false;
+
+static void* sync_thread( void* arg );
+
+bool aesd_durability_parse( char const* spec, struct aesd_durability* out ){
+    memset( out, 0, sizeof( *out ) );
+
+    if( 0 == strcmp( spec, "none" ) ){
+        out->mode = AESD_SYNC_NONE;
+    }else if( 0 == strcmp( spec, "every-record" ) ){
+        out->mode = AESD_SYNC_EVERY_RECORD;
+    }else if( 0 == strncmp( spec, "interval=", 9 ) ){
+        char* end = NULL;
+        unsigned long ms = strtoul( spec + 9, &end, 10 );
+
+        if( end == spec + 9 || *end != '\0' || ms == 0 ){
+            return false;
+        }
+
+        out->mode = AESD_SYNC_INTERVAL;
+        out->interval_ms = ms;
+    }else{
+        return false;
+    }
+
+    return true;
+}
+
+bool aesd_durability_start( struct aesd_durability const* policy, int fd ){
+    struct stat st;
+    policy_ = *policy;
+    sync_fd = fd;
+
+    if( fstat( fd, &st ) < 0 || !S_ISREG( st.st_mode ) ){
+        policy_.mode = AESD_SYNC_NONE;
+    }
+
+    syslog( LOG_DEBUG, "> durability mode %d, interval %u ms", policy_.mode, policy_.interval_ms );
+
+    if( policy_.mode != AESD_SYNC_INTERVAL ){
+        return true;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &stop_cond, &attr );
+    pthread_condattr_destroy( &attr );
+    stop_requested = false;
+
+    if( pthread_create( &sync_tid, NULL, sync_thread, NULL ) != 0 ){
+        syslog( LOG_ERR, "Failed to start sync thread" );
+        return false;
+    }
+
+    thread_running = true;
+    return true;
+}
+
+void aesd_durability_rebind( int fd ){
+    int old = atomic_exchange( &sync_fd, fd );
+
+    if( policy_.mode != AESD_SYNC_NONE && old >= 0 && old != fd && fdatasync( old ) < 0 ){
+        syslog( LOG_ERR, "fdatasync failed, err: %s", strerror( errno ) );
+    }
+}
+
+void aesd_durability_commit( void ){
+    switch( policy_.mode ){
+    case AESD_SYNC_EVERY_RECORD:
+        if( fdatasync( sync_fd ) < 0 ){
+            syslog( LOG_ERR, "fdatasync failed, err: %s", strerror( errno ) );
+        }
+        break;
+    case AESD_SYNC_INTERVAL:
+        atomic_store_explicit( &dirty, true, memory_order_release );
+        break;
+    default:
+        break;
+    }
+}
+
+void aesd_durability_stop( void ){
+    if( thread_running ){
+        pthread_mutex_lock( &stop_lock );
+        stop_requested = true;
+        pthread_cond_signal( &stop_cond );
+        pthread_mutex_unlock( &stop_lock );
+        pthread_join( sync_tid, NULL );
+        pthread_cond_destroy( &stop_cond );
+        thread_running = false;
+    }
+
+    if( policy_.mode != AESD_SYNC_NONE && sync_fd >= 0 ){
+        fdatasync( sync_fd );
+    }
+}
+
+static void* sync_thread( void* arg ){
+    struct timespec deadline;
+    clock_gettime( CLOCK_MONOTONIC, &deadline );
+    pthread_mutex_lock( &stop_lock );
+
+    while( !stop_requested ){
+        deadline.tv_sec += policy_.interval_ms / 1000;
+        deadline.tv_nsec += ( policy_.interval_ms % 1000 ) * 1000000L;
+
+        if( deadline.tv_nsec >= 1000000000L ){
+            deadline.tv_sec ++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while( !stop_requested &&
+               pthread_cond_timedwait( &stop_cond, &stop_lock, &deadline ) != ETIMEDOUT ){
+        }
+
+        if( stop_requested ){
+            break;
+        }
+
+        pthread_mutex_unlock( &stop_lock );
+
+        if( atomic_exchange_explicit( &dirty, false, memory_order_acq_rel ) &&
+            fdatasync( sync_fd ) < 0 ){
+            syslog( LOG_ERR, "fdatasync failed, err: %s", strerror( errno ) );
+        }
+
+        pthread_mutex_lock( &stop_lock );
+    }
+
+    pthread_mutex_unlock( &stop_lock );
+    return NULL;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdbool.h>
+
+/*
+ * How hard the server tries to get committed records onto stable storage.
+ *  none            rely on the page cache, replays read back through the same file anyway
+ *  interval=<ms>   a background thread fdatasync()s the log every <ms> when it changed
+ *  every-record    fdatasync() before a commit returns
+ */
+enum aesd_sync_mode {
+    AESD_SYNC_NONE = 0,
+    AESD_SYNC_INTERVAL,
+    AESD_SYNC_EVERY_RECORD
+};
+
+struct aesd_durability {
+    enum aesd_sync_mode mode;
+    unsigned            interval_ms;
+};
+
+#define AESD_DURABILITY_DEFAULT "none"
+
+bool aesd_durability_parse( char const* spec, struct aesd_durability* out );
+
+/**
+ * Applies @param policy to @param fd, starting the sync thread for interval mode.
+ * Backends that cannot be synced, like the char device, always run with none.
+ */
+bool aesd_durability_start( struct aesd_durability const* policy, int fd );
+
+/**
+ * Moves the policy to @param fd, a new segment of the log, after syncing what the old one still
+ * has outstanding.
+ */
+void aesd_durability_rebind( int fd );
+
+/**
+ * To be called after every commit to the log.
+ */
+void aesd_durability_commit( void );
+
+/**
+ * Stops the sync thread and syncs whatever is still outstanding.
+ */
+void aesd_durability_stop( void );
@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include "aesd_handover.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int successor_fd = -1;   /* connection to the old server while taking over */
+
+static bool make_addr( char const* path, struct sockaddr_un* addr ){
+    memset( addr, 0, sizeof( *addr ) );
+    addr->sun_family = AF_UNIX;
+
+    if( strlen( path ) >= sizeof( addr->sun_path ) ){
+        syslog( LOG_ERR, "Control socket path too long: %s\n", path );
+        return false;
+    }
+
+    strcpy( addr->sun_path, path );
+    return true;
+}
+
+int aesd_handover_listen( char const* path ){
+    struct sockaddr_un addr;
+    int fd;
+
+    if( !make_addr( path, &addr ) ){
+        return -1;
+    }
+
+    fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0 );
+
+    if( fd < 0 ){
+        syslog( LOG_ERR, "Failed to create control socket, err: %s\n", strerror( errno ) );
+        return -1;
+    }
+
+    // a predecessor may still hold the old path open, it never unlinks after a handover
+    unlink( path );
+
+    if( bind( fd, ( struct sockaddr* )&addr, sizeof( addr ) ) < 0 || listen( fd, 1 ) < 0 ){
+        syslog( LOG_ERR, "Failed to listen on %s, err: %s\n", path, strerror( errno ) );
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+bool aesd_handover_serve( int ctlfd, int const* fds, unsigned n ){
+    char cbuf[ CMSG_SPACE( sizeof( int ) * AESD_HANDOVER_MAX_FDS ) ];
+    char tag = 'L', ack = 0;
+    struct iovec iov = { .iov_base = &tag, .iov_len = 1 };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = cbuf };
+    struct cmsghdr* cmsg;
+    struct pollfd pfd;
+    bool ok = false;
+    int conn = accept4( ctlfd, NULL, NULL, SOCK_CLOEXEC );
+
+    if( conn < 0 ){
+        return false;
+    }
+
+    if( n > AESD_HANDOVER_MAX_FDS ){
+        n = AESD_HANDOVER_MAX_FDS;
+    }
+
+    memset( cbuf, 0, sizeof( cbuf ) );
+    msg.msg_controllen = CMSG_SPACE( sizeof( int ) * n );
+    cmsg = CMSG_FIRSTHDR( &msg );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( sizeof( int ) * n );
+    memcpy( CMSG_DATA( cmsg ), fds, sizeof( int ) * n );
+
+    pfd.fd = conn;
+    pfd.events = POLLIN;
+
+    if( sendmsg( conn, &msg, MSG_NOSIGNAL ) != 1 ){
+        syslog( LOG_ERR, "Failed to pass listeners, err: %s\n", strerror( errno ) );
+    }else if( poll( &pfd, 1, AESD_HANDOVER_ACK_MS ) == 1 && read( conn, &ack, 1 ) == 1 && ack == 'A' ){
+        ok = true;
+    }else{
+        syslog( LOG_ERR, "Successor did not acknowledge the handover, still serving\n" );
+    }
+
+    close( conn );
+    return ok;
+}
+
+int aesd_handover_takeover( char const* path, int* fds, unsigned max ){
+    char cbuf[ CMSG_SPACE( sizeof( int ) * AESD_HANDOVER_MAX_FDS ) ];
+    char tag = 0;
+    struct iovec iov = { .iov_base = &tag, .iov_len = 1 };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = cbuf, .msg_controllen = sizeof( cbuf ) };
+    struct sockaddr_un addr;
+    struct cmsghdr* cmsg;
+    int n = 0;
+
+    if( !make_addr( path, &addr ) ){
+        return -1;
+    }
+
+    successor_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+    if( successor_fd < 0 || connect( successor_fd, ( struct sockaddr* )&addr, sizeof( addr ) ) < 0 ){
+        syslog( LOG_ERR, "Cannot reach the running server at %s, err: %s\n", path, strerror( errno ) );
+        return -1;
+    }
+
+    if( recvmsg( successor_fd, &msg, MSG_CMSG_CLOEXEC ) != 1 || tag != 'L' ){
+        syslog( LOG_ERR, "No listeners received from %s\n", path );
+        return -1;
+    }
+
+    for( cmsg = CMSG_FIRSTHDR( &msg ); cmsg; cmsg = CMSG_NXTHDR( &msg, cmsg ) ){
+        if( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS ){
+            int count = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+            int* in = ( int* )CMSG_DATA( cmsg );
+
+            for( int i = 0; i < count; i ++ ){
+                if( ( unsigned )n < max ){
+                    fds[ n ++ ] = in[ i ];
+                }else{
+                    close( in[ i ] );
+                }
+            }
+        }
+    }
+
+    return n;
+}
+
+void aesd_handover_ack( void ){
+    char ack = 'A';
+
+    if( successor_fd < 0 ){
+        return;
+    }
+
+    if( write( successor_fd, &ack, 1 ) != 1 ){
+        syslog( LOG_ERR, "Failed to acknowledge the handover, err: %s\n", strerror( errno ) );
+    }
+
+    close( successor_fd );
+    successor_fd = -1;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdbool.h>
+
+/*
+ * Hot restart.  A server started with --control-socket listens on that Unix socket.  A successor
+ * started with --takeover connects to it and receives the listening sockets with SCM_RIGHTS, the
+ * kernel keeps queueing connections on them the whole time, so none are refused.  Once the
+ * successor acknowledged, the old server stops accepting, drains its clients and exits without
+ * removing the log.
+ */
+
+#define AESD_HANDOVER_MAX_FDS    64
+#define AESD_HANDOVER_ACK_MS     2000   /* how long the old server waits for the successor */
+
+/**
+ * @return the listening, non blocking control socket bound to @param path, or -1 on error.
+ */
+int aesd_handover_listen( char const* path );
+
+/**
+ * Accepts a successor on @param ctlfd and passes it the @param n descriptors in @param fds.
+ * @return true when the successor acknowledged, the caller must stop accepting then.
+ */
+bool aesd_handover_serve( int ctlfd, int const* fds, unsigned n );
+
+/**
+ * Connects to the server at @param path and receives up to @param max descriptors into @param fds.
+ * @return the number of descriptors received, -1 on error.
+ */
+int aesd_handover_takeover( char const* path, int* fds, unsigned max );
+
+/**
+ * Acknowledges the takeover on the connection left open by aesd_handover_takeover(), to be called
+ * once the received listeners are being served.
+ */
+void aesd_handover_ack( void );
@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include "aesd_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC     "AESDIDX1"
+#define INDEX_INIT_CAP  1024
+#define SCAN_CHUNK      ( 64 * 1024 )
+
+// sidecar layout: this header, then cap record offsets
+struct aesd_index_hdr {
+    char        magic[ 8 ];
+    uint64_t    count;
+    uint64_t    end;
+    uint64_t    next_start;
+};
+
+static size_t map_size( uint64_t cap ){
+    return sizeof( struct aesd_index_hdr ) + cap * sizeof( uint64_t );
+}
+
+static bool grow( struct aesd_index* idx ){
+    uint64_t cap = idx->cap ? idx->cap * 2 : INDEX_INIT_CAP;
+
+    if( idx->map_fd < 0 ){
+        uint64_t* starts = realloc( idx->starts, cap * sizeof( uint64_t ) );
+
+        if( !starts ){
+            return false;
+        }
+
+        idx->starts = starts;
+    }else{
+        void* map;
+
+        if( ftruncate( idx->map_fd, map_size( cap ) ) < 0 ){
+            return false;
+        }
+
+        map = idx->hdr ? mremap( idx->hdr, map_size( idx->cap ), map_size( cap ), MREMAP_MAYMOVE )
+                       : mmap( NULL, map_size( cap ), PROT_READ | PROT_WRITE, MAP_SHARED, idx->map_fd, 0 );
+
+        if( map == MAP_FAILED ){
+            return false;
+        }
+
+        idx->hdr = map;
+        idx->starts = ( uint64_t* )( idx->hdr + 1 );
+    }
+
+    idx->cap = cap;
+    return true;
+}
+
+// the counters are mirrored into the sidecar header after every change
+static void publish( struct aesd_index* idx ){
+    if( idx->hdr ){
+        idx->hdr->count = idx->count;
+        idx->hdr->end = idx->end;
+        idx->hdr->next_start = idx->next_start;
+    }
+}
+
+static bool add_bytes( struct aesd_index* idx, char const* buf, size_t len ){
+    for( char const* p = buf, *stop = buf + len; ( p = memchr( p, '\n', stop - p ) ) != NULL; p ++ ){
+        if( idx->count == idx->cap && !grow( idx ) ){
+            return false;
+        }
+
+        idx->starts[ idx->count ++ ] = idx->next_start;
+        idx->next_start = idx->end + ( p - buf ) + 1;
+    }
+
+    idx->end += len;
+    return true;
+}
+
+// indexes the bytes of the log from idx->end up to @param end
+static bool scan( struct aesd_index* idx, uint64_t end ){
+    char* chunk = malloc( SCAN_CHUNK );
+    bool ok = chunk != NULL;
+
+    while( ok && idx->end < end ){
+        size_t want = end - idx->end < SCAN_CHUNK ? end - idx->end : SCAN_CHUNK;
+        ssize_t rn = aesd_seglog_pread( idx->log, chunk, want, idx->end );
+
+        ok = rn > 0 && add_bytes( idx, chunk, rn );
+    }
+
+    free( chunk );
+    publish( idx );
+    return ok;
+}
+
+/*
+ * Trusts a sidecar only when it still matches the log: it must cover what retention left and not
+ * more than the log holds, and the bytes before the newest record starts it knows must be newlines.
+ */
+static bool sidecar_valid( struct aesd_index* idx, uint64_t end ){
+    struct aesd_index_hdr* hdr = idx->hdr;
+    char c;
+
+    if( memcmp( hdr->magic, INDEX_MAGIC, sizeof( hdr->magic ) ) != 0 || hdr->end > end ||
+        hdr->end < aesd_seglog_start( idx->log ) || hdr->count > idx->cap || hdr->next_start > hdr->end ){
+        return false;
+    }
+
+    if( hdr->next_start > 0 &&
+        ( aesd_seglog_pread( idx->log, &c, 1, hdr->next_start - 1 ) != 1 || c != '\n' ) ){
+        return false;
+    }
+
+    if( hdr->count > 0 && idx->starts[ hdr->count - 1 ] > 0 &&
+        ( aesd_seglog_pread( idx->log, &c, 1, idx->starts[ hdr->count - 1 ] - 1 ) != 1 || c != '\n' ) ){
+        return false;
+    }
+
+    return true;
+}
+
+// forgets the records retention deleted, so record numbers count from the oldest one kept
+static void trim( struct aesd_index* idx ){
+    uint64_t start = aesd_seglog_start( idx->log );
+    uint64_t lo = 0, hi = idx->count;
+
+    if( idx->count == 0 || idx->starts[ 0 ] >= start ){
+        return;
+    }
+
+    while( lo < hi ){
+        uint64_t mid = ( lo + hi ) / 2;
+
+        if( idx->starts[ mid ] < start ){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+
+    idx->count -= lo;
+    memmove( idx->starts, idx->starts + lo, idx->count * sizeof( uint64_t ) );
+    publish( idx );
+}
+
+bool aesd_index_open( struct aesd_index* idx, char const* sidecar, struct aesd_seglog* log ){
+    uint64_t end = aesd_seglog_end( log );
+
+    memset( idx, 0, sizeof( *idx ) );
+    idx->map_fd = -1;
+    idx->log = log;
+    // a new index starts at the oldest byte retention left
+    idx->end = idx->next_start = aesd_seglog_start( log );
+
+    if( sidecar ){
+        struct stat mst;
+
+        idx->map_fd = open( sidecar, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR );
+
+        if( idx->map_fd < 0 || fstat( idx->map_fd, &mst ) < 0 ){
+            syslog( LOG_ERR, "Cannot open index %s, err: %s\n", sidecar, strerror( errno ) );
+            aesd_index_close( idx );
+            return false;
+        }
+
+        // map what is there, an existing sidecar keeps its capacity
+        while( map_size( idx->cap ) < ( uint64_t )mst.st_size || idx->cap == 0 ){
+            if( !grow( idx ) ){
+                aesd_index_close( idx );
+                return false;
+            }
+        }
+
+        if( sidecar_valid( idx, end ) ){
+            idx->count = idx->hdr->count;
+            idx->end = idx->hdr->end;
+            idx->next_start = idx->hdr->next_start;
+        }else{
+            memcpy( idx->hdr->magic, INDEX_MAGIC, sizeof( idx->hdr->magic ) );
+        }
+    }
+
+    if( !scan( idx, end ) ){
+        syslog( LOG_ERR, "Cannot index the data file, err: %s\n", strerror( errno ) );
+        aesd_index_close( idx );
+        return false;
+    }
+
+    trim( idx );
+    return true;
+}
+
+void aesd_index_close( struct aesd_index* idx ){
+    if( idx->map_fd < 0 ){
+        free( idx->starts );
+    }else{
+        if( idx->hdr ){
+            munmap( idx->hdr, map_size( idx->cap ) );
+        }
+
+        close( idx->map_fd );
+    }
+
+    memset( idx, 0, sizeof( *idx ) );
+    idx->map_fd = -1;
+}
+
+bool aesd_index_append( struct aesd_index* idx, uint64_t base, char const* buf, size_t len ){
+    bool ok = ( idx->end == base || scan( idx, base ) ) && add_bytes( idx, buf, len );
+
+    publish( idx );
+    return ok;
+}
+
+bool aesd_index_seek( struct aesd_index* idx, uint64_t record, uint64_t offset, uint64_t* pos ){
+    uint64_t next;
+
+    trim( idx );
+
+    if( record >= idx->count ){
+        return false;
+    }
+
+    next = record + 1 < idx->count ? idx->starts[ record + 1 ] : idx->next_start;
+
+    if( offset >= next - idx->starts[ record ] ){
+        return false;
+    }
+
+    *pos = idx->starts[ record ] + offset;
+    return true;
+}
+
+uint64_t aesd_index_tail( struct aesd_index* idx, uint64_t records ){
+    trim( idx );
+
+    if( records >= idx->count ){
+        return aesd_seglog_start( idx->log );
+    }
+
+    return records == 0 ? idx->next_start : idx->starts[ idx->count - records ];
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "aesd_seglog.h"
+
+/*
+ * Start offsets of the records of a data file log, so a seek to record N is an array lookup
+ * instead of a scan for newlines.  The array lives on the heap, or in a memory mapped sidecar file
+ * that survives restarts: on open the sidecar is checked against the log and only the bytes
+ * written since it was last updated are scanned.
+ *
+ * The index follows the log through aesd_index_append() after each commit.  When the log grew
+ * behind its back, e.g. a predecessor still appending during a hot restart, the gap is read back
+ * first.  Records deleted by retention are dropped on the next lookup, record 0 is always the
+ * oldest record kept.  Calls must be serialized by the caller.
+ */
+
+struct aesd_index_hdr;
+
+struct aesd_index {
+    uint64_t*               starts;     /* start offset of every complete record */
+    uint64_t                count;      /* complete records */
+    uint64_t                cap;
+    uint64_t                end;        /* bytes of the data file indexed */
+    uint64_t                next_start; /* start of the record being written, one past the last newline */
+    struct aesd_seglog*     log;
+    int                     map_fd;     /* sidecar, -1 when the index lives on the heap */
+    struct aesd_index_hdr*  hdr;        /* start of the sidecar mapping */
+};
+
+/**
+ * Indexes @param log, kept in the sidecar file @param sidecar when not NULL.
+ * @return false when out of memory or the sidecar cannot be used.
+ */
+bool aesd_index_open( struct aesd_index* idx, char const* sidecar, struct aesd_seglog* log );
+
+void aesd_index_close( struct aesd_index* idx );
+
+/**
+ * Adds @param buf, just appended to the log at offset @param base.
+ * @return false when out of memory or the log could not be read, the index is unusable then.
+ */
+bool aesd_index_append( struct aesd_index* idx, uint64_t base, char const* buf, size_t len );
+
+/**
+ * Looks up byte @param offset of record @param record, counted from the oldest record kept.
+ * @return false when the position is not in a complete record, as AESDCHAR_IOCSEEKTO would fail.
+ */
+bool aesd_index_seek( struct aesd_index* idx, uint64_t record, uint64_t offset, uint64_t* pos );
+
+/**
+ * @return where the last @param records complete records start.
+ */
+uint64_t aesd_index_tail( struct aesd_index* idx, uint64_t records );
@@ -0,0 +1,158 @@
+#include "aesd_latency.h"
+#include "aesd_logger.h"
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define SUB_BITS    6
+#define HALF        ( 1u << ( SUB_BITS - 1 ) )
+#define BUCKETS     ( ( 64 - SUB_BITS + 2 ) * HALF )
+
+struct histogram {
+    _Atomic uint64_t    counts[ BUCKETS ];
+    _Atomic uint64_t    sum;
+    _Atomic uint64_t    max;
+};
+
+static struct histogram hist[ AESD_STAGE_COUNT ];
+static volatile sig_atomic_t dump_pending = 0;
+
+static char const* const stage_names[ AESD_STAGE_COUNT ] = {
+    [ AESD_STAGE_ACCEPT ] = "accept",
+    [ AESD_STAGE_RECEIVE ] = "receive",
+    [ AESD_STAGE_COMMIT ] = "commit",
+    [ AESD_STAGE_REPLAY ] = "replay",
+    [ AESD_STAGE_REQUEST ] = "request"
+};
+
+// values below 2 * HALF have a bucket each, above every power of two is split into HALF buckets
+static unsigned bucket_of( uint64_t v ){
+    unsigned shift;
+
+    if( v < 2 * HALF ){
+        return v;
+    }
+
+    shift = 63 - __builtin_clzll( v ) - ( SUB_BITS - 1 );
+    return shift * HALF + ( unsigned )( v >> shift );
+}
+
+// the largest value that falls into bucket @param b
+static uint64_t bucket_top( unsigned b ){
+    unsigned shift;
+
+    if( b < 2 * HALF ){
+        return b;
+    }
+
+    shift = b / HALF - 1;
+    return ( ( uint64_t )( b - shift * HALF + 1 ) << shift ) - 1;
+}
+
+void aesd_latency_record( enum aesd_stage stage, uint64_t ns ){
+    struct histogram* h = &hist[ stage ];
+    uint64_t max = atomic_load_explicit( &h->max, memory_order_relaxed );
+
+    atomic_fetch_add_explicit( &h->counts[ bucket_of( ns ) ], 1, memory_order_relaxed );
+    atomic_fetch_add_explicit( &h->sum, ns, memory_order_relaxed );
+
+    while( ns > max && !atomic_compare_exchange_weak_explicit( &h->max, &max, ns, memory_order_relaxed,
+                                                               memory_order_relaxed ) ){
+    }
+}
+
+void aesd_trace_ready( struct aesd_trace* t ){
+    t->ready = aesd_latency_now();
+
+    if( t->first == 0 ){
+        t->first = t->ready;
+    }
+
+    if( t->accept != 0 ){
+        aesd_latency_record( AESD_STAGE_ACCEPT, t->first - t->accept );
+        t->accept = 0;
+    }
+
+    aesd_latency_record( AESD_STAGE_RECEIVE, t->ready - t->first );
+}
+
+void aesd_trace_commit( struct aesd_trace* t ){
+    t->commit = aesd_latency_now();
+    aesd_latency_record( AESD_STAGE_COMMIT, t->commit - t->ready );
+}
+
+void aesd_trace_done( struct aesd_trace* t ){
+    uint64_t now = aesd_latency_now();
+
+    if( t->commit != 0 ){
+        aesd_latency_record( AESD_STAGE_REPLAY, now - t->commit );
+    }
+
+    aesd_latency_record( AESD_STAGE_REQUEST, now - t->first );
+    t->first = t->ready = t->commit = 0;
+}
+
+/**
+ * Formats the line of @param stage from a copy of its buckets, recording goes on meanwhile.
+ */
+static int format_stage( enum aesd_stage stage, char* buf, size_t size ){
+    static double const quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    struct histogram* h = &hist[ stage ];
+    uint64_t counts[ BUCKETS ], count = 0, seen = 0, pct[ 4 ];
+    uint64_t max = atomic_load_explicit( &h->max, memory_order_relaxed );
+    unsigned q = 0;
+
+    for( unsigned b = 0; b < BUCKETS; b ++ ){
+        counts[ b ] = atomic_load_explicit( &h->counts[ b ], memory_order_relaxed );
+        count += counts[ b ];
+    }
+
+    for( unsigned b = 0; b < BUCKETS && q < 4; b ++ ){
+        seen += counts[ b ];
+
+        while( q < 4 && count > 0 && seen >= quantiles[ q ] * count ){
+            // the top of a bucket may lie above every value recorded
+            pct[ q ++ ] = bucket_top( b ) < max ? bucket_top( b ) : max;
+        }
+    }
+
+    while( q < 4 ){
+        pct[ q ++ ] = 0;
+    }
+
+    return snprintf( buf, size, "%s count %llu mean %.1f p50 %.1f p90 %.1f p99 %.1f p999 %.1f max %.1f\n",
+                     stage_names[ stage ], ( unsigned long long )count,
+                     count ? atomic_load_explicit( &h->sum, memory_order_relaxed ) / 1e3 / count : 0.0,
+                     pct[ 0 ] / 1e3, pct[ 1 ] / 1e3, pct[ 2 ] / 1e3, pct[ 3 ] / 1e3, max / 1e3 );
+}
+
+int aesd_latency_format( char* buf, size_t size ){
+    size_t len = 0;
+
+    for( int s = 0; s < AESD_STAGE_COUNT; s ++ ){
+        len += format_stage( s, buf + ( len < size ? len : size ), len < size ? size - len : 0 );
+    }
+
+    return len;
+}
+
+void aesd_latency_signal( void ){
+    dump_pending = 1;
+}
+
+void aesd_latency_poll( void ){
+    char line[ 160 ];
+
+    if( !dump_pending ){
+        return;
+    }
+
+    dump_pending = 0;
+    AESD_LOG( LOG_INFO, "latency in us:\n" );
+
+    for( int s = 0; s < AESD_STAGE_COUNT; s ++ ){
+        format_stage( s, line, sizeof( line ) );
+        AESD_LOG( LOG_INFO, "%s", line );
+    }
+}
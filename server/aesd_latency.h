@@ -0,0 +1,90 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Per stage latency of the requests served.  A connection carries a struct aesd_trace with the
+ * CLOCK_MONOTONIC times a request passed, each stage it completes is added to a process wide log
+ * linear histogram: 32 buckets per power of two, so a reported percentile is at most 3% above the
+ * true value.  Recording is a few relaxed atomic adds, cheap enough to stay on in production.
+ *
+ *  accept   connection accepted until its first byte
+ *  receive  first byte until the request is complete, the newline or the last byte of the frame
+ *  commit   request complete until its write was committed
+ *  replay   commit until the reply was sent
+ *  request  first byte until the reply was sent
+ *
+ * A read that completes several pipelined requests is traced as one.  The histograms are dumped
+ * to the log on SIGUSR1 and returned by the AESDCHAR_LATENCY command.
+ */
+
+enum aesd_stage {
+    AESD_STAGE_ACCEPT = 0,
+    AESD_STAGE_RECEIVE,
+    AESD_STAGE_COMMIT,
+    AESD_STAGE_REPLAY,
+    AESD_STAGE_REQUEST,
+    AESD_STAGE_COUNT
+};
+
+struct aesd_trace {
+    uint64_t    accept;     /* until the first request started, then 0 */
+    uint64_t    first;      /* first byte of the request in flight, 0 between requests */
+    uint64_t    ready;      /* the request in flight is complete, 0 before */
+    uint64_t    commit;     /* its write was committed, 0 for requests without a write */
+};
+
+static inline uint64_t aesd_latency_now( void ){
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( uint64_t )ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void aesd_latency_record( enum aesd_stage stage, uint64_t ns );
+
+static inline void aesd_trace_start( struct aesd_trace* t ){
+    t->accept = aesd_latency_now();
+    t->first = t->ready = t->commit = 0;
+}
+
+/**
+ * Bytes of a request arrived, the first ones start it.
+ */
+static inline void aesd_trace_input( struct aesd_trace* t ){
+    if( t->first == 0 ){
+        t->first = aesd_latency_now();
+    }
+}
+
+/**
+ * The request in flight is complete, records the accept and receive stages.
+ */
+void aesd_trace_ready( struct aesd_trace* t );
+
+/**
+ * The write of the request in flight was committed, records the commit stage.
+ */
+void aesd_trace_commit( struct aesd_trace* t );
+
+/**
+ * The reply was sent, records the replay and request stages and ends the request.
+ */
+void aesd_trace_done( struct aesd_trace* t );
+
+/**
+ * Formats one line per stage with its count, mean, percentiles and maximum in microseconds.
+ * @return the length, as snprintf().
+ */
+int aesd_latency_format( char* buf, size_t size );
+
+/**
+ * Asks for a dump to the log, safe to call from a signal handler.
+ */
+void aesd_latency_signal( void );
+
+/**
+ * Logs the histograms when aesd_latency_signal() was called since the last dump.
+ */
+void aesd_latency_poll( void );
@@ -0,0 +1,182 @@
+#pragma once
+/*
+ * Lock free bounded rings of pointers for handing records between threads, e.g. from the network
+ * threads to a dedicated log writer thread.
+ *
+ *  aesd_spsc_ring  one producer thread, one consumer thread
+ *  aesd_mpsc_ring  any number of producer threads, one consumer thread
+ *
+ * Capacities are rounded up to a power of two.  Producer and consumer indices live on separate
+ * cache lines so the two sides never write to the same line.
+ */
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define AESD_CACHELINE 64
+
+static inline size_t aesd_lfring_pow2( size_t n ){
+    size_t cap = 2;
+
+    while( cap < n ){
+        cap <<= 1;
+    }
+
+    return cap;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+struct aesd_spsc_ring {
+    _Alignas( AESD_CACHELINE ) _Atomic size_t   head;       /* next slot to write, owned by producer */
+    size_t                                      tail_cache; /* producer's last view of tail */
+    _Alignas( AESD_CACHELINE ) _Atomic size_t   tail;       /* next slot to read, owned by consumer */
+    size_t                                      head_cache; /* consumer's last view of head */
+    _Alignas( AESD_CACHELINE ) size_t           mask;
+    void**                                      slots;
+};
+
+static inline bool aesd_spsc_init( struct aesd_spsc_ring* r, size_t capacity ){
+    size_t cap = aesd_lfring_pow2( capacity );
+    r->slots = calloc( cap, sizeof( void* ) );
+
+    if( !r->slots ){
+        return false;
+    }
+
+    r->mask = cap - 1;
+    atomic_init( &r->head, 0 );
+    atomic_init( &r->tail, 0 );
+    r->tail_cache = 0;
+    r->head_cache = 0;
+    return true;
+}
+
+static inline void aesd_spsc_destroy( struct aesd_spsc_ring* r ){
+    free( r->slots );
+    r->slots = NULL;
+}
+
+/**
+ * @return false when the ring is full.  Producer thread only.
+ */
+static inline bool aesd_spsc_push( struct aesd_spsc_ring* r, void* item ){
+    size_t head = atomic_load_explicit( &r->head, memory_order_relaxed );
+
+    if( head - r->tail_cache > r->mask ){
+        r->tail_cache = atomic_load_explicit( &r->tail, memory_order_acquire );
+
+        if( head - r->tail_cache > r->mask ){
+            return false;
+        }
+    }
+
+    r->slots[ head & r->mask ] = item;
+    atomic_store_explicit( &r->head, head + 1, memory_order_release );
+    return true;
+}
+
+/**
+ * @return the oldest item or NULL when the ring is empty.  Consumer thread only.
+ */
+static inline void* aesd_spsc_pop( struct aesd_spsc_ring* r ){
+    size_t tail = atomic_load_explicit( &r->tail, memory_order_relaxed );
+    void* item;
+
+    if( tail == r->head_cache ){
+        r->head_cache = atomic_load_explicit( &r->head, memory_order_acquire );
+
+        if( tail == r->head_cache ){
+            return NULL;
+        }
+    }
+
+    item = r->slots[ tail & r->mask ];
+    atomic_store_explicit( &r->tail, tail + 1, memory_order_release );
+    return item;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// bounded multi producer ring, every cell carries a sequence number telling whose turn it is
+struct aesd_mpsc_cell {
+    _Atomic size_t  seq;
+    void*           item;
+};
+
+struct aesd_mpsc_ring {
+    _Alignas( AESD_CACHELINE ) _Atomic size_t   head;   /* next position to claim, shared by producers */
+    _Alignas( AESD_CACHELINE ) size_t           tail;   /* next position to read, owned by consumer */
+    _Alignas( AESD_CACHELINE ) size_t           mask;
+    struct aesd_mpsc_cell*                      cells;
+};
+
+static inline bool aesd_mpsc_init( struct aesd_mpsc_ring* r, size_t capacity ){
+    size_t cap = aesd_lfring_pow2( capacity );
+    r->cells = calloc( cap, sizeof( struct aesd_mpsc_cell ) );
+
+    if( !r->cells ){
+        return false;
+    }
+
+    for( size_t i = 0; i < cap; i ++ ){
+        atomic_init( &r->cells[ i ].seq, i );
+    }
+
+    r->mask = cap - 1;
+    atomic_init( &r->head, 0 );
+    r->tail = 0;
+    return true;
+}
+
+static inline void aesd_mpsc_destroy( struct aesd_mpsc_ring* r ){
+    free( r->cells );
+    r->cells = NULL;
+}
+
+/**
+ * @return false when the ring is full.  Safe from any number of threads.
+ */
+static inline bool aesd_mpsc_push( struct aesd_mpsc_ring* r, void* item ){
+    size_t pos = atomic_load_explicit( &r->head, memory_order_relaxed );
+    struct aesd_mpsc_cell* cell;
+
+    for( ;; ){
+        cell = &r->cells[ pos & r->mask ];
+        size_t seq = atomic_load_explicit( &cell->seq, memory_order_acquire );
+        intptr_t diff = ( intptr_t )seq - ( intptr_t )pos;
+
+        if( diff == 0 ){
+            if( atomic_compare_exchange_weak_explicit( &r->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed ) ){
+                break;
+            }
+        }else if( diff < 0 ){
+            return false;
+        }else{
+            pos = atomic_load_explicit( &r->head, memory_order_relaxed );
+        }
+    }
+
+    cell->item = item;
+    atomic_store_explicit( &cell->seq, pos + 1, memory_order_release );
+    return true;
+}
+
+/**
+ * @return the oldest published item or NULL when there is none.  Consumer thread only.
+ */
+static inline void* aesd_mpsc_pop( struct aesd_mpsc_ring* r ){
+    struct aesd_mpsc_cell* cell = &r->cells[ r->tail & r->mask ];
+    size_t seq = atomic_load_explicit( &cell->seq, memory_order_acquire );
+    void* item;
+
+    if( seq != r->tail + 1 ){
+        return NULL;
+    }
+
+    item = cell->item;
+    atomic_store_explicit( &cell->seq, r->tail + r->mask + 1, memory_order_release );
+    r->tail ++;
+    return item;
+}
@@ -0,0 +1,209 @@
+#include "aesd_logger.h"
+#include "aesd_lfring.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct aesd_log_record {
+    int     level;
+    char    msg[ AESD_LOG_MSG_MAX ];
+};
+
+/*
+ * Owned by one producer thread.  Records travel to the drain thread on full and come back on
+ * free, so formatting a message never allocates.
+ */
+struct aesd_log_ring {
+    struct aesd_spsc_ring   full;
+    struct aesd_spsc_ring   free;
+    struct aesd_log_record* records;
+    atomic_ulong            dropped;
+    atomic_bool             closed;     /* the producer thread exited */
+    struct aesd_log_ring*   next;
+};
+
+static atomic_bool                  running = false;
+static enum aesd_log_sink           sink_;
+static pthread_t                    drain_tid;
+static atomic_bool                  stop_requested = false;
+static pthread_mutex_t              rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct aesd_log_ring*        rings = NULL;
+static pthread_key_t                ring_key;
+static __thread struct aesd_log_ring* my_ring = NULL;
+
+static void* drain_thread( void* arg );
+
+static void ring_free( struct aesd_log_ring* r ){
+    aesd_spsc_destroy( &r->full );
+    aesd_spsc_destroy( &r->free );
+    free( r->records );
+    free( r );
+}
+
+// thread exit, the drain thread frees the ring once it is empty
+static void ring_release( void* arg ){
+    atomic_store( &( ( struct aesd_log_ring* )arg )->closed, true );
+}
+
+static struct aesd_log_ring* ring_get( void ){
+    struct aesd_log_ring* r;
+
+    if( my_ring ){
+        return my_ring;
+    }
+
+    r = calloc( 1, sizeof( *r ) );
+
+    if( !r ){
+        return NULL;
+    }
+
+    r->records = calloc( AESD_LOG_RING_SIZE, sizeof( struct aesd_log_record ) );
+
+    if( !r->records || !aesd_spsc_init( &r->full, AESD_LOG_RING_SIZE ) ||
+        !aesd_spsc_init( &r->free, AESD_LOG_RING_SIZE ) ){
+        ring_free( r );
+        return NULL;
+    }
+
+    for( int i = 0; i < AESD_LOG_RING_SIZE; i ++ ){
+        aesd_spsc_push( &r->free, &r->records[ i ] );
+    }
+
+    pthread_mutex_lock( &rings_lock );
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock( &rings_lock );
+    pthread_setspecific( ring_key, r );
+    my_ring = r;
+    return r;
+}
+
+void aesd_log( int level, char const* fmt, ... ){
+    struct aesd_log_ring* r = atomic_load_explicit( &running, memory_order_acquire ) ? ring_get() : NULL;
+    struct aesd_log_record* rec;
+    va_list ap;
+
+    va_start( ap, fmt );
+
+    if( !r ){
+        vsyslog( level, fmt, ap );
+    }else if( ( rec = aesd_spsc_pop( &r->free ) ) == NULL ){
+        atomic_fetch_add_explicit( &r->dropped, 1, memory_order_relaxed );
+    }else{
+        rec->level = level;
+        vsnprintf( rec->msg, sizeof( rec->msg ), fmt, ap );
+        aesd_spsc_push( &r->full, rec );
+    }
+
+    va_end( ap );
+}
+
+static void emit( int level, char const* msg ){
+    if( sink_ == AESD_LOG_STDERR ){
+        size_t len = strlen( msg );
+        fprintf( stderr, "<%d> %s%s", level, msg, len && msg[ len - 1 ] == '\n' ? "" : "\n" );
+    }else{
+        syslog( level, "%s", msg );
+    }
+}
+
+/**
+ * Empties every ring once and frees the rings of exited threads.
+ * @return the number of records written.
+ */
+static unsigned drain_once( void ){
+    struct aesd_log_ring** link;
+    unsigned n = 0;
+
+    pthread_mutex_lock( &rings_lock );
+    link = &rings;
+
+    while( *link ){
+        struct aesd_log_ring* r = *link;
+        bool closed = atomic_load( &r->closed );
+        struct aesd_log_record* rec;
+        unsigned long dropped;
+
+        while( ( rec = aesd_spsc_pop( &r->full ) ) != NULL ){
+            emit( rec->level, rec->msg );
+            aesd_spsc_push( &r->free, rec );
+            n ++;
+        }
+
+        if( ( dropped = atomic_exchange( &r->dropped, 0 ) ) > 0 ){
+            char msg[ 64 ];
+            snprintf( msg, sizeof( msg ), "logger dropped %lu records", dropped );
+            emit( LOG_WARNING, msg );
+        }
+
+        if( closed ){
+            *link = r->next;
+            ring_free( r );
+        }else{
+            link = &r->next;
+        }
+    }
+
+    pthread_mutex_unlock( &rings_lock );
+    return n;
+}
+
+static void* drain_thread( void* arg ){
+    struct timespec idle = { .tv_sec = 0, .tv_nsec = 10 * 1000000L };
+
+    while( !atomic_load( &stop_requested ) ){
+        if( drain_once() == 0 ){
+            nanosleep( &idle, NULL );
+        }
+    }
+
+    drain_once();
+    return NULL;
+}
+
+bool aesd_log_start( enum aesd_log_sink sink ){
+    sink_ = sink;
+    atomic_store( &stop_requested, false );
+
+    if( pthread_key_create( &ring_key, ring_release ) != 0 ){
+        return false;
+    }
+
+    if( pthread_create( &drain_tid, NULL, drain_thread, NULL ) != 0 ){
+        pthread_key_delete( ring_key );
+        return false;
+    }
+
+    atomic_store_explicit( &running, true, memory_order_release );
+    return true;
+}
+
+void aesd_log_stop( void ){
+    if( !atomic_load( &running ) ){
+        return;
+    }
+
+    // every other producer has been joined by now, only this thread's ring can still be in use
+    atomic_store_explicit( &running, false, memory_order_release );
+    atomic_store( &stop_requested, true );
+    pthread_join( drain_tid, NULL );
+
+    pthread_mutex_lock( &rings_lock );
+
+    while( rings ){
+        struct aesd_log_ring* r = rings;
+        rings = r->next;
+        ring_free( r );
+    }
+
+    pthread_mutex_unlock( &rings_lock );
+    pthread_setspecific( ring_key, NULL );
+    pthread_key_delete( ring_key );
+    my_ring = NULL;
+}
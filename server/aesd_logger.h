@@ -0,0 +1,44 @@
+#pragma once
+#include <stdbool.h>
+#include <syslog.h>
+
+/*
+ * Asynchronous logger.  AESD_LOG formats the message into a record taken from a per thread pool
+ * and pushes it on that thread's lock free ring, a background thread drains every ring to syslog
+ * or stderr.  The request path never blocks, when the pool is exhausted the record is dropped and
+ * counted instead.
+ *
+ * Levels above AESD_LOG_LEVEL are removed at compile time, e.g. make AESD_LOG_LEVEL=LOG_DEBUG
+ * keeps the debug messages.  Before aesd_log_start() and after aesd_log_stop() messages go to
+ * syslog directly.
+ */
+#ifndef AESD_LOG_LEVEL
+#define AESD_LOG_LEVEL LOG_INFO
+#endif
+
+#define AESD_LOG_MSG_MAX    240     /* longer messages are truncated */
+#define AESD_LOG_RING_SIZE  256     /* records per thread */
+
+#define AESD_LOG( level, ... ) \
+    do{ \
+        if( ( level ) <= AESD_LOG_LEVEL ){ \
+            aesd_log( level, __VA_ARGS__ ); \
+        } \
+    }while( 0 )
+
+enum aesd_log_sink {
+    AESD_LOG_SYSLOG = 0,
+    AESD_LOG_STDERR
+};
+
+void aesd_log( int level, char const* fmt, ... ) __attribute__(( format( printf, 2, 3 ) ));
+
+/**
+ * Starts the drain thread, to be called after the process daemonized.
+ */
+bool aesd_log_start( enum aesd_log_sink sink );
+
+/**
+ * Drains everything still queued and stops the drain thread.
+ */
+void aesd_log_stop( void );
@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include "aesd_metrics.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SCRAPE_MAX  4096
+
+__thread struct aesd_counters* aesd_counters_self = NULL;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct aesd_counters* _Atomic all_blocks = NULL;
+static struct aesd_counters* free_blocks = NULL;
+static pthread_key_t self_key;
+static pthread_once_t self_once = PTHREAD_ONCE_INIT;
+
+// runs when a counting thread exits, its block goes to the next thread
+static void release_block( void* arg ){
+    struct aesd_counters* c = arg;
+
+    pthread_mutex_lock( &registry_lock );
+    c->next_free = free_blocks;
+    free_blocks = c;
+    pthread_mutex_unlock( &registry_lock );
+}
+
+static void create_key( void ){
+    pthread_key_create( &self_key, release_block );
+}
+
+struct aesd_counters* aesd_counters_attach( void ){
+    struct aesd_counters* c;
+
+    pthread_once( &self_once, create_key );
+    pthread_mutex_lock( &registry_lock );
+
+    if( ( c = free_blocks ) != NULL ){
+        free_blocks = c->next_free;
+    }else if( ( c = aligned_alloc( 64, sizeof( *c ) ) ) != NULL ){
+        memset( c, 0, sizeof( *c ) );
+        c->next = atomic_load_explicit( &all_blocks, memory_order_relaxed );
+        // scrapes walk the list without the lock
+        atomic_store_explicit( &all_blocks, c, memory_order_release );
+    }
+
+    pthread_mutex_unlock( &registry_lock );
+
+    if( c ){
+        aesd_counters_self = c;
+        pthread_setspecific( self_key, c );
+    }
+
+    return c;
+}
+
+void aesd_count_commit( char const* buf, size_t len ){
+    uint64_t records = 0;
+
+    for( char const* p = buf, *end = buf + len; ( p = memchr( p, '\n', end - p ) ) != NULL; p ++ ){
+        records ++;
+    }
+
+    aesd_count( AESD_CTR_BYTES, len );
+    aesd_count( AESD_CTR_RECORDS, records );
+}
+
+static uint64_t total( enum aesd_counter ctr ){
+    uint64_t sum = 0;
+
+    for( struct aesd_counters* c = atomic_load_explicit( &all_blocks, memory_order_acquire ); c; c = c->next ){
+        sum += atomic_load_explicit( &c->v[ ctr ], memory_order_relaxed );
+    }
+
+    return sum;
+}
+
+struct out {
+    char*   buf;
+    size_t  size;
+    size_t  len;
+};
+
+static void __attribute__(( format( printf, 2, 3 ) )) put( struct out* o, char const* fmt, ... ){
+    va_list ap;
+    int n;
+
+    va_start( ap, fmt );
+    n = vsnprintf( o->buf + ( o->len < o->size ? o->len : o->size ), o->len < o->size ? o->size - o->len : 0, fmt, ap );
+    va_end( ap );
+    o->len += n > 0 ? n : 0;
+}
+
+static void put_head( struct out* o, char const* name, char const* type, char const* help ){
+    put( o, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type );
+}
+
+int aesd_metrics_format( char* buf, size_t size, struct aesd_gauges const* g ){
+    struct out o = { buf, size, 0 };
+    uint64_t records = total( AESD_CTR_RECORDS );
+
+    put_head( &o, "aesd_connections", "gauge", "Open client connections." );
+    put( &o, "aesd_connections{engine=\"%s\"} %u\n", g->engine, g->connections );
+    put_head( &o, "aesd_log_start_bytes", "gauge", "Log offset of the oldest byte kept." );
+    put( &o, "aesd_log_start_bytes %llu\n", ( unsigned long long )g->log_start );
+    put_head( &o, "aesd_log_end_bytes", "gauge", "Log offset one past the newest byte." );
+    put( &o, "aesd_log_end_bytes %llu\n", ( unsigned long long )g->log_end );
+    put_head( &o, "aesd_accepts_total", "counter", "Connections accepted." );
+    put( &o, "aesd_accepts_total %llu\n", ( unsigned long long )total( AESD_CTR_ACCEPTS ) );
+    put_head( &o, "aesd_records_total", "counter", "Records committed to the log." );
+    put( &o, "aesd_records_total %llu\n", ( unsigned long long )records );
+    put_head( &o, "aesd_committed_bytes_total", "counter", "Bytes committed to the log." );
+    put( &o, "aesd_committed_bytes_total %llu\n", ( unsigned long long )total( AESD_CTR_BYTES ) );
+    put_head( &o, "aesd_replay_bytes_total", "counter", "Bytes of the log sent to clients." );
+    put( &o, "aesd_replay_bytes_total %llu\n", ( unsigned long long )total( AESD_CTR_REPLAY_BYTES ) );
+    put_head( &o, "aesd_write_lock_wait_seconds_total", "counter", "Time spent waiting for the write lock." );
+    put( &o, "aesd_write_lock_wait_seconds_total %.9f\n", total( AESD_CTR_LOCK_WAIT_NS ) / 1e9 );
+    put_head( &o, "aesd_syscalls_total", "counter", "Socket and backend reads and writes of the request path." );
+    put( &o, "aesd_syscalls_total %llu\n", ( unsigned long long )total( AESD_CTR_SYSCALLS ) );
+    put_head( &o, "aesd_syscalls_per_record", "gauge", "Request path syscalls per record committed." );
+    put( &o, "aesd_syscalls_per_record %.3f\n", records ? ( double )total( AESD_CTR_SYSCALLS ) / records : 0.0 );
+    put_head( &o, "aesd_throttled_total", "counter", "Clients paused by their rate limit." );
+    put( &o, "aesd_throttled_total %llu\n", ( unsigned long long )total( AESD_CTR_THROTTLED ) );
+    put_head( &o, "aesd_backend_errors_total", "counter", "Failed backend operations." );
+    put( &o, "aesd_backend_errors_total{backend=\"%s\",op=\"write\"} %llu\n", g->backend,
+         ( unsigned long long )total( AESD_CTR_WRITE_ERRORS ) );
+    put( &o, "aesd_backend_errors_total{backend=\"%s\",op=\"read\"} %llu\n", g->backend,
+         ( unsigned long long )total( AESD_CTR_READ_ERRORS ) );
+    return o.len;
+}
+
+int aesd_metrics_listen( char const* path ){
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if( strlen( path ) >= sizeof( addr.sun_path ) ){
+        syslog( LOG_ERR, "Stats socket path too long: %s\n", path );
+        return -1;
+    }
+
+    strcpy( addr.sun_path, path );
+    fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0 );
+
+    if( fd < 0 ){
+        syslog( LOG_ERR, "Failed to create stats socket, err: %s\n", strerror( errno ) );
+        return -1;
+    }
+
+    // a predecessor of a hot restart leaves the path to us
+    unlink( path );
+
+    if( bind( fd, ( struct sockaddr* )&addr, sizeof( addr ) ) < 0 || listen( fd, 8 ) < 0 ){
+        syslog( LOG_ERR, "Failed to listen on %s, err: %s\n", path, strerror( errno ) );
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+void aesd_metrics_serve( int lfd, struct aesd_gauges const* g ){
+    char buf[ SCRAPE_MAX ];
+    int fd, len = -1;
+
+    while( ( fd = accept4( lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK ) ) >= 0 ){
+        if( len < 0 ){
+            len = aesd_metrics_format( buf, sizeof( buf ), g );
+            len = ( size_t )len < sizeof( buf ) ? len : ( int )sizeof( buf ) - 1;
+        }
+
+        // a scrape fits into the socket buffer, a client that does not read loses it
+        if( send( fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL ) < len ){
+            syslog( LOG_WARNING, "Short write to a stats client\n" );
+        }
+
+        close( fd );
+    }
+}
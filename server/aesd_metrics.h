@@ -0,0 +1,80 @@
+#pragma once
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Operational counters, served in the Prometheus text format on the Unix socket given with
+ * --stats-socket.  Every thread counts into a block of its own, aligned to a cache line and only
+ * ever written by that thread, so counting is a plain load and store and a scrape merely reads the
+ * blocks.  The block of a thread that exited is handed to the next thread and keeps counting, a
+ * counter is the sum over all blocks.
+ */
+
+enum aesd_counter {
+    AESD_CTR_ACCEPTS = 0,       /* connections accepted */
+    AESD_CTR_RECORDS,           /* newline terminated records committed */
+    AESD_CTR_BYTES,             /* bytes committed */
+    AESD_CTR_REPLAY_BYTES,      /* bytes of the log sent to clients */
+    AESD_CTR_LOCK_WAIT_NS,      /* time spent waiting for the write lock */
+    AESD_CTR_SYSCALLS,          /* socket and backend reads and writes of the request path */
+    AESD_CTR_WRITE_ERRORS,      /* failed backend writes */
+    AESD_CTR_READ_ERRORS,       /* failed backend reads */
+    AESD_CTR_THROTTLED,         /* clients paused by their rate limit */
+    AESD_CTR_COUNT
+};
+
+struct aesd_counters {
+    _Atomic uint64_t        v[ AESD_CTR_COUNT ];
+    struct aesd_counters*   next;       /* all blocks, newest first */
+    struct aesd_counters*   next_free;  /* blocks of exited threads */
+} __attribute__(( aligned( 64 ) ));
+
+/*
+ * Values of the engine that are not counters.
+ */
+struct aesd_gauges {
+    char const*     engine;         /* "threads" or "epoll" */
+    char const*     backend;        /* "file" or "device" */
+    unsigned        connections;
+    uint64_t        log_start;
+    uint64_t        log_end;
+};
+
+extern __thread struct aesd_counters* aesd_counters_self;
+
+/**
+ * Takes a block for the calling thread.
+ * @return NULL when out of memory, the thread does not count then.
+ */
+struct aesd_counters* aesd_counters_attach( void );
+
+static inline void aesd_count( enum aesd_counter ctr, uint64_t n ){
+    struct aesd_counters* c = aesd_counters_self ? aesd_counters_self : aesd_counters_attach();
+
+    if( c ){
+        atomic_store_explicit( &c->v[ ctr ], atomic_load_explicit( &c->v[ ctr ], memory_order_relaxed ) + n,
+                               memory_order_relaxed );
+    }
+}
+
+/**
+ * Counts @param len bytes committed from @param buf and the records they complete.
+ */
+void aesd_count_commit( char const* buf, size_t len );
+
+/**
+ * Formats the counters and @param g in the Prometheus text format.
+ * @return the length, as snprintf().
+ */
+int aesd_metrics_format( char* buf, size_t size, struct aesd_gauges const* g );
+
+/**
+ * @return the listening, non blocking stats socket bound to @param path, or -1 on error.
+ */
+int aesd_metrics_listen( char const* path );
+
+/**
+ * Answers every client waiting on the stats socket @param lfd and closes it.
+ */
+void aesd_metrics_serve( int lfd, struct aesd_gauges const* g );
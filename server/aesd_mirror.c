@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include "aesd_mirror.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+struct aesd_mirror_chunk {
+    atomic_uint refs;
+    size_t      used;
+    char        data[ AESD_MIRROR_CHUNK ];
+};
+
+static void chunk_put( struct aesd_mirror_chunk* c ){
+    if( atomic_fetch_sub_explicit( &c->refs, 1, memory_order_acq_rel ) == 1 ){
+        free( c );
+    }
+}
+
+static struct aesd_mirror_chunk* chunk_at( struct aesd_mirror* m, unsigned i ){
+    return m->chunks[ ( m->head + i ) % m->cap ];
+}
+
+bool aesd_mirror_init( struct aesd_mirror* m, size_t max_bytes ){
+    memset( m, 0, sizeof( *m ) );
+    m->max_bytes = max_bytes;
+    // the newest chunk may be nearly empty, so the bound needs one spare slot
+    m->cap = max_bytes / AESD_MIRROR_CHUNK + 2;
+    m->chunks = calloc( m->cap, sizeof( *m->chunks ) );
+    return m->chunks != NULL;
+}
+
+void aesd_mirror_destroy( struct aesd_mirror* m ){
+    for( unsigned i = 0; m->chunks && i < m->count; i ++ ){
+        chunk_put( chunk_at( m, i ) );
+    }
+
+    free( m->chunks );
+    memset( m, 0, sizeof( *m ) );
+}
+
+// drops the oldest chunk, views still holding it keep it alive
+static void drop_oldest( struct aesd_mirror* m ){
+    struct aesd_mirror_chunk* c = chunk_at( m, 0 );
+
+    m->base += c->used;
+    m->head = ( m->head + 1 ) % m->cap;
+    m->count --;
+    chunk_put( c );
+}
+
+bool aesd_mirror_append( struct aesd_mirror* m, char const* buf, size_t len ){
+    char const* nl = len ? memrchr( buf, '\n', len ) : NULL;
+
+    if( nl ){
+        m->record_end = m->end + ( nl - buf ) + 1;
+
+        for( char const* p = buf; ( p = memchr( p, '\n', buf + len - p ) ) != NULL; p ++ ){
+            m->records ++;
+        }
+    }
+
+    while( len > 0 ){
+        struct aesd_mirror_chunk* tail = m->count ? chunk_at( m, m->count - 1 ) : NULL;
+
+        if( !tail || tail->used == AESD_MIRROR_CHUNK ){
+            if( m->count == m->cap ){
+                drop_oldest( m );
+            }
+
+            tail = malloc( sizeof( *tail ) );
+
+            if( !tail ){
+                return false;
+            }
+
+            atomic_init( &tail->refs, 1 );
+            tail->used = 0;
+            m->chunks[ ( m->head + m->count ) % m->cap ] = tail;
+            m->count ++;
+        }
+
+        size_t n = AESD_MIRROR_CHUNK - tail->used;
+        n = n < len ? n : len;
+        memcpy( tail->data + tail->used, buf, n );
+        tail->used += n;
+        m->end += n;
+        buf += n;
+        len -= n;
+    }
+
+    while( m->count > 1 && m->end - m->base > m->max_bytes ){
+        drop_oldest( m );
+    }
+
+    return true;
+}
+
+bool aesd_mirror_view( struct aesd_mirror* m, uint64_t start, uint64_t end, struct aesd_mirror_view* v ){
+    uint64_t pos = m->base;
+    unsigned first = 0;
+
+    memset( v, 0, sizeof( *v ) );
+
+    if( start < m->base || end > m->end || start > end ){
+        return false;
+    }
+
+    if( start == end ){
+        return true;
+    }
+
+    while( pos + chunk_at( m, first )->used <= start ){
+        pos += chunk_at( m, first )->used;
+        first ++;
+    }
+
+    v->first_off = start - pos;
+    v->len = end - start;
+    v->chunks = malloc( ( m->count - first ) * sizeof( *v->chunks ) );
+
+    if( !v->chunks ){
+        return false;
+    }
+
+    for( unsigned i = first; i < m->count && pos < end; i ++ ){
+        struct aesd_mirror_chunk* c = chunk_at( m, i );
+
+        atomic_fetch_add_explicit( &c->refs, 1, memory_order_relaxed );
+        v->chunks[ v->count ++ ] = c;
+        pos += c->used;
+    }
+
+    return true;
+}
+
+bool aesd_mirror_send( int fd, struct aesd_mirror_view const* v, size_t skip ){
+    struct iovec iov[ 64 ];
+    size_t off, left;
+    unsigned next;
+
+    if( skip >= v->len ){
+        return true;
+    }
+
+    // every chunk but the newest is full, so the chunk holding a byte is a division away
+    off = v->first_off + skip;
+    next = off / AESD_MIRROR_CHUNK;
+    off %= AESD_MIRROR_CHUNK;
+    left = v->len - skip;
+
+    while( left > 0 ){
+        int n = 0;
+
+        // the chunk bytes up to used were written before the view was taken and never change
+        for( size_t budget = left; next + n < v->count && n < 64 && budget > 0; n ++ ){
+            struct aesd_mirror_chunk* c = v->chunks[ next + n ];
+            size_t o = n == 0 ? off : 0;
+            size_t l = AESD_MIRROR_CHUNK - o < budget ? AESD_MIRROR_CHUNK - o : budget;
+
+            iov[ n ].iov_base = c->data + o;
+            iov[ n ].iov_len = l;
+            budget -= l;
+        }
+
+        ssize_t sent = writev( fd, iov, n );
+
+        if( sent < 0 ){
+            if( errno == EINTR ){
+                continue;
+            }
+
+            return false;
+        }
+
+        left -= sent;
+
+        // advance over the chunks written completely
+        for( int i = 0; i < n && sent > 0; i ++ ){
+            if( ( size_t )sent >= iov[ i ].iov_len ){
+                sent -= iov[ i ].iov_len;
+                next ++;
+                off = 0;
+            }else{
+                off = ( i == 0 ? off : 0 ) + sent;
+                sent = 0;
+            }
+        }
+    }
+
+    return true;
+}
+
+void aesd_mirror_release( struct aesd_mirror_view* v ){
+    for( unsigned i = 0; i < v->count; i ++ ){
+        chunk_put( v->chunks[ i ] );
+    }
+
+    free( v->chunks );
+    memset( v, 0, sizeof( *v ) );
+}
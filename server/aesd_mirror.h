@@ -0,0 +1,62 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * In memory copy of the tail of the log, so replays are served with writev() instead of reading
+ * the backend again.  Appends go to the newest chunk of an append only chunk list, once the
+ * mirror holds more than its bound the oldest chunks are dropped.  Offsets are stream positions:
+ * bytes appended since the mirror was created.
+ *
+ * Chunks are reference counted.  A view pins the chunks of a byte range, so it can be sent without
+ * holding any lock while appends and truncation go on.  Appends, truncation and taking views must
+ * be serialized by the caller.
+ */
+
+#define AESD_MIRROR_CHUNK   ( 64 * 1024 )
+
+struct aesd_mirror_chunk;
+
+struct aesd_mirror {
+    struct aesd_mirror_chunk**  chunks;     /* ring of chunk pointers, head is the oldest */
+    unsigned                    head;
+    unsigned                    count;
+    unsigned                    cap;
+    uint64_t                    base;       /* stream position of the first byte held */
+    uint64_t                    end;        /* stream position one past the newest byte */
+    uint64_t                    record_end; /* stream position one past the newest newline */
+    uint64_t                    records;    /* newlines appended */
+    size_t                      max_bytes;
+};
+
+struct aesd_mirror_view {
+    struct aesd_mirror_chunk**  chunks;
+    unsigned                    count;
+    size_t                      first_off;  /* offset of the first byte in chunks[ 0 ] */
+    size_t                      len;
+};
+
+bool aesd_mirror_init( struct aesd_mirror* m, size_t max_bytes );
+
+void aesd_mirror_destroy( struct aesd_mirror* m );
+
+/**
+ * @return false when out of memory, the mirror is unusable then.
+ */
+bool aesd_mirror_append( struct aesd_mirror* m, char const* buf, size_t len );
+
+/**
+ * Pins the bytes [ @param start, @param end ) into @param v.
+ * @return false when part of the range is no longer held.
+ */
+bool aesd_mirror_view( struct aesd_mirror* m, uint64_t start, uint64_t end, struct aesd_mirror_view* v );
+
+/**
+ * Writes the view to @param fd with writev(), leaving out its first @param skip bytes, no lock needed.
+ * @return false when the connection failed.
+ */
+bool aesd_mirror_send( int fd, struct aesd_mirror_view const* v, size_t skip );
+
+void aesd_mirror_release( struct aesd_mirror_view* v );
@@ -0,0 +1,136 @@
+#pragma once
+/*
+ * Binary framing for machine clients.  A connection that starts with AESD_PROTO_MAGIC speaks
+ * frames instead of newline terminated text, the server confirms by sending the magic back.
+ *
+ * Every frame is a fixed header followed by len payload bytes, all integers big endian:
+ *
+ *      0   op       request opcode, replies carry op | AESD_OP_REPLY
+ *      1   status   0 in requests, enum aesd_proto_status in replies
+ *      2   flags    AESD_FLAG_MORE
+ *      4   len      payload bytes
+ *      8   seq      chosen by the client, echoed in every frame of the reply
+ *
+ * Requests may be pipelined.  A reply is one or more frames carrying the seq of its request, all
+ * but the last with AESD_FLAG_MORE set, their payloads concatenated.  Clients match replies by seq
+ * and must not rely on their order.
+ *
+ *  AESD_OP_APPEND       payload is appended to the log as is, empty reply
+ *  AESD_OP_REPLAY_FROM  payload is a u64 log offset, the reply holds the log from there on
+ *  AESD_OP_SEEK         payload is u32 write_cmd, u32 write_cmd_offset as for AESDCHAR_IOCSEEKTO,
+ *                       the reply holds the log from that position on, a data file needs the
+ *                       record index for it
+ *  AESD_OP_STATS        empty payload, the reply holds "name value" lines
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define AESD_PROTO_MAGIC        "AESDBIN1"
+#define AESD_PROTO_MAGIC_LEN    8
+#define AESD_FRAME_HDR_LEN      16
+#define AESD_FLAG_MORE          0x0001
+#define AESD_OP_REPLY           0x80
+
+enum aesd_proto_op {
+    AESD_OP_APPEND = 1,
+    AESD_OP_REPLAY_FROM = 2,
+    AESD_OP_SEEK = 3,
+    AESD_OP_STATS = 4
+};
+
+enum aesd_proto_status {
+    AESD_STATUS_OK = 0,
+    AESD_STATUS_BAD_REQUEST,    /* unknown opcode or malformed payload */
+    AESD_STATUS_TOO_LARGE,      /* payload above the server maxline, the connection is closed */
+    AESD_STATUS_UNSUPPORTED,    /* not available with this backend or engine */
+    AESD_STATUS_FAILED          /* the backend reported an error */
+};
+
+struct aesd_frame {
+    uint8_t     op;
+    uint8_t     status;
+    uint16_t    flags;
+    uint32_t    len;
+    uint64_t    seq;
+};
+
+static inline void aesd_proto_put_u32( uint8_t* p, uint32_t v ){
+    for( int i = 3; i >= 0; i -- ){
+        p[ i ] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+static inline void aesd_proto_put_u64( uint8_t* p, uint64_t v ){
+    for( int i = 7; i >= 0; i -- ){
+        p[ i ] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+static inline uint32_t aesd_proto_get_u32( uint8_t const* p ){
+    uint32_t v = 0;
+
+    for( int i = 0; i < 4; i ++ ){
+        v = ( v << 8 ) | p[ i ];
+    }
+
+    return v;
+}
+
+static inline uint64_t aesd_proto_get_u64( uint8_t const* p ){
+    uint64_t v = 0;
+
+    for( int i = 0; i < 8; i ++ ){
+        v = ( v << 8 ) | p[ i ];
+    }
+
+    return v;
+}
+
+static inline void aesd_frame_encode( struct aesd_frame const* f, uint8_t* out ){
+    out[ 0 ] = f->op;
+    out[ 1 ] = f->status;
+    out[ 2 ] = f->flags >> 8;
+    out[ 3 ] = f->flags & 0xff;
+    aesd_proto_put_u32( out + 4, f->len );
+    aesd_proto_put_u64( out + 8, f->seq );
+}
+
+static inline void aesd_frame_decode( uint8_t const* in, struct aesd_frame* f ){
+    f->op = in[ 0 ];
+    f->status = in[ 1 ];
+    f->flags = ( uint16_t )( ( in[ 2 ] << 8 ) | in[ 3 ] );
+    f->len = aesd_proto_get_u32( in + 4 );
+    f->seq = aesd_proto_get_u64( in + 8 );
+}
+
+/**
+ * @return true when @param buf starts with the magic.  @param len below the magic length only
+ * tells whether the text seen so far could still become the magic.
+ */
+static inline bool aesd_proto_is_magic( char const* buf, size_t len ){
+    return memcmp( buf, AESD_PROTO_MAGIC, len < AESD_PROTO_MAGIC_LEN ? len : AESD_PROTO_MAGIC_LEN ) == 0;
+}
+
+/**
+ * Takes the next complete frame from @param buf.
+ * @return the bytes it spans, 0 when more input is needed.  Check f->len against the payload
+ * limit before waiting for more, a frame larger than the input buffer never completes.
+ */
+static inline size_t aesd_frame_next( char const* buf, size_t len, struct aesd_frame* f, char const** payload ){
+    if( len < AESD_FRAME_HDR_LEN ){
+        return 0;
+    }
+
+    aesd_frame_decode( ( uint8_t const* )buf, f );
+
+    if( len - AESD_FRAME_HDR_LEN < f->len ){
+        return 0;
+    }
+
+    *payload = buf + AESD_FRAME_HDR_LEN;
+    return AESD_FRAME_HDR_LEN + f->len;
+}
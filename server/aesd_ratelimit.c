@@ -0,0 +1,199 @@
+#include "aesd_ratelimit.h"
+#include "aesd_latency.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PEER_CHAINS     1024
+
+/*
+ * An address stays in the table while it has connections or its bucket is not full, so closing
+ * and reconnecting does not refill it.
+ */
+struct aesd_peer {
+    struct aesd_peer*   next;
+    in_addr_t           addr;
+    unsigned            refs;       /* connections, under the table lock */
+    pthread_mutex_t     lock;       /* guards the bucket */
+    struct aesd_bucket  bucket;
+};
+
+static void fill_burst( struct aesd_limit* l ){
+    if( l->rate > 0 && l->burst == 0 ){
+        l->burst = l->rate;
+    }
+}
+
+static void refill( struct aesd_bucket* b, struct aesd_limit const* l, uint64_t now ){
+    // another thread may have refilled with a later clock reading
+    if( now <= b->stamp_ns ){
+        return;
+    }
+
+    b->tokens += ( double )l->rate * ( now - b->stamp_ns ) / 1e9;
+    b->stamp_ns = now;
+
+    if( b->tokens > l->burst ){
+        b->tokens = l->burst;
+    }
+}
+
+static void bucket_start( struct aesd_bucket* b, struct aesd_limit const* l, uint64_t now ){
+    b->tokens = l->burst;
+    b->stamp_ns = now;
+}
+
+// nanoseconds until @param b is out of debt
+static uint64_t bucket_delay( struct aesd_bucket* b, struct aesd_limit const* l, uint64_t now ){
+    refill( b, l, now );
+    return b->tokens >= 0 ? 0 : ( uint64_t )( -b->tokens * 1e9 / l->rate ) + 1;
+}
+
+static unsigned chain_of( in_addr_t addr ){
+    return ( ( uint32_t )addr * 2654435761u ) % PEER_CHAINS;
+}
+
+// with the table lock held, an unused address has no lock holders left
+static bool peer_idle( struct aesd_ratelimit* rl, struct aesd_peer* p, uint64_t now ){
+    if( p->refs > 0 ){
+        return false;
+    }
+
+    refill( &p->bucket, &rl->ip, now );
+    return p->bucket.tokens >= rl->ip.burst;
+}
+
+static void peer_free( struct aesd_peer* p ){
+    pthread_mutex_destroy( &p->lock );
+    free( p );
+}
+
+bool aesd_ratelimit_init( struct aesd_ratelimit* rl, struct aesd_limit conn, struct aesd_limit ip ){
+    memset( rl, 0, sizeof( *rl ) );
+    fill_burst( &conn );
+    fill_burst( &ip );
+    rl->conn = conn;
+    rl->ip = ip;
+    pthread_mutex_init( &rl->lock, NULL );
+
+    if( ip.rate > 0 ){
+        rl->npeers = PEER_CHAINS;
+        rl->peers = calloc( rl->npeers, sizeof( *rl->peers ) );
+    }
+
+    return ip.rate == 0 || rl->peers != NULL;
+}
+
+void aesd_ratelimit_free( struct aesd_ratelimit* rl ){
+    for( unsigned i = 0; i < rl->npeers; i ++ ){
+        while( rl->peers[ i ] ){
+            struct aesd_peer* p = rl->peers[ i ];
+
+            rl->peers[ i ] = p->next;
+            peer_free( p );
+        }
+    }
+
+    free( rl->peers );
+    pthread_mutex_destroy( &rl->lock );
+    memset( rl, 0, sizeof( *rl ) );
+}
+
+bool aesd_ratelimit_attach( struct aesd_ratelimit* rl, struct aesd_client_limit* cl, struct in_addr addr ){
+    uint64_t now = aesd_latency_now();
+    struct aesd_peer* p;
+
+    bucket_start( &cl->bucket, &rl->conn, now );
+    cl->peer = NULL;
+
+    if( rl->ip.rate == 0 ){
+        return true;
+    }
+
+    pthread_mutex_lock( &rl->lock );
+
+    // looks the address up and drops the idle entries on the way
+    for( struct aesd_peer** pp = &rl->peers[ chain_of( addr.s_addr ) ]; ( p = *pp ) != NULL; ){
+        if( p->addr == addr.s_addr ){
+            break;
+        }
+
+        if( peer_idle( rl, p, now ) ){
+            *pp = p->next;
+            peer_free( p );
+        }else{
+            pp = &p->next;
+        }
+    }
+
+    if( !p && ( p = calloc( 1, sizeof( *p ) ) ) != NULL ){
+        p->addr = addr.s_addr;
+        pthread_mutex_init( &p->lock, NULL );
+        bucket_start( &p->bucket, &rl->ip, now );
+        p->next = rl->peers[ chain_of( addr.s_addr ) ];
+        rl->peers[ chain_of( addr.s_addr ) ] = p;
+    }
+
+    if( p ){
+        p->refs ++;
+        cl->peer = p;
+    }
+
+    pthread_mutex_unlock( &rl->lock );
+    return p != NULL;
+}
+
+void aesd_ratelimit_detach( struct aesd_ratelimit* rl, struct aesd_client_limit* cl ){
+    struct aesd_peer* p = cl->peer;
+
+    if( !p ){
+        return;
+    }
+
+    pthread_mutex_lock( &rl->lock );
+    p->refs --;
+
+    if( peer_idle( rl, p, aesd_latency_now() ) ){
+        struct aesd_peer** pp = &rl->peers[ chain_of( p->addr ) ];
+
+        while( *pp != p ){
+            pp = &( *pp )->next;
+        }
+
+        *pp = p->next;
+        peer_free( p );
+    }
+
+    pthread_mutex_unlock( &rl->lock );
+    cl->peer = NULL;
+}
+
+void aesd_ratelimit_charge( struct aesd_ratelimit* rl, struct aesd_client_limit* cl, uint64_t cost ){
+    if( rl->conn.rate > 0 ){
+        cl->bucket.tokens -= cost;
+    }
+
+    if( cl->peer ){
+        pthread_mutex_lock( &cl->peer->lock );
+        cl->peer->bucket.tokens -= cost;
+        pthread_mutex_unlock( &cl->peer->lock );
+    }
+}
+
+uint64_t aesd_ratelimit_delay( struct aesd_ratelimit* rl, struct aesd_client_limit* cl ){
+    uint64_t now = aesd_latency_now();
+    uint64_t delay = 0, peer_delay;
+
+    if( rl->conn.rate > 0 ){
+        delay = bucket_delay( &cl->bucket, &rl->conn, now );
+    }
+
+    if( cl->peer ){
+        pthread_mutex_lock( &cl->peer->lock );
+        peer_delay = bucket_delay( &cl->peer->bucket, &rl->ip, now );
+        pthread_mutex_unlock( &cl->peer->lock );
+        delay = peer_delay > delay ? peer_delay : delay;
+    }
+
+    return delay;
+}
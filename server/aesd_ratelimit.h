@@ -0,0 +1,74 @@
+#pragma once
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Token buckets limiting what a client may cost the server, one per connection and one shared by
+ * all connections from the same source address.  The cost of a client is the bytes it sends plus
+ * the bytes of the log replayed to it, so neither streaming data nor spamming newlines for full
+ * replays gets around the limit.  Costs are charged after the fact and may drive a bucket into
+ * debt, the engine then stops reading from the client until aesd_ratelimit_delay() is 0 again.
+ *
+ * A rate of 0 disables that limit.  Charging and the delay may be called from any thread.
+ */
+
+struct aesd_limit {
+    uint64_t    rate;       /* bytes per second, 0 = no limit */
+    uint64_t    burst;      /* bytes a full bucket holds */
+};
+
+struct aesd_bucket {
+    double      tokens;     /* negative while in debt */
+    uint64_t    stamp_ns;   /* last refill */
+};
+
+struct aesd_peer;
+
+struct aesd_ratelimit {
+    struct aesd_limit   conn;
+    struct aesd_limit   ip;
+    pthread_mutex_t     lock;       /* guards the peer table */
+    struct aesd_peer**  peers;      /* hash chains by address */
+    unsigned            npeers;     /* chains */
+};
+
+/*
+ * What a connection keeps for its limits.
+ */
+struct aesd_client_limit {
+    struct aesd_bucket  bucket;
+    struct aesd_peer*   peer;       /* NULL without a per address limit */
+};
+
+/**
+ * Sets up @param rl, a burst of 0 is one second worth of the rate.
+ * @return false when out of memory.
+ */
+bool aesd_ratelimit_init( struct aesd_ratelimit* rl, struct aesd_limit conn, struct aesd_limit ip );
+
+void aesd_ratelimit_free( struct aesd_ratelimit* rl );
+
+/**
+ * Starts the limits of a connection from @param addr with full buckets.
+ * @return false when out of memory for a new address, the connection is then only limited by
+ * its own bucket.
+ */
+bool aesd_ratelimit_attach( struct aesd_ratelimit* rl, struct aesd_client_limit* cl, struct in_addr addr );
+
+void aesd_ratelimit_detach( struct aesd_ratelimit* rl, struct aesd_client_limit* cl );
+
+/**
+ * Takes @param cost bytes from the buckets of the connection and its address.
+ */
+void aesd_ratelimit_charge( struct aesd_ratelimit* rl, struct aesd_client_limit* cl, uint64_t cost );
+
+/**
+ * @return the nanoseconds until both buckets are out of debt, 0 when the client may be served.
+ */
+uint64_t aesd_ratelimit_delay( struct aesd_ratelimit* rl, struct aesd_client_limit* cl );
+
+static inline bool aesd_ratelimit_on( struct aesd_ratelimit const* rl ){
+    return rl->conn.rate > 0 || rl->ip.rate > 0;
+}
@@ -0,0 +1,524 @@
+#define _GNU_SOURCE
+#include "aesd_seglog.h"
+#include "aesd_durability.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/file.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEGMENT_DIGITS      16
+#define REAPER_INTERVAL_S   1
+
+struct aesd_segment {
+    atomic_uint refs;
+    int         fd;
+    uint64_t    start;      /* log offset of its first byte */
+    char        path[];
+};
+
+/**
+ * Opens the segment starting at @param start, the @param active one for appending.
+ */
+static struct aesd_segment* segment_open( struct aesd_seglog* log, uint64_t start, bool active ){
+    size_t len = strlen( log->path ) + SEGMENT_DIGITS + 2;
+    struct aesd_segment* seg = malloc( sizeof( *seg ) + len );
+
+    if( !seg ){
+        return NULL;
+    }
+
+    if( log->segment_size > 0 ){
+        snprintf( seg->path, len, "%s.%0*" PRIx64, log->path, SEGMENT_DIGITS, start );
+
+        // a crash may have left the newest segment sealed, appends go on in it
+        if( active ){
+            chmod( seg->path, S_IRUSR | S_IWUSR );
+        }
+    }else{
+        snprintf( seg->path, len, "%s", log->path );
+    }
+
+    seg->fd = open( seg->path, active ? O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC : O_RDONLY | O_CLOEXEC,
+                    S_IRUSR | S_IWUSR );
+
+    if( seg->fd < 0 ){
+        syslog( LOG_ERR, "Cannot open segment %s, err: %s\n", seg->path, strerror( errno ) );
+        free( seg );
+        return NULL;
+    }
+
+    atomic_init( &seg->refs, 1 );
+    seg->start = start;
+    return seg;
+}
+
+static void segment_put( struct aesd_segment* seg ){
+    if( atomic_fetch_sub_explicit( &seg->refs, 1, memory_order_acq_rel ) == 1 ){
+        close( seg->fd );
+        free( seg );
+    }
+}
+
+static bool add_segment( struct aesd_seglog* log, struct aesd_segment* seg ){
+    bool ok = true;
+
+    pthread_mutex_lock( &log->lock );
+
+    if( log->count == log->cap ){
+        unsigned cap = log->cap ? log->cap * 2 : 16;
+        struct aesd_segment** segs = realloc( log->segs, cap * sizeof( *segs ) );
+
+        if( segs ){
+            log->segs = segs;
+            log->cap = cap;
+        }
+
+        ok = segs != NULL;
+    }
+
+    if( ok ){
+        log->segs[ log->count ++ ] = seg;
+    }
+
+    pthread_mutex_unlock( &log->lock );
+
+    if( !ok ){
+        segment_put( seg );
+    }
+
+    return ok;
+}
+
+// makes @param seg, the newest segment of the list, the one appended to
+static void activate( struct aesd_seglog* log, struct aesd_segment* seg ){
+    struct stat st;
+
+    pthread_mutex_lock( &log->lock );
+    log->active = seg;
+    pthread_cond_signal( &log->reaper_cond );
+    pthread_mutex_unlock( &log->lock );
+    log->active_len = fstat( seg->fd, &st ) == 0 ? st.st_size : 0;
+    aesd_durability_rebind( seg->fd );
+}
+
+static int cmp_start( void const* a, void const* b ){
+    uint64_t x = *( uint64_t const* )a, y = *( uint64_t const* )b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Adds the segment files found next to log->path, with @param newer_only those after the active
+ * one, and makes the newest of them active.
+ * @return false when none was added.
+ */
+static bool load_segments( struct aesd_seglog* log, bool newer_only ){
+    char* dir_path = strdup( log->path );
+    char* slash = dir_path ? strrchr( dir_path, '/' ) : NULL;
+    char const* base = slash ? slash + 1 : dir_path;
+    size_t base_len, n = 0, cap = 0;
+    uint64_t* starts = NULL;
+    bool ok = true;
+    struct dirent* de;
+    DIR* dir;
+
+    if( !dir_path ){
+        return false;
+    }
+
+    if( slash ){
+        *slash = '\0';
+    }
+
+    base_len = strlen( base );
+    dir = opendir( !slash ? "." : slash == dir_path ? "/" : dir_path );
+
+    while( dir && ( de = readdir( dir ) ) != NULL ){
+        char const* digits = de->d_name + base_len + 1;
+        uint64_t start;
+
+        if( strncmp( de->d_name, base, base_len ) != 0 || de->d_name[ base_len ] != '.' ||
+            strlen( digits ) != SEGMENT_DIGITS || strspn( digits, "0123456789abcdef" ) != SEGMENT_DIGITS ){
+            continue;
+        }
+
+        start = strtoull( digits, NULL, 16 );
+
+        if( newer_only && start <= log->active->start ){
+            continue;
+        }
+
+        if( n == cap ){
+            uint64_t* grown = realloc( starts, ( cap = cap ? cap * 2 : 16 ) * sizeof( *starts ) );
+
+            if( !grown ){
+                ok = false;
+                break;
+            }
+
+            starts = grown;
+        }
+
+        starts[ n ++ ] = start;
+    }
+
+    if( dir ){
+        closedir( dir );
+    }
+
+    if( n > 1 ){
+        qsort( starts, n, sizeof( *starts ), cmp_start );
+    }
+
+    for( size_t i = 0; i < n && ok; i ++ ){
+        struct aesd_segment* seg = segment_open( log, starts[ i ], i == n - 1 );
+
+        ok = seg && add_segment( log, seg );
+    }
+
+    ok = ok && n > 0;
+
+    if( ok ){
+        activate( log, log->segs[ log->count - 1 ] );
+    }
+
+    free( starts );
+    free( dir_path );
+    return ok;
+}
+
+// a segment shorter than the distance to the next one leaves a hole, only what follows it is served
+static void drop_holes( struct aesd_seglog* log ){
+    unsigned first = 0;
+    struct stat st;
+
+    for( unsigned i = 0; i + 1 < log->count; i ++ ){
+        if( fstat( log->segs[ i ]->fd, &st ) != 0 ||
+            ( uint64_t )st.st_size < log->segs[ i + 1 ]->start - log->segs[ i ]->start ){
+            first = i + 1;
+        }
+    }
+
+    if( first > 0 ){
+        syslog( LOG_WARNING, "Segments of %s before %s are incomplete, ignoring them\n", log->path,
+                log->segs[ first ]->path );
+
+        for( unsigned i = 0; i < first; i ++ ){
+            segment_put( log->segs[ i ] );
+        }
+
+        log->count -= first;
+        memmove( log->segs, log->segs + first, log->count * sizeof( *log->segs ) );
+    }
+}
+
+/*
+ * Seals the active segment and starts the next one where it ends.  When another server sealed it
+ * first, the segment it started is appended to instead.
+ */
+static bool rotate( struct aesd_seglog* log ){
+    struct aesd_segment* seg = log->active;
+    struct aesd_segment* next;
+    struct stat st;
+    bool ok = false;
+
+    if( flock( seg->fd, LOCK_EX ) < 0 ){
+        return false;
+    }
+
+    if( fstat( seg->fd, &st ) == 0 ){
+        ok = !( st.st_mode & S_IWUSR ) && load_segments( log, true );
+
+        if( !ok && ( next = segment_open( log, seg->start + st.st_size, true ) ) != NULL &&
+            add_segment( log, next ) ){
+            fchmod( seg->fd, S_IRUSR );
+            activate( log, next );
+            ok = true;
+        }
+    }
+
+    flock( seg->fd, LOCK_UN );
+    return ok;
+}
+
+// appends under a shared lock, so the server that took over cannot seal the segment meanwhile
+static ssize_t append_shared( struct aesd_seglog* log, char const* buf, size_t len ){
+    struct aesd_segment* seg;
+    struct stat st;
+    ssize_t n;
+    int err;
+
+    for( ;; ){
+        seg = log->active;
+
+        if( flock( seg->fd, LOCK_SH ) < 0 ){
+            return -1;
+        }
+
+        if( fstat( seg->fd, &st ) != 0 || ( st.st_mode & S_IWUSR ) || !load_segments( log, true ) ){
+            break;
+        }
+
+        flock( seg->fd, LOCK_UN );
+    }
+
+    n = write( seg->fd, buf, len );
+    err = errno;
+    flock( seg->fd, LOCK_UN );
+    errno = err;
+    return n;
+}
+
+static bool expired( struct aesd_seglog* log, time_t now ){
+    struct stat st;
+
+    // the active segment always stays
+    if( log->count < 2 ){
+        return false;
+    }
+
+    if( log->retain_bytes > 0 && fstat( log->active->fd, &st ) == 0 &&
+        log->active->start + st.st_size - log->segs[ 1 ]->start >= log->retain_bytes ){
+        return true;
+    }
+
+    return log->retain_secs > 0 && fstat( log->segs[ 0 ]->fd, &st ) == 0 &&
+           st.st_mtime + ( time_t )log->retain_secs <= now;
+}
+
+static void* reaper_thread( void* arg ){
+    struct aesd_seglog* log = arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock( &log->lock );
+
+    while( !log->reaper_stop ){
+        if( expired( log, time( NULL ) ) ){
+            struct aesd_segment* old = log->segs[ 0 ];
+
+            log->count --;
+            memmove( log->segs, log->segs + 1, log->count * sizeof( *log->segs ) );
+            atomic_store_explicit( &log->start, log->segs[ 0 ]->start, memory_order_release );
+            pthread_mutex_unlock( &log->lock );
+
+            // readers still sending from it keep the file open until they are done
+            syslog( LOG_INFO, "Retention deletes segment %s\n", old->path );
+
+            if( unlink( old->path ) < 0 && errno != ENOENT ){
+                syslog( LOG_ERR, "Cannot delete segment %s, err: %s\n", old->path, strerror( errno ) );
+            }
+
+            segment_put( old );
+            pthread_mutex_lock( &log->lock );
+            continue;
+        }
+
+        clock_gettime( CLOCK_MONOTONIC, &deadline );
+        deadline.tv_sec += REAPER_INTERVAL_S;
+        pthread_cond_timedwait( &log->reaper_cond, &log->lock, &deadline );
+    }
+
+    pthread_mutex_unlock( &log->lock );
+    return NULL;
+}
+
+bool aesd_seglog_open( struct aesd_seglog* log, char const* path, uint64_t segment_size,
+                       uint64_t retain_bytes, unsigned retain_secs ){
+    pthread_condattr_t attr;
+    struct aesd_segment* seg;
+    char c;
+
+    memset( log, 0, sizeof( *log ) );
+    pthread_mutex_init( &log->lock, NULL );
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &log->reaper_cond, &attr );
+    pthread_condattr_destroy( &attr );
+    log->path = strdup( path );
+    log->segment_size = segment_size;
+    log->retain_bytes = retain_bytes;
+    log->retain_secs = retain_secs;
+
+    if( log->path && segment_size > 0 ){
+        load_segments( log, false );
+    }
+
+    // a new log, or the single data file
+    if( log->path && log->count == 0 && ( seg = segment_open( log, 0, true ) ) != NULL && add_segment( log, seg ) ){
+        activate( log, seg );
+    }
+
+    if( !log->active ){
+        aesd_seglog_close( log );
+        return false;
+    }
+
+    drop_holes( log );
+    atomic_store( &log->start, log->segs[ 0 ]->start );
+
+    // a record cut short by a crash is completed before the segment can be sealed
+    log->at_boundary = log->active_len == 0 ||
+                       ( pread( log->active->fd, &c, 1, log->active_len - 1 ) == 1 && c == '\n' );
+
+    if( ( retain_bytes > 0 || retain_secs > 0 ) && segment_size > 0 ){
+        if( pthread_create( &log->reaper, NULL, reaper_thread, log ) != 0 ){
+            syslog( LOG_ERR, "Failed to start the retention thread\n" );
+            aesd_seglog_close( log );
+            return false;
+        }
+
+        log->reaper_on = true;
+    }
+
+    return true;
+}
+
+void aesd_seglog_close( struct aesd_seglog* log ){
+    if( log->reaper_on ){
+        pthread_mutex_lock( &log->lock );
+        log->reaper_stop = true;
+        pthread_cond_signal( &log->reaper_cond );
+        pthread_mutex_unlock( &log->lock );
+        pthread_join( log->reaper, NULL );
+    }
+
+    for( unsigned i = 0; i < log->count; i ++ ){
+        segment_put( log->segs[ i ] );
+    }
+
+    pthread_cond_destroy( &log->reaper_cond );
+    pthread_mutex_destroy( &log->lock );
+    free( log->segs );
+    free( log->path );
+    memset( log, 0, sizeof( *log ) );
+}
+
+void aesd_seglog_remove( struct aesd_seglog* log ){
+    pthread_mutex_lock( &log->lock );
+
+    for( unsigned i = 0; i < log->count; i ++ ){
+        unlink( log->segs[ i ]->path );
+    }
+
+    pthread_mutex_unlock( &log->lock );
+}
+
+ssize_t aesd_seglog_append( struct aesd_seglog* log, char const* buf, size_t len, uint64_t* end ){
+    ssize_t n;
+
+    if( log->segment_size > 0 && log->follow ){
+        n = append_shared( log, buf, len );
+    }else{
+        // sealing only between records keeps every record within one segment
+        if( log->segment_size > 0 && log->at_boundary && log->active_len >= log->segment_size &&
+            !rotate( log ) ){
+            syslog( LOG_WARNING, "Cannot rotate %s, err: %s\n", log->active->path, strerror( errno ) );
+        }
+
+        n = write( log->active->fd, buf, len );
+    }
+
+    if( n > 0 ){
+        // with O_APPEND the descriptor offset is where this write ended
+        log->active_len = lseek( log->active->fd, 0, SEEK_CUR );
+        log->at_boundary = buf[ n - 1 ] == '\n';
+        *end = log->active->start + log->active_len;
+    }
+
+    return n;
+}
+
+/**
+ * @return the segment holding log offset @param off with a reference, NULL when there is none.
+ * @param room receives how many bytes from @param off on belong to it.
+ */
+static struct aesd_segment* segment_get( struct aesd_seglog* log, uint64_t off, uint64_t* room ){
+    struct aesd_segment* seg = NULL;
+    unsigned lo = 0, hi;
+
+    pthread_mutex_lock( &log->lock );
+    hi = log->count;
+
+    while( hi - lo > 1 ){
+        unsigned mid = ( lo + hi ) / 2;
+
+        if( log->segs[ mid ]->start <= off ){
+            lo = mid;
+        }else{
+            hi = mid;
+        }
+    }
+
+    if( log->count > 0 && log->segs[ lo ]->start <= off ){
+        seg = log->segs[ lo ];
+        *room = lo + 1 < log->count ? log->segs[ lo + 1 ]->start - off : UINT64_MAX;
+        atomic_fetch_add_explicit( &seg->refs, 1, memory_order_relaxed );
+    }
+
+    pthread_mutex_unlock( &log->lock );
+    return seg;
+}
+
+ssize_t aesd_seglog_pread( struct aesd_seglog* log, char* buf, size_t len, uint64_t off ){
+    uint64_t room;
+    struct aesd_segment* seg = segment_get( log, off, &room );
+    ssize_t rn;
+    int err;
+
+    if( !seg ){
+        return 0;
+    }
+
+    rn = pread( seg->fd, buf, len < room ? len : room, off - seg->start );
+    err = errno;
+    segment_put( seg );
+    errno = err;
+    return rn;
+}
+
+ssize_t aesd_seglog_sendfile( struct aesd_seglog* log, int out_fd, uint64_t off, size_t len ){
+    uint64_t room;
+    struct aesd_segment* seg = segment_get( log, off, &room );
+    off_t pos;
+    ssize_t sent;
+    int err;
+
+    if( !seg ){
+        return 0;
+    }
+
+    pos = off - seg->start;
+    sent = sendfile( out_fd, seg->fd, &pos, len < room ? len : room );
+    err = errno;
+    segment_put( seg );
+    errno = err;
+    return sent;
+}
+
+uint64_t aesd_seglog_end( struct aesd_seglog* log ){
+    struct stat st;
+    uint64_t end;
+
+    pthread_mutex_lock( &log->lock );
+    end = log->active->start + ( fstat( log->active->fd, &st ) == 0 ? st.st_size : 0 );
+    pthread_mutex_unlock( &log->lock );
+    return end;
+}
+
+int aesd_seglog_fd( struct aesd_seglog* log ){
+    return log->active->fd;
+}
+
+void aesd_seglog_follow( struct aesd_seglog* log ){
+    log->follow = true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The data file backend as a sequence of segment files, addressed by 64 bit log offsets that stay
+ * the same across rotation and retention.  Segment files are named <path>.<offset of their first
+ * byte, 16 hex digits>, only the newest one is appended to.  Once it reached the segment size it
+ * is sealed at the next record boundary, so records never span two segments.  A background thread
+ * deletes the oldest sealed segments beyond the retention limits, readers that still use one keep
+ * it open until they are done.  With a segment size of 0 the log is the single file <path>, as
+ * before segments existed.
+ *
+ * Appends must be serialized by the caller, reads may come from any thread.
+ *
+ * During a hot restart two servers append to the same log.  Rotation takes an exclusive flock()
+ * on the segment it seals and marks it read only, a server that handed over its listeners calls
+ * aesd_seglog_follow() and from then on appends under a shared flock(), moving to the newest
+ * segment once its own was sealed.
+ */
+
+struct aesd_segment;
+
+struct aesd_seglog {
+    pthread_mutex_t         lock;           /* guards the segment list */
+    struct aesd_segment**   segs;           /* oldest first */
+    unsigned                count;
+    unsigned                cap;
+    struct aesd_segment*    active;         /* newest segment, only changed by the appending thread */
+    uint64_t                active_len;     /* bytes in the active segment after our last append */
+    _Atomic uint64_t        start;          /* log offset of the oldest byte kept */
+    char*                   path;
+    uint64_t                segment_size;
+    uint64_t                retain_bytes;   /* 0 = no limit */
+    unsigned                retain_secs;    /* 0 = no limit */
+    bool                    at_boundary;    /* the last byte appended ends a record */
+    bool                    follow;
+    bool                    reaper_on;
+    bool                    reaper_stop;
+    pthread_t               reaper;
+    pthread_cond_t          reaper_cond;
+};
+
+/**
+ * Opens the log at @param path, creating its first segment when there is none, and starts the
+ * retention thread when a limit is set.
+ */
+bool aesd_seglog_open( struct aesd_seglog* log, char const* path, uint64_t segment_size,
+                       uint64_t retain_bytes, unsigned retain_secs );
+
+void aesd_seglog_close( struct aesd_seglog* log );
+
+/**
+ * Unlinks every segment file, the log stays readable until aesd_seglog_close().
+ */
+void aesd_seglog_remove( struct aesd_seglog* log );
+
+/**
+ * Appends @param buf as write() would, rotating first when the active segment is full.
+ * @param end receives the log offset one past the bytes written, which may include bytes another
+ * server appended to the same segment.
+ */
+ssize_t aesd_seglog_append( struct aesd_seglog* log, char const* buf, size_t len, uint64_t* end );
+
+/**
+ * Reads from log offset @param off, never across a segment boundary.
+ * @return the bytes read, 0 when @param off is not or no longer in the log.
+ */
+ssize_t aesd_seglog_pread( struct aesd_seglog* log, char* buf, size_t len, uint64_t off );
+
+/**
+ * As aesd_seglog_pread() for sendfile() to @param out_fd.
+ */
+ssize_t aesd_seglog_sendfile( struct aesd_seglog* log, int out_fd, uint64_t off, size_t len );
+
+static inline uint64_t aesd_seglog_start( struct aesd_seglog* log ){
+    return atomic_load_explicit( &log->start, memory_order_acquire );
+}
+
+/**
+ * @return the log offset one past the newest byte, including appends of another server.
+ */
+uint64_t aesd_seglog_end( struct aesd_seglog* log );
+
+/**
+ * @return the descriptor of the active segment.
+ */
+int aesd_seglog_fd( struct aesd_seglog* log );
+
+/**
+ * Switches to appending after the server that took over, see above.
+ */
+void aesd_seglog_follow( struct aesd_seglog* log );
@@ -1,11 +1,24 @@
+#define _GNU_SOURCE
 #include "aesd_server_thrd.h"
 #include "aesdsocket_cfg.h"
+#include "aesd_timestamp.h"
+#include "aesd_handover.h"
+#include "aesd_logger.h"
+#include "aesd_mirror.h"
+#include "aesd_proto.h"
+#include "aesd_cmd.h"
+#include "aesd_index.h"
+#include "aesd_seglog.h"
+#include "aesd_latency.h"
+#include "aesd_metrics.h"
+#include "aesd_ratelimit.h"
 #include "slist/queue.h"
 #include "../aesd-char-driver/aesd_ioctl.h"
 
 #include <string.h>
 #include <sys/socket.h>	/* basic socket definitions */
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <syslog.h>
 
@@ -20,13 +33,26 @@
 #include <arpa/inet.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <time.h>
+#include <sys/eventfd.h>
+#include <linux/filter.h>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct ThreadData {
     pthread_mutex_t*        write_lock;
     int                     fd;
+    char*                   buf;    /* cfg maxline bytes, client input */
+    size_t                  in_len; /* bytes kept in buf, a partial frame or magic */
+    char*                   xbuf;   /* cfg buffsize bytes, replay chunks */
+    bool                    answered;   /* at least one reply was sent, the client is not mid request */
+    bool                    negotiated; /* the first bytes told whether the client speaks frames */
+    bool                    binary;     /* framed protocol, see aesd_proto.h */
+    uint64_t                gen;        /* log_gen of the last write of this client */
+    struct aesd_trace       trace;
+    struct aesd_client_limit limit;
     volatile sig_atomic_t   is_completed;
     pthread_t               p_tid;
 } ;
@@ -38,405 +64,1665 @@ struct slist_data_s {
 
 typedef struct slist_data_s slist_data_t;
 
+SLIST_HEAD(slisthead, slist_data_s);
+
+/*
+ * An accept loop with its own listening socket and the connection threads it started.  Worker 0
+ * runs on the main thread, the others on their own threads.
+ */
+struct aesd_worker {
+    unsigned            index;
+    int                 listenfd;
+    pthread_t           tid;
+    struct slisthead    threads;
+};
+
+/*
+ * A copy of the log shared by every client whose own write it already contains, so a burst of
+ * replays reads the backend once.  Either pins mirror chunks or owns the bytes read from the backend.
+ */
+struct replay_snap {
+    atomic_uint             refs;
+    uint64_t                gen;        /* log_gen when the snapshot was started */
+    bool                    ok;         /* false when unreadable, clients stream on their own */
+    bool                    partial;    /* capped at REPLAY_SNAPSHOT_MAX, clients stream the rest */
+    bool                    from_mirror;
+    struct aesd_mirror_view view;
+    char*                   data;
+    size_t                  len;
+    uint64_t                base;       /* log offset of the first byte, where retention left the log */
+};
+
 struct t_eventData{
     int myData;
 };
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-static char const*          filename_ = NULL;
-static int                  log_fd = -1, connfd = -1;
-static int                  listenfd;
-static  socklen_t           clilen;
-static struct sockaddr_in   cliaddr, servaddr;
-static const int	        on = 1;
-volatile sig_atomic_t       sigint_triggered = 0;
-volatile sig_atomic_t       sigterm_triggered = 0;
-static pthread_mutex_t      write_lock;
-static pthread_mutex_t      meta_lock;
-timer_t                     timer_id = 0;
-static int                  file_size = 0;
-static unsigned             thread_clients = 0;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static struct aesd_config const* cfg_ = NULL;
+static char const*          filename_ = NULL;
+static bool                 backend_is_file = false;
+static struct aesd_mirror   mirror;
+static bool                 mirror_on = false;  /* cleared for good once the backend diverged */
+static uint64_t             mirror_seq_base = 0;/* device sequence number before the first mirrored record */
+static uint64_t             mirror_log_base = 0;/* data files: log offset of the first mirrored byte */
+static struct aesd_seglog   seglog;             /* file backends, appended to under write_lock */
+static struct aesd_index    rec_index;          /* file backends: record offsets, under write_lock */
+static bool                 index_on = false;
+static int                  log_fd = -1;        /* the char device */
+static struct aesd_worker*  workers = NULL;
+static unsigned             nworkers = 0;
+static struct sockaddr_in   servaddr;
+static const int	        on = 1;
+static volatile sig_atomic_t sigint_triggered = 0;
+static volatile sig_atomic_t sigterm_triggered = 0;
+static pthread_mutex_t      write_lock;
+static pthread_mutex_t      meta_lock;
+static int                  timer_fd = -1;
+static int                  drain_fd = -1;  /* eventfd, readable once the server is shutting down */
+static long                 drain_start_ms = 0;
+static int                  ctl_fd = -1;    /* control socket for a hot restart */
+static int                  stats_fd = -1;  /* --stats-socket listener */
+static struct aesd_ratelimit limiter;
+static bool                 handed_over = false;
+static uint64_t             log_gen = 0;    /* successful backend writes, under write_lock */
+static pthread_mutex_t      replay_lock;
+static pthread_cond_t       replay_cond;
+static struct replay_snap*  replay_last = NULL; /* newest snapshot, under replay_lock */
+static bool                 replay_loading = false; /* a client is taking the next snapshot */
+static unsigned             replay_snapshots = 0;
+static unsigned             replay_clients = 0;
+static unsigned             replay_busy = 0;    /* clients in a replay right now, under replay_lock */
+static atomic_uint          thread_clients = 0;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void log_remote_peer_name( int client_sock, bool is_open );
+void* connection_handler( void* arg );
+static int open_listener( bool reuseport );
+static bool steer_by_cpu( int listenfd, unsigned n );
+static void pin_to_cpu( pthread_t tid, unsigned index );
+static int spawn_thread( pthread_t* tid, void* ( *fn )( void* ), void* arg );
+static void* worker_loop( void* arg );
+static void add_thread( struct aesd_worker* w, struct ThreadData* td );
+static void do_maintenance( struct aesd_worker* w );
+static void join_threads( struct aesd_worker* w );
+static void close_connection( struct ThreadData* td );
+static void begin_drain( void );
+static void drain_connections( void );
+static bool take_listeners( void );
+static bool hand_over_listeners( void );
+static void process_message( struct ThreadData* td, char const* buf, int len );
+static bool negotiate( struct ThreadData* td );
+static bool process_frames( struct ThreadData* td );
+static bool serve_frame( struct ThreadData* td, struct aesd_frame const* f, char const* payload );
+static bool reply_chunk( struct ThreadData* td, struct aesd_frame const* req, char const* buf, size_t len );
+static bool reply_end( struct ThreadData* td, struct aesd_frame const* req, uint8_t status );
+static bool send_frame( struct ThreadData* td, struct aesd_frame const* req, uint8_t status, uint16_t flags,
+                        char const* payload, size_t len );
+static uint8_t seek_to_client( struct ThreadData* td, unsigned cmd, unsigned off, struct aesd_frame const* req );
+static uint8_t dump_file_to_client( struct ThreadData* td, uint64_t gen, uint64_t from, struct aesd_frame const* req );
+static uint64_t log_gen_now( void );
+static struct replay_snap* replay_get( uint64_t gen );
+static struct replay_snap* replay_take( void );
+static void replay_put( struct replay_snap* snap );
+static uint8_t stream_file_to_client( struct ThreadData* td, uint64_t from, struct aesd_frame const* req );
+static bool mirror_start( void );
+static bool mirror_snapshot( uint64_t from, struct aesd_mirror_view* v );
+static bool log_reader_open( int* rd_fd );
+static ssize_t log_pread( int rd_fd, char* buf, size_t len, uint64_t off );
+static void mirror_diverged( char const* why );
+static bool write_all( int fd, char const* buf, size_t len );
+static bool send_all( int fd, char const* buf, size_t len, int flags );
+static void make_daemon( void );
+static int format_stats( char* buf, size_t size );
+static uint64_t log_size( void );
+static uint64_t log_start( void );
+static void cmd_seekto( struct ThreadData* td, struct aesd_cmd const* cmd );
+static void cmd_stats( struct ThreadData* td, struct aesd_cmd const* cmd );
+static void cmd_size( struct ThreadData* td, struct aesd_cmd const* cmd );
+static void cmd_replay_from( struct ThreadData* td, struct aesd_cmd const* cmd );
+static void cmd_tail( struct ThreadData* td, struct aesd_cmd const* cmd );
+static void cmd_latency( struct ThreadData* td, struct aesd_cmd const* cmd );
+
+static void ( * const cmd_handlers[ AESD_CMD_COUNT ] )( struct ThreadData* td, struct aesd_cmd const* cmd ) = {
+    [ AESD_CMD_SEEKTO ] = cmd_seekto,
+    [ AESD_CMD_STATS ] = cmd_stats,
+    [ AESD_CMD_SIZE ] = cmd_size,
+    [ AESD_CMD_REPLAY_FROM ] = cmd_replay_from,
+    [ AESD_CMD_TAIL ] = cmd_tail,
+    [ AESD_CMD_LATENCY ] = cmd_latency
+};
+
+static void timer_handler();
+static void serve_stats( void );
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool aesd_thrd_initialize( struct aesd_config const* cfg ){
+    struct stat st;
+    AESD_LOG( LOG_DEBUG, "> aesd_thrd_initialize" );
+    int rc = pthread_mutex_init( &write_lock, NULL );
+
+    if( rc != 0 ){
+        AESD_LOG( LOG_ERR, "Failed to initialize write lock." );
+        return false;
+    }
+
+    rc = pthread_mutex_init( &meta_lock, NULL );
+
+    if( rc != 0 ){
+        AESD_LOG( LOG_ERR, "Failed to initialize meta lock." );
+        return false;
+    }
+
+    cfg_ = cfg;
+    filename_ = cfg->backend;
+
+    if( !aesd_ratelimit_init( &limiter, ( struct aesd_limit ){ cfg->client_rate, cfg->client_burst },
+                              ( struct aesd_limit ){ cfg->ip_rate, cfg->ip_burst } ) ){
+        AESD_LOG( LOG_ERR, "Out of memory for the rate limits\n" );
+        return false;
+    }
+
+    AESD_LOG( LOG_DEBUG, "> open %s\n", filename_ );
+    // anything but an existing device is a data file, kept in segments when configured
+    backend_is_file = cfg->segment_size > 0 || stat( filename_, &st ) != 0 || S_ISREG( st.st_mode );
+
+    if( backend_is_file ){
+        if( !aesd_seglog_open( &seglog, filename_, cfg->segment_size, cfg->retain_bytes, cfg->retain_secs ) ){
+            AESD_LOG( LOG_ERR, "Cannot open the log %s\n", filename_ );
+            return false;
+        }
+    }else if( ( log_fd = open( filename_, O_RDWR | O_APPEND ) ) < 0 ){
+        AESD_LOG( LOG_ERR, "Cannot open %s, err: %s\n", filename_, strerror( errno ) );
+        return false;
+    }
+
+    if( cfg->mirror_size > 0 && !mirror_start() ){
+        return false;
+    }
+
+    // the device locates records itself, a data file needs the index for seeks
+    if( backend_is_file ){
+        if( !aesd_index_open( &rec_index, cfg->index_file, &seglog ) ){
+            AESD_LOG( LOG_ERR, "Cannot set up the record index\n" );
+            return false;
+        }
+
+        index_on = true;
+    }
+
+    if( pthread_mutex_init( &replay_lock, NULL ) != 0 || pthread_cond_init( &replay_cond, NULL ) != 0 ){
+        AESD_LOG( LOG_ERR, "Failed to initialize replay lock." );
+        return false;
+    }
+
+    drain_fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+
+    if( drain_fd < 0 ){
+        AESD_LOG( LOG_ERR, "eventfd failed, err: %s\n", strerror( errno ) );
+        return false;
+    }
+
+    memset( &servaddr, 0, sizeof( servaddr ) );
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl( INADDR_ANY );
+    servaddr.sin_port = htons( cfg->port );
+
+    if( cfg->takeover ){
+        if( !take_listeners() ){
+            return false;
+        }
+    }else{
+        nworkers = cfg->workers;
+        workers = calloc( nworkers, sizeof( struct aesd_worker ) );
+
+        if( !workers ){
+            AESD_LOG( LOG_ERR, "Out of memory for workers\n" );
+            return false;
+        }
+
+        // more than one worker shares the port, the kernel spreads new connections over the listeners
+        for( unsigned i = 0; i < nworkers; i ++ ){
+            workers[ i ].listenfd = open_listener( nworkers > 1 );
+
+            if( workers[ i ].listenfd < 0 ){
+                return false;
+            }
+        }
+    }
+
+    // non blocking, after a handover another process may take the connection poll() reported
+    for( unsigned i = 0; i < nworkers; i ++ ){
+        workers[ i ].index = i;
+        SLIST_INIT( &workers[ i ].threads );
+        fcntl( workers[ i ].listenfd, F_SETFL, fcntl( workers[ i ].listenfd, F_GETFL ) | O_NONBLOCK );
+    }
+
+    if( cfg->daemon ){
+        make_daemon();
+    }
+
+    // after make_daemon(), the sync thread would not survive its fork
+    if( !aesd_durability_start( &cfg->durability, backend_is_file ? aesd_seglog_fd( &seglog ) : log_fd ) ){
+        return false;
+    }
+
+    // listen order defines the index of each socket in the SO_REUSEPORT group
+    for( unsigned i = 0; i < nworkers; i ++ ){
+        listen( workers[ i ].listenfd, cfg->backlog );
+    }
+
+    if( nworkers > 1 && cfg->worker_affinity && !steer_by_cpu( workers[ 0 ].listenfd, nworkers ) ){
+        AESD_LOG( LOG_WARNING, "Cannot steer connections by cpu, err: %s\n", strerror( errno ) );
+    }
+
+    if( cfg->timestamps && ( timer_fd = aesd_timestamp_timer_open( cfg->timer_interval ) ) < 0 ){
+        return false;
+    }
+
+    if( cfg->control_socket && ( ctl_fd = aesd_handover_listen( cfg->control_socket ) ) < 0 ){
+        return false;
+    }
+
+    if( cfg->stats_socket && ( stats_fd = aesd_metrics_listen( cfg->stats_socket ) ) < 0 ){
+        return false;
+    }
+
+    // the predecessor stops accepting once told that the listeners are served here
+    aesd_handover_ack();
+    return true;
+}
+
+void aesd_thrd_run(){
+    AESD_LOG( LOG_DEBUG, "> aesd_thrd_run" );
+    workers[ 0 ].tid = pthread_self();
+
+    if( cfg_->worker_affinity ){
+        pin_to_cpu( workers[ 0 ].tid, 0 );
+    }
+
+    for( unsigned i = 1; i < nworkers; i ++ ){
+        if( spawn_thread( &workers[ i ].tid, worker_loop, &workers[ i ] ) != 0 ){
+            AESD_LOG( LOG_ERR, "> Failed to create worker %u, its listener is closed", i );
+            close( workers[ i ].listenfd );
+            workers[ i ].listenfd = -1;
+            continue;
+        }
+
+        if( cfg_->worker_affinity ){
+            pin_to_cpu( workers[ i ].tid, i );
+        }
+    }
+
+    worker_loop( &workers[ 0 ] );
+
+    // the signal is only delivered to this thread, drain_fd wakes the other workers
+    begin_drain();
+
+    for( unsigned i = 1; i < nworkers; i ++ ){
+        if( workers[ i ].listenfd >= 0 ){
+            pthread_join( workers[ i ].tid, NULL );
+        }
+    }
+}
+
+void aesd_thrd_signal_triggered( int sig ){
+    if( sig == SIGINT ){
+        sigint_triggered = 1;
+    }
+
+    if( sig == SIGTERM ){
+        sigterm_triggered = 1;
+    }
+}
+
+void aesd_thrd_shutdown(){
+    for( unsigned i = 0; i < nworkers; i ++ ){
+        if( workers[ i ].listenfd >= 0 ){
+            close( workers[ i ].listenfd );
+        }
+    }
+
+    drain_connections();
+
+    if( ctl_fd >= 0 ){
+        close( ctl_fd );
+        ctl_fd = -1;
+
+        // after a handover the path belongs to the successor
+        if( !handed_over ){
+            unlink( cfg_->control_socket );
+        }
+    }
+
+    if( stats_fd >= 0 ){
+        close( stats_fd );
+        stats_fd = -1;
+
+        if( !handed_over ){
+            unlink( cfg_->stats_socket );
+        }
+    }
+
+    if( index_on ){
+        aesd_index_close( &rec_index );
+        index_on = false;
+    }
+
+    // never unlink the char device node, only the data file, nor the log a successor appends to
+    if( backend_is_file && !handed_over ){
+        aesd_seglog_remove( &seglog );
+
+        if( cfg_->index_file ){
+            unlink( cfg_->index_file );
+        }
+    }
+
+    pthread_mutex_destroy( &write_lock );
+    free( workers );
+    workers = NULL;
+    nworkers = 0;
+    aesd_ratelimit_free( &limiter );
+    aesd_durability_stop();
+
+    if( backend_is_file ){
+        aesd_seglog_close( &seglog );
+    }else{
+        close( log_fd );
+    }
+
+    if( timer_fd >= 0 ){
+        close( timer_fd );
+        timer_fd = -1;
+    }
+
+    close( drain_fd );
+    drain_fd = -1;
+
+    if( replay_last ){
+        replay_put( replay_last );
+        replay_last = NULL;
+    }
+
+    if( replay_snapshots > 0 ){
+        AESD_LOG( LOG_INFO, "Served %u replays from %u snapshots\n", replay_clients, replay_snapshots );
+    }
+
+    pthread_cond_destroy( &replay_cond );
+    pthread_mutex_destroy( &replay_lock );
+
+    if( mirror_on ){
+        aesd_mirror_destroy( &mirror );
+        mirror_on = false;
+    }
+
+    AESD_LOG( LOG_DEBUG, "aesd_thrd_shutdown completed." );
+}
+
+//----------------------------------------------------- private impl -----------------------------------------------------//
+//////////////////////////////////////////////////////////////////////////////////////////////
+static void log_remote_peer_name( int client_sock, bool is_open ){
+    char ipstr[INET6_ADDRSTRLEN];
+
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof( addr );
+    getpeername( client_sock, (struct sockaddr*)&addr, &len );
+    struct sockaddr_in *s = (struct sockaddr_in *)&addr;
+    inet_ntop(AF_INET, &s->sin_addr, ipstr, sizeof( ipstr ));
+
+    if( is_open ){
+        AESD_LOG( LOG_DEBUG, "> Accepted connection from %s\n", ipstr );
+    }else{
+        AESD_LOG( LOG_DEBUG, "> Closed connection from %s\n", ipstr );
+    }
+}
+
+void* connection_handler( void* arg ){
+    struct ThreadData* td = ( struct ThreadData* )arg;
+    int n;
+
+    td->buf = malloc( cfg_->maxline );
+    td->xbuf = malloc( cfg_->buffsize );
+
+    if( !td->buf || !td->xbuf ){
+        AESD_LOG( LOG_ERR, "> Out of memory for connection buffers" );
+        close_connection( td );
+        return NULL;
+    }
+
+    struct pollfd pfds[ 2 ] = {
+        { .fd = td->fd, .events = POLLIN },
+        { .fd = drain_fd, .events = POLLIN }
+    };
+
+    bool draining = false;
+
+    for( ;; ){
+        // a draining client gets its request in flight finished before the deadline, whatever it cost
+        uint64_t delay = draining ? 0 : aesd_ratelimit_delay( &limiter, &td->limit );
+
+        if( delay > 0 ){
+            // over its rate limit, the client is not read from until its buckets refilled
+            aesd_count( AESD_CTR_THROTTLED, 1 );
+            pfds[ 0 ].revents = 0;
+
+            if( poll( pfds + 1, 1, delay / 1000000 + 1 ) <= 0 ){
+                continue;
+            }
+        }else if( poll( pfds, draining ? 1 : 2, INFTIM ) < 0 ){
+            continue;
+        }
+
+        // shutting down, leave once the request in flight has been answered
+        if( !pfds[ 0 ].revents ){
+            if( td->answered ){
+                break;
+            }
+
+            // a client that has not sent a full request yet is served until the drain deadline
+            draining = true;
+            continue;
+        }
+
+        n = read( td->fd, td->buf + td->in_len, cfg_->maxline - 1 - td->in_len );
+        aesd_count( AESD_CTR_SYSCALLS, 1 );
+
+        if ( n < 0 ) {
+            /* connection reset by client */
+            break;
+        }else if( n == 0 ){// client disconnected
+            break;
+        }else{
+            aesd_trace_input( &td->trace );
+            aesd_ratelimit_charge( &limiter, &td->limit, n );
+            td->in_len += n;
+
+            if( !td->negotiated && !negotiate( td ) ){
+                continue;
+            }
+
+            if( td->binary ){
+                if( !process_frames( td ) ){
+                    break;
+                }
+            }else{
+                td->buf[ td->in_len ] = '\0';
+                process_message( td, td->buf, td->in_len );
+                td->in_len = 0;
+            }
+
+            if( draining && td->answered ){
+                break;
+            }
+        }
+    }
+
+    close_connection( td );
+    return NULL;
+}
+
+// wakes the workers and the connection threads, only the first call has an effect
+static void begin_drain( void ){
+    if( drain_start_ms != 0 ){
+        return;
+    }
+
+    drain_start_ms = aesd_timestamp_now_ms();
+
+    if( eventfd_write( drain_fd, 1 ) < 0 ){
+        AESD_LOG( LOG_ERR, "Failed to signal drain, err: %s\n", strerror( errno ) );
+    }
+}
+
+// one worker per listener received from the predecessor, whatever -w says
+static bool take_listeners( void ){
+    int fds[ AESD_HANDOVER_MAX_FDS ];
+    int n = aesd_handover_takeover( cfg_->control_socket, fds, AESD_HANDOVER_MAX_FDS );
+
+    if( n <= 0 ){
+        return false;
+    }
+
+    if( ( unsigned )n != cfg_->workers ){
+        AESD_LOG( LOG_NOTICE, "Took over %d listeners, running %d workers\n", n, n );
+    }
+
+    nworkers = n;
+    workers = calloc( nworkers, sizeof( struct aesd_worker ) );
+
+    if( !workers ){
+        AESD_LOG( LOG_ERR, "Out of memory for workers\n" );
+        return false;
+    }
+
+    for( unsigned i = 0; i < nworkers; i ++ ){
+        workers[ i ].listenfd = fds[ i ];
+    }
+
+    return true;
+}
+
+static bool hand_over_listeners( void ){
+    int fds[ AESD_HANDOVER_MAX_FDS ];
+    unsigned n = 0;
+
+    for( unsigned i = 0; i < nworkers && n < AESD_HANDOVER_MAX_FDS; i ++ ){
+        if( workers[ i ].listenfd >= 0 ){
+            fds[ n ++ ] = workers[ i ].listenfd;
+        }
+    }
+
+    if( !aesd_handover_serve( ctl_fd, fds, n ) ){
+        return false;
+    }
+
+    AESD_LOG( LOG_INFO, "Listeners handed over to a successor, draining\n" );
+    handed_over = true;
+
+    // the successor rotates the segments from now on
+    if( backend_is_file ){
+        pthread_mutex_lock( &write_lock );
+        aesd_seglog_follow( &seglog );
+        pthread_mutex_unlock( &write_lock );
+    }
+
+    return true;
+}
+
+// meta_lock keeps drain_connections() from shutting down a descriptor number that was reused
+static void close_connection( struct ThreadData* td ){
+    log_remote_peer_name( td->fd, false );
+    aesd_ratelimit_detach( &limiter, &td->limit );
+    pthread_mutex_lock( &meta_lock );
+    close( td->fd );
+    td->fd = -1;
+    pthread_mutex_unlock( &meta_lock );
+    // the thread is joined only after the next accept, the gauge drops now
+    atomic_fetch_sub( &thread_clients, 1 );
+    td->is_completed = 1;
+}
+
+/*
+ * Tells every connection thread to finish through drain_fd and waits up to the drain timeout.
+ * Threads still busy after that, e.g. writing to a client that stopped reading, get their
+ * socket shut down so the blocked call fails, then all of them are joined.
+ */
+static void drain_connections( void ){
+    long start, now;
+    unsigned open = 0, total = 0;
+    slist_data_t *item = NULL;
+
+    begin_drain();
+    start = now = drain_start_ms;
+
+    for( unsigned i = 0; i < nworkers; i ++ ){
+        SLIST_FOREACH( item, &workers[ i ].threads, entries ){
+            total += !item->td->is_completed;
+        }
+    }
+
+    do{
+        open = 0;
+
+        for( unsigned i = 0; i < nworkers; i ++ ){
+            SLIST_FOREACH( item, &workers[ i ].threads, entries ){
+                open += !item->td->is_completed;
+            }
+        }
+
+        if( open == 0 || now - start >= ( long )cfg_->drain_timeout_ms ){
+            break;
+        }
+
+        usleep( 1000 );
+        now = aesd_timestamp_now_ms();
+    }while( true );
+
+    for( unsigned i = 0; open > 0 && i < nworkers; i ++ ){
+        SLIST_FOREACH( item, &workers[ i ].threads, entries ){
+            pthread_mutex_lock( &meta_lock );
+
+            if( item->td->fd >= 0 ){
+                shutdown( item->td->fd, SHUT_RDWR );
+            }
+
+            pthread_mutex_unlock( &meta_lock );
+        }
+    }
+
+    for( unsigned i = 0; i < nworkers; i ++ ){
+        join_threads( &workers[ i ] );
+    }
+
+    AESD_LOG( LOG_INFO, "Drained %u connections in %ld ms, %u cut off at the deadline",
+            total, aesd_timestamp_now_ms() - start, open );
+}
+
+static int open_listener( bool reuseport ){
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+
+    if( fd < 0 ){
+        AESD_LOG( LOG_ERR, "Failed to create socket\n" );
+        return -1;
+    }
+
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+
+    if( reuseport && setsockopt( fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on) ) < 0 ){
+        AESD_LOG( LOG_ERR, "Failed to set SO_REUSEPORT, err: %s\n", strerror( errno ) );
+        close( fd );
+        return -1;
+    }
+
+    if( bind( fd, ( struct sockaddr* )&servaddr, sizeof( servaddr ) ) < 0 ){
+        AESD_LOG( LOG_ERR, "Failed to bind to %d port\n", cfg_->port );
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Attaches a classic BPF program to the SO_REUSEPORT group picking listener (cpu % n), so a
+ * connection is accepted by the worker pinned to the cpu that handled its SYN.
+ */
+static bool steer_by_cpu( int listenfd, unsigned n ){
+    struct sock_filter code[] = {
+        { BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, n },
+        { BPF_RET | BPF_A,           0, 0, 0 },
+    };
+    struct sock_fprog prog = { .len = sizeof( code ) / sizeof( code[ 0 ] ), .filter = code };
+
+    return setsockopt( listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof( prog ) ) == 0;
+}
+
+static void pin_to_cpu( pthread_t tid, unsigned index ){
+    long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+    cpu_set_t set;
+
+    CPU_ZERO( &set );
+    CPU_SET( index % ( ncpu > 0 ? ncpu : 1 ), &set );
+
+    if( pthread_setaffinity_np( tid, sizeof( set ), &set ) != 0 ){
+        AESD_LOG( LOG_WARNING, "> Failed to pin worker %u", index );
+    }
+}
+
+/**
+ * pthread_create with SIGINT, SIGTERM and SIGUSR1 blocked in the new thread, so they always interrupt the
+ * poll() of the main thread.
+ */
+static int spawn_thread( pthread_t* tid, void* ( *fn )( void* ), void* arg ){
+    sigset_t block, old;
+    int rc;
+
+    sigemptyset( &block );
+    sigaddset( &block, SIGINT );
+    sigaddset( &block, SIGTERM );
+    sigaddset( &block, SIGUSR1 );
+    pthread_sigmask( SIG_BLOCK, &block, &old );
+    rc = pthread_create( tid, NULL, fn, arg );
+    pthread_sigmask( SIG_SETMASK, &old, NULL );
+    return rc;
+}
+
+static void* worker_loop( void* arg ){
+    struct aesd_worker* w = ( struct aesd_worker* )arg;
+    struct pollfd pfds[ 5 ] = {
+        { .fd = w->listenfd, .events = POLLIN },
+        { .fd = drain_fd, .events = POLLIN },
+        { .fd = timer_fd, .events = POLLIN },
+        { .fd = ctl_fd, .events = POLLIN },
+        { .fd = stats_fd, .events = POLLIN }
+    };
+
+    // only worker 0 watches the timer, the control and the stats socket, so there is a single timestamp writer
+    nfds_t nfds = w->index == 0 ? 5 : 2;
+
+    for( ;; ){
+        int nready = poll( pfds, nfds, INFTIM );
+        
+        aesd_latency_poll();
+
+        if ( sigint_triggered ) {
+            AESD_LOG( LOG_DEBUG, "sigint triggered, exiting...\n" );
+            break;
+        }
+
+        if ( sigterm_triggered ) {
+            AESD_LOG( LOG_DEBUG, "sigterm triggered\n" );
+            break;
+        }
+
+        if( nready <= 0 ){
+            continue;
+        }
+
+        if( pfds[ 1 ].revents ){
+            break;
+        }
+
+        if( nfds > 2 && ( pfds[ 2 ].revents & POLLIN ) && aesd_timestamp_timer_fired( timer_fd ) &&
+            atomic_load( &thread_clients ) > 0 ){
+            timer_handler();
+        }
+
+        if( nfds > 3 && ( pfds[ 3 ].revents & POLLIN ) && hand_over_listeners() ){
+            break;
+        }
+
+        if( nfds > 4 && ( pfds[ 4 ].revents & POLLIN ) ){
+            serve_stats();
+        }
+
+        if( pfds[ 0 ].revents ){
+            struct sockaddr_in cliaddr;
+            socklen_t clilen = sizeof( cliaddr );
+            int connfd = accept4( w->listenfd, (SA *) &cliaddr, &clilen, SOCK_CLOEXEC );
+
+            if( connfd < 0 ){
+                continue;
+            }
+
+            aesd_count( AESD_CTR_ACCEPTS, 1 );
+            log_remote_peer_name( connfd, true );
+            
+            struct ThreadData* thrd = ( struct ThreadData* )malloc( sizeof( struct ThreadData) );
+            thrd->write_lock     = &write_lock;
+            thrd->fd            = connfd;
+            thrd->buf           = NULL;
+            thrd->xbuf          = NULL;
+            thrd->in_len        = 0;
+            thrd->answered      = false;
+            thrd->negotiated    = false;
+            thrd->binary        = false;
+            thrd->gen           = 0;
+            thrd->is_completed  = 0;
+            aesd_trace_start( &thrd->trace );
+            aesd_ratelimit_attach( &limiter, &thrd->limit, cliaddr.sin_addr );
+            // counted before the thread runs, close_connection() takes it back
+            atomic_fetch_add( &thread_clients, 1 );
+            
+            int rc = spawn_thread( &thrd->p_tid, connection_handler, thrd ); 
+
+            if( rc != 0 ){
+                AESD_LOG( LOG_ERR, "> Failed to create connection handler thread" );
+                atomic_fetch_sub( &thread_clients, 1 );
+                aesd_ratelimit_detach( &limiter, &thrd->limit );
+                close( connfd );
+                free( thrd );
+            }else{
+                add_thread( w, thrd );
+            }
+
+            do_maintenance( w );
+        }
+    }
+
+    return NULL;
+}
+
+static void add_thread( struct aesd_worker* w, struct ThreadData* td ){
+    AESD_LOG( LOG_DEBUG, "> adding new thread %lu", td->p_tid );
+    slist_data_t* datap = malloc(sizeof(slist_data_t));
+    datap->td = td;
+    SLIST_INSERT_HEAD( &w->threads, datap, entries );
+}
+
+// https://man.archlinux.org/man/core/man-pages/SLIST_REMOVE.3.en
+static void do_maintenance( struct aesd_worker* w ){
+    AESD_LOG( LOG_DEBUG, "> do maintenance" );
+    slist_data_t *item = NULL;
+    slist_data_t *tmp_item = NULL;
+
+    SLIST_FOREACH_SAFE( item, &w->threads, entries, tmp_item ) {
+        struct ThreadData* td = item->td;
+
+        if( td->is_completed ){
+            pthread_t tid = td->p_tid;
+            pthread_join( tid, NULL );
+            SLIST_REMOVE( &w->threads, item, slist_data_s, entries );
+            free( td->buf );
+            free( td->xbuf );
+            free( td );
+            free( item );
+            AESD_LOG( LOG_DEBUG, "> Thrd %lu completed.", tid );
+        }
+    }
+}
+
+static void join_threads( struct aesd_worker* w ){
+    slist_data_t *datap = NULL;
+
+    while ( !SLIST_EMPTY( &w->threads ) ) {
+        datap = SLIST_FIRST( &w->threads );
+        struct ThreadData* td = datap->td;
+        pthread_t tid = td->p_tid;
+        pthread_join( tid, NULL );
+        SLIST_REMOVE_HEAD( &w->threads, entries );
+        free( td->buf );
+        free( td->xbuf );
+        free( td );
+        free( datap );
+        AESD_LOG( LOG_DEBUG, "> Thrd %lu completed.", tid );
+    }
+}
+
+/**
+ * Appends @param buf to the backend.  @param gen, when not NULL, receives the log_gen of this write,
+ * any replay snapshot started later contains it.
+ */
+static int write_safe( char const* buf, int len, uint64_t* gen ){
+    int rc = pthread_mutex_trylock( &write_lock );
+
+    // only a contended lock pays for the clock
+    if( rc == EBUSY ){
+        uint64_t wait_start = aesd_latency_now();
+
+        rc = pthread_mutex_lock( &write_lock );
+        aesd_count( AESD_CTR_LOCK_WAIT_NS, aesd_latency_now() - wait_start );
+    }
+
+    if( 0 != rc ){
+        AESD_LOG( LOG_ERR, "> Failed to lock write lock" );
+        return -1;
+    }
+
+    uint64_t end = 0;
+    int nbytes = backend_is_file ? aesd_seglog_append( &seglog, buf, len, &end ) : write( log_fd, buf, len );
+
+    aesd_count( AESD_CTR_SYSCALLS, 1 );
+
+    if( nbytes < 0 ){
+        aesd_count( AESD_CTR_WRITE_ERRORS, 1 );
+    }
+
+    if( mirror_on && nbytes > 0 && !aesd_mirror_append( &mirror, buf, nbytes ) ){
+        mirror_diverged( "out of memory" );
+    }
+
+    if( nbytes > 0 ){
+        log_gen ++;
+    }
+
+    if( index_on && nbytes > 0 && !aesd_index_append( &rec_index, end - nbytes, buf, nbytes ) ){
+        AESD_LOG( LOG_WARNING, "Record index disabled, seeks on the data file fail from now on\n" );
+        aesd_index_close( &rec_index );
+        index_on = false;
+    }
+
+    if( gen ){
+        *gen = log_gen;
+    }
+
+    pthread_mutex_unlock( &write_lock );
+
+    if( nbytes > 0 ){
+        aesd_durability_commit();
+        aesd_count_commit( buf, nbytes );
+    }
+
+    return nbytes;
+}
+
+static void process_message( struct ThreadData* td, char const* buf, int len ){   
+    do{
+        if( len <= 0 ){
+            AESD_LOG( LOG_ERR, "> Invalid len %d", len );
+            break;
+        }
+
+        struct aesd_cmd cmd;
+
+        if( aesd_cmd_parse( buf, len, &cmd ) != AESD_CMD_NONE ){
+            aesd_trace_ready( &td->trace );
+            cmd_handlers[ cmd.id ]( td, &cmd );
+            aesd_trace_done( &td->trace );
+            td->answered = true;
+        }else{
+            AESD_LOG( LOG_DEBUG, "> process_message %d bytes\n", len );
+            int nbytes;
+            char const* nl = strchr( buf, '\n' );
+
+            if( nl ){
+                aesd_trace_ready( &td->trace );
+            }
+
+            nbytes = write_safe( buf, len, &td->gen );
+
+            if( nbytes < 0 ){
+                AESD_LOG( LOG_ERR, "Failed to write log data, err: %s\n", strerror( errno ) );
+                break;
+            }
+
+            if( nl ){
+                aesd_trace_commit( &td->trace );
+                dump_file_to_client( td, td->gen, 0, NULL );
+                aesd_trace_done( &td->trace );
+                td->answered = true;
+            }   
+        }
+    }while( 0 );
+}
+
+/**
+ * Looks at the first bytes of a connection, a client starting with the magic speaks frames.
+ * @return false while the bytes so far could still become the magic.
+ */
+static bool negotiate( struct ThreadData* td ){
+    if( td->in_len < AESD_PROTO_MAGIC_LEN && aesd_proto_is_magic( td->buf, td->in_len ) ){
+        return false;
+    }
+
+    td->negotiated = true;
+
+    if( aesd_proto_is_magic( td->buf, td->in_len ) ){
+        td->binary = true;
+        td->in_len -= AESD_PROTO_MAGIC_LEN;
+        memmove( td->buf, td->buf + AESD_PROTO_MAGIC_LEN, td->in_len );
+        // replies are assembled with MSG_MORE, pipelined clients should not wait for delayed acks
+        setsockopt( td->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+        write_all( td->fd, AESD_PROTO_MAGIC, AESD_PROTO_MAGIC_LEN );
+    }
+
+    return true;
+}
+
+/**
+ * Serves every complete frame in td->buf in order and keeps a partial one for the next read.
+ * @return false when the connection has to be closed.
+ */
+static bool process_frames( struct ThreadData* td ){
+    struct aesd_frame f;
+    char const* payload;
+    size_t used = 0, n;
+
+    while( ( n = aesd_frame_next( td->buf + used, td->in_len - used, &f, &payload ) ) > 0 ){
+        if( used == 0 ){
+            aesd_trace_ready( &td->trace );
+        }
+
+        if( !serve_frame( td, &f, payload ) ){
+            return false;
+        }
+
+        used += n;
+        td->answered = true;
+    }
+
+    if( used > 0 ){
+        aesd_trace_done( &td->trace );
+    }
+
+    // the header is in, the payload would never fit into buf
+    if( td->in_len - used >= AESD_FRAME_HDR_LEN && f.len > cfg_->maxline - 1 - AESD_FRAME_HDR_LEN ){
+        AESD_LOG( LOG_ERR, "> Frame of %u bytes above maxline, closing", f.len );
+        reply_end( td, &f, AESD_STATUS_TOO_LARGE );
+        return false;
+    }
+
+    td->in_len -= used;
+    memmove( td->buf, td->buf + used, td->in_len );
+    return true;
+}
+
+/**
+ * @return false when the reply could not be sent.
+ */
+static bool serve_frame( struct ThreadData* td, struct aesd_frame const* f, char const* payload ){
+    AESD_LOG( LOG_DEBUG, "> frame op %u, seq %llu, %u bytes\n", f->op, ( unsigned long long )f->seq, f->len );
+
+    switch( f->op ){
+    case AESD_OP_APPEND:
+        if( f->len > 0 && write_safe( payload, f->len, &td->gen ) < 0 ){
+            AESD_LOG( LOG_ERR, "Failed to write log data, err: %s\n", strerror( errno ) );
+            return reply_end( td, f, AESD_STATUS_FAILED );
+        }
+
+        aesd_trace_commit( &td->trace );
+        return reply_end( td, f, AESD_STATUS_OK );
+    case AESD_OP_REPLAY_FROM:
+        if( f->len != 8 ){
+            return reply_end( td, f, AESD_STATUS_BAD_REQUEST );
+        }
+
+        return reply_end( td, f, dump_file_to_client( td, log_gen_now(), aesd_proto_get_u64( ( uint8_t const* )payload ), f ) );
+    case AESD_OP_SEEK:
+        if( f->len != 8 ){
+            return reply_end( td, f, AESD_STATUS_BAD_REQUEST );
+        }
+
+        return reply_end( td, f, seek_to_client( td, aesd_proto_get_u32( ( uint8_t const* )payload ),
+                                                 aesd_proto_get_u32( ( uint8_t const* )payload + 4 ), f ) );
+    case AESD_OP_STATS:
+        return send_frame( td, f, AESD_STATUS_OK, 0, td->xbuf, format_stats( td->xbuf, cfg_->buffsize ) );
+    default:
+        return reply_end( td, f, AESD_STATUS_BAD_REQUEST );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// text protocol commands, see aesd_cmd.h
+
+static void cmd_seekto( struct ThreadData* td, struct aesd_cmd const* cmd ){
+    AESD_LOG( LOG_DEBUG, "seek_cmd: %llu, seek_off: %llu", ( unsigned long long )cmd->arg[ 0 ], ( unsigned long long )cmd->arg[ 1 ] );
+
+    if( cmd->arg[ 0 ] <= UINT32_MAX && cmd->arg[ 1 ] <= UINT32_MAX ){
+        seek_to_client( td, cmd->arg[ 0 ], cmd->arg[ 1 ], NULL );
+    }
+}
+
+static void cmd_stats( struct ThreadData* td, struct aesd_cmd const* cmd ){
+    write_all( td->fd, td->xbuf, format_stats( td->xbuf, cfg_->buffsize ) );
+}
 
-#define POLL_SZ 2
-static struct pollfd clientfds[ POLL_SZ ];
+static void cmd_size( struct ThreadData* td, struct aesd_cmd const* cmd ){
+    int len = snprintf( td->xbuf, cfg_->buffsize, "%llu\n", ( unsigned long long )log_size() );
 
-SLIST_HEAD(slisthead, slist_data_s) thrd_head;
+    write_all( td->fd, td->xbuf, len );
+}
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static void cmd_replay_from( struct ThreadData* td, struct aesd_cmd const* cmd ){
+    dump_file_to_client( td, log_gen_now(), cmd->arg[ 0 ], NULL );
+}
 
-static void log_remote_peer_name( int client_sock, bool is_open );
-void* connection_handler( void* arg );
-static void add_thread( struct ThreadData* td );
-static void do_maintenance();
-static void process_message( int clientfd, char const* buf, int len );
-static void dump_file_to_client( int fd );
-static void make_daemon( void );
-static bool parse_aesdchar_ioseek( char const* buffer, unsigned int *write_cmd, unsigned int *write_cmd_offset );
+static void cmd_tail( struct ThreadData* td, struct aesd_cmd const* cmd ){
+    uint64_t from;
+    bool ok;
 
-#ifndef USE_AESD_CHAR_DEVICE
-static void timer_handler();
-#endif
-// static bool start_timer( void );
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    pthread_mutex_lock( &write_lock );
 
-bool aesd_thrd_initialize( char const* filename, bool is_daemon ){
-    syslog( LOG_DEBUG, "> aesd_thrd_initialize" );
-    int rc = pthread_mutex_init( &write_lock, NULL );
+    if( index_on ){
+        from = aesd_index_tail( &rec_index, cmd->arg[ 0 ] );
+        ok = true;
+    }else{
+        // a data file is only found through its index, the device is read backwards
+        ok = !backend_is_file &&
+             aesd_cmd_tail_offset( log_fd, log_size(), cmd->arg[ 0 ], td->xbuf, cfg_->buffsize, &from );
+    }
 
-    if( rc != 0 ){
-        syslog( LOG_ERR, "Failed to initialize write lock." );
-        return false;
+    pthread_mutex_unlock( &write_lock );
+
+    if( !ok ){
+        AESD_LOG( LOG_ERR, "read of log failed, err: %s\n", strerror( errno ) );
+        return;
     }
 
-    rc = pthread_mutex_init( &meta_lock, NULL );
+    dump_file_to_client( td, log_gen_now(), from, NULL );
+}
 
-    if( rc != 0 ){
-        syslog( LOG_ERR, "Failed to initialize meta lock." );
-        return false;
+static void cmd_latency( struct ThreadData* td, struct aesd_cmd const* cmd ){
+    int len = aesd_latency_format( td->xbuf, cfg_->buffsize );
+
+    write_all( td->fd, td->xbuf, ( size_t )len < cfg_->buffsize ? ( size_t )len : cfg_->buffsize - 1 );
+}
+
+static void serve_stats( void ){
+    struct aesd_gauges g = {
+        .engine = "threads",
+        .backend = backend_is_file ? "file" : "device",
+        .connections = atomic_load( &thread_clients ),
+        .log_start = log_start(),
+        .log_end = log_size()
+    };
+
+    aesd_metrics_serve( stats_fd, &g );
+}
+
+static int format_stats( char* buf, size_t size ){
+    uint64_t writes;
+    unsigned replays, snapshots;
+
+    pthread_mutex_lock( &write_lock );
+    writes = log_gen;
+    pthread_mutex_unlock( &write_lock );
+    pthread_mutex_lock( &replay_lock );
+    replays = replay_clients;
+    snapshots = replay_snapshots;
+    pthread_mutex_unlock( &replay_lock );
+    return snprintf( buf, size, "connections %u\nwrites %llu\nreplays %u\nsnapshots %u\nbytes %llu\n",
+                     atomic_load( &thread_clients ), ( unsigned long long )writes, replays, snapshots,
+                     ( unsigned long long )log_size() );
+}
+
+// where a replay ends: the end of the data file log, or what the device holds right now
+static uint64_t log_size( void ){
+    struct aesd_info info;
+
+    if( backend_is_file ){
+        return aesd_seglog_end( &seglog );
     }
 
-    SLIST_INIT( &thrd_head );
+    return ioctl( log_fd, AESDCHAR_IOCGINFO, &info ) == 0 ? info.size : 0;
+}
+
+// where a replay starts, retention may have deleted the beginning of a data file log
+static uint64_t log_start( void ){
+    return backend_is_file ? aesd_seglog_start( &seglog ) : 0;
+}
+
+/**
+ * Sends part of a reply: raw bytes to a text client, a frame flagged AESD_FLAG_MORE to a framed one.
+ * @return false when the connection failed.
+ */
+static bool reply_chunk( struct ThreadData* td, struct aesd_frame const* req, char const* buf, size_t len ){
+    aesd_count( AESD_CTR_REPLAY_BYTES, len );
+    aesd_ratelimit_charge( &limiter, &td->limit, len );
+    return req ? send_frame( td, req, AESD_STATUS_OK, AESD_FLAG_MORE, buf, len ) : write_all( td->fd, buf, len );
+}
 
-    filename_ = filename;
-    syslog( LOG_DEBUG, "> open %s\n", filename_ );
-    // log_fd = open( filename, O_RDWR, S_IRUSR | S_IWUSR );
+/**
+ * Completes a reply, a framed client gets the last frame carrying @param status.
+ */
+static bool reply_end( struct ThreadData* td, struct aesd_frame const* req, uint8_t status ){
+    return req ? send_frame( td, req, status, 0, NULL, 0 ) : true;
+}
 
-    // if( log_fd < 0 ){
-    //     syslog( LOG_ERR, "Cannot create %s, err: %s\n", filename, strerror( errno ) );
-    //     return false;
-    // }
+/**
+ * Sends one reply frame to request @param req.  Frames with AESD_FLAG_MORE are held back with
+ * MSG_MORE, so a reply leaves in full segments and is pushed out by its last frame.
+ */
+static bool send_frame( struct ThreadData* td, struct aesd_frame const* req, uint8_t status, uint16_t flags,
+                        char const* payload, size_t len ){
+    struct aesd_frame f = { req->op | AESD_OP_REPLY, status, flags, len, req->seq };
+    uint8_t hdr[ AESD_FRAME_HDR_LEN ];
+    int more = flags & AESD_FLAG_MORE ? MSG_MORE : 0;
+
+    aesd_frame_encode( &f, hdr );
+    return send_all( td->fd, ( char const* )hdr, sizeof( hdr ), len > 0 ? MSG_MORE : more ) &&
+           send_all( td->fd, payload, len, more );
+}
 
-    listenfd = socket( AF_INET, SOCK_STREAM, 0 );
+/**
+ * Replies with the log from write command @param cmd, offset @param off on, located by the device
+ * or, for a data file, by the record index.
+ * @return the status for a framed reply.
+ */
+static uint8_t seek_to_client( struct ThreadData* td, unsigned cmd, unsigned off, struct aesd_frame const* req ){
+    struct aesd_seekto seek_to_cmd = {
+        .write_cmd = cmd,
+        .write_cmd_offset = off
+    };
+    uint8_t status = AESD_STATUS_OK;
+    uint64_t pos;
+    bool found;
+    int rn;
+
+    // a data file is seeked through the record index, then replayed like any other offset
+    if( backend_is_file ){
+        pthread_mutex_lock( &write_lock );
+        found = index_on && aesd_index_seek( &rec_index, cmd, off, &pos );
+        pthread_mutex_unlock( &write_lock );
 
-    if( listenfd < 0 ){
-        syslog( LOG_ERR, "Failed to create socket\n" );
-        return false;
+        if( !found ){
+            return index_on ? AESD_STATUS_BAD_REQUEST : AESD_STATUS_UNSUPPORTED;
+        }
+
+        return dump_file_to_client( td, log_gen_now(), pos, req );
     }
 
-    setsockopt( listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
-    memset( &servaddr, 0, sizeof( servaddr ) );
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = htonl( INADDR_ANY );
-    servaddr.sin_port = htons( SERV_PORT );
-    rc = bind( listenfd, ( struct sockaddr* )&servaddr, sizeof( servaddr ) );
+    int seek_fd = open( filename_, O_RDWR );
+
+    if( seek_fd < 0 ){
+        AESD_LOG( LOG_ERR, "Cannot open ioctl %s, err: %s\n", filename_, strerror( errno ) );
+        return AESD_STATUS_FAILED;
+    }
+
+    if( ioctl( seek_fd, AESDCHAR_IOCSEEKTO, &seek_to_cmd ) == -1 ){
+        AESD_LOG( LOG_ERR, "> Failed to send AESDCHAR_IOCSEEKTO command - %s", strerror( errno ) );
+        status = errno == EINVAL ? AESD_STATUS_BAD_REQUEST : AESD_STATUS_FAILED;
+    }else{
+        do{
+            rn = read( seek_fd, td->xbuf, cfg_->buffsize );
+            aesd_count( AESD_CTR_SYSCALLS, 1 );
+            AESD_LOG( LOG_DEBUG, ">> seek dump_file_to_client: read chunk = %d\n", rn );
+
+            if( rn > 0 && !reply_chunk( td, req, td->xbuf, rn ) ){
+                break;
+            }
+        }while( rn > 0 );
+
+        status = rn < 0 ? AESD_STATUS_FAILED : AESD_STATUS_OK;
+        aesd_count( AESD_CTR_READ_ERRORS, rn < 0 );
+    }
+
+    close( seek_fd );
+    return status;
+}
+
+/*
+ * Copies the current backend contents into a new mirror.  Only the char device keeps a sequence
+ * number, so for it the mirror also learns which record numbers it holds.
+ */
+static bool mirror_start( void ){
+    struct aesd_info info;
+    int rd_fd = -1;
+    char* chunk = malloc( cfg_->buffsize );
+    ssize_t rn = 0;
+
+    if( !log_reader_open( &rd_fd ) || !chunk || !aesd_mirror_init( &mirror, cfg_->mirror_size ) ){
+        AESD_LOG( LOG_ERR, "Cannot set up the log mirror\n" );
+        free( chunk );
+
+        if( rd_fd >= 0 ){
+            close( rd_fd );
+        }
 
-    if( rc < 0 ){
-        syslog( LOG_ERR, "Failed to bind to 9000 port\n" );
         return false;
     }
 
-    if( is_daemon ){
-        make_daemon();
+    mirror_log_base = log_start();
+
+    while( ( rn = log_pread( rd_fd, chunk, cfg_->buffsize, mirror_log_base + mirror.end ) ) > 0 &&
+           aesd_mirror_append( &mirror, chunk, rn ) ){
     }
 
-    listen( listenfd, LISTENQ );
-    
-    // if( !start_timer() ){
-    //     syslog( LOG_ERR, "Failed to start timer" );
-    //     return false;
-    // }
-    clientfds[0].fd = listenfd;
-    clientfds[0].events = POLLIN;
+    free( chunk );
+
+    if( rd_fd >= 0 ){
+        close( rd_fd );
+    }
+    mirror_on = rn == 0;
+
+    if( mirror_on && !backend_is_file ){
+        if( ioctl( log_fd, AESDCHAR_IOCGINFO, &info ) == 0 ){
+            mirror_seq_base = info.newest_seq - mirror.records;
+        }else{
+            mirror_diverged( "the device cannot report its contents" );
+        }
+    }
+
+    if( !mirror_on && mirror.chunks ){
+        mirror_diverged( "the backend could not be read" );
+    }
 
     return true;
 }
 
-void aesd_thrd_run(){
-    syslog( LOG_DEBUG, "> aesd_thrd_run" );
+/**
+ * Pins the bytes a replay has to return right now, a data file log from offset @param from on,
+ * called with write_lock held.  The backend metadata tells whether anyone else wrote to it, the
+ * contents are never read.
+ * @return false when the backend has to be read instead.
+ */
+static bool mirror_snapshot( uint64_t from, struct aesd_mirror_view* v ){
+    struct aesd_info info;
 
-    for( ;; ){
-        int nready = poll( clientfds, 1, LOG_TIMER_INT * 1000 );
-        
+    if( !mirror_on ){
+        return false;
+    }
 
-        if ( sigint_triggered ) {
-            syslog( LOG_DEBUG, "sigint triggered, exiting...\n" );
-            break;
+    if( backend_is_file ){
+        if( aesd_seglog_end( &seglog ) != mirror_log_base + mirror.end ){
+            mirror_diverged( "the data file was written by another process" );
+            return false;
         }
 
-        if ( sigterm_triggered ) {
-            syslog( LOG_DEBUG, "sigterm triggered\n" );
-            break;
-        }
+        return aesd_mirror_view( &mirror, from - mirror_log_base, mirror.end, v );
+    }
 
-#ifndef USE_AESD_CHAR_DEVICE
-        if ( nready == 0 && thread_clients > 0 ) {
-            timer_handler();
-            continue;
-        }
-#endif
-        if( nready > 0 ){
-            connfd = accept( listenfd, (SA *) &cliaddr, &clilen );
+    // the device keeps the newest complete records, a suffix of what was written ending at record_end
+    if( ioctl( log_fd, AESDCHAR_IOCGINFO, &info ) != 0 || info.newest_seq != mirror_seq_base + mirror.records ||
+        info.size > mirror.record_end ){
+        mirror_diverged( "the device was written by another process" );
+        return false;
+    }
 
-            log_remote_peer_name( connfd, true );
-            
-            struct ThreadData* thrd = ( struct ThreadData* )malloc( sizeof( struct ThreadData) );
-            thrd->write_lock     = &write_lock;
-            thrd->fd            = connfd;
-            thrd->is_completed  = 0;
-            
-            int rc = pthread_create( &thrd->p_tid, NULL, connection_handler, thrd ); 
+    return aesd_mirror_view( &mirror, mirror.record_end - info.size, mirror.record_end, v );
+}
 
-            if( rc != 0 ){
-                syslog( LOG_ERR, "> Failed to create connection handler thread" );
-                close( connfd );
-                free( thrd );
-            }else{
-                add_thread( thrd );
+static void mirror_diverged( char const* why ){
+    AESD_LOG( LOG_WARNING, "Log mirror disabled, %s\n", why );
+    aesd_mirror_destroy( &mirror );
+    mirror_on = false;
+}
+
+/**
+ * @return the log_gen a request that did not write itself has to see.
+ */
+static uint64_t log_gen_now( void ){
+    uint64_t gen;
+
+    pthread_mutex_lock( &write_lock );
+    gen = log_gen;
+    pthread_mutex_unlock( &write_lock );
+    return gen;
+}
+
+/*
+ * Replays the log from offset @param from on, out of a snapshot shared with the clients asking at
+ * about the same time that contains the write numbered @param gen.  No lock is held while writing
+ * to the socket, so a slow client cannot stall the others.  A framed reply is completed by the
+ * caller with the status returned.
+ */
+static uint8_t dump_file_to_client( struct ThreadData* td, uint64_t gen, uint64_t from, struct aesd_frame const* req ){
+    struct replay_snap* snap = replay_get( gen );
+    uint8_t status = AESD_STATUS_OK;
+    uint64_t skip = snap && from > snap->base ? from - snap->base : 0;
+
+    if( !snap || !snap->ok ){
+        status = stream_file_to_client( td, from, req );
+    }else if( snap->from_mirror ){
+        size_t len = skip < snap->view.len ? snap->view.len - skip : 0;
+
+        if( req && len > 0 ){
+            struct aesd_frame f = { req->op | AESD_OP_REPLY, AESD_STATUS_OK, AESD_FLAG_MORE, len, req->seq };
+            uint8_t hdr[ AESD_FRAME_HDR_LEN ];
+
+            aesd_frame_encode( &f, hdr );
+
+            if( !send_all( td->fd, ( char const* )hdr, sizeof( hdr ), MSG_MORE ) ){
+                len = 0;
             }
+        }
 
-            do_maintenance();
+        if( len > 0 && !aesd_mirror_send( td->fd, &snap->view, skip ) ){
+            AESD_LOG( LOG_ERR, "> write back failed with %s", strerror( errno ) );
+        }else{
+            aesd_count( AESD_CTR_REPLAY_BYTES, len );
+            aesd_ratelimit_charge( &limiter, &td->limit, len );
         }
-    }
-}
+    }else if( skip >= snap->len || reply_chunk( td, req, snap->data + skip, snap->len - skip ) ){
+        uint64_t tail = snap->base + snap->len;
 
-void aesd_thrd_signal_triggered( int sig ){
-    if( sig == SIGINT ){
-        sigint_triggered = 1;
+        // only the head of a large log is shared, the rest is read per client
+        if( snap->partial ){
+            status = stream_file_to_client( td, from > tail ? from : tail, req );
+        }
     }
 
-    if( sig == SIGTERM ){
-        sigterm_triggered = 1;
+    if( snap ){
+        replay_put( snap );
     }
+
+    pthread_mutex_lock( &replay_lock );
+    replay_busy --;
+    pthread_mutex_unlock( &replay_lock );
+    return status;
 }
 
-void aesd_thrd_shutdown(){
-    // close( log_fd );
-    close( listenfd );
-    remove( filename_ );
-    pthread_mutex_destroy( &write_lock );
-    slist_data_t *datap = NULL;
+/**
+ * @return a referenced snapshot that contains the write numbered @param gen, NULL when out of memory.
+ * The first client needing a newer snapshot takes it, clients arriving in the meantime wait for that
+ * one instead of reading the backend again.  While other replays are under way it first waits
+ * replay_window_us for more to join, a client replaying on its own never waits.
+ */
+static struct replay_snap* replay_get( uint64_t gen ){
+    struct replay_snap* snap;
+    bool crowded;
+
+    pthread_mutex_lock( &replay_lock );
+    replay_clients ++;
+    replay_busy ++;
+
+    while( !replay_last || replay_last->gen < gen ){
+        if( !replay_loading ){
+            break;
+        }
 
-    while ( !SLIST_EMPTY( &thrd_head ) ) {
-        datap = SLIST_FIRST( &thrd_head );
-        struct ThreadData* td = datap->td;
-        pthread_t tid = td->p_tid;
-        pthread_join( tid, NULL );
-        SLIST_REMOVE_HEAD( &thrd_head, entries );
-        free( td );
-        free( datap );
-        syslog( LOG_DEBUG, "> Thrd %lu completed.", tid );
+        pthread_cond_wait( &replay_cond, &replay_lock );
     }
 
-    // timer_delete( timer_id );
-    syslog( LOG_DEBUG, "aesd_thrd_shutdown completed." );
-}
+    if( replay_last && replay_last->gen >= gen ){
+        snap = replay_last;
+        atomic_fetch_add( &snap->refs, 1 );
+        pthread_mutex_unlock( &replay_lock );
+        return snap;
+    }
 
-//----------------------------------------------------- private impl -----------------------------------------------------//
-//////////////////////////////////////////////////////////////////////////////////////////////
-static void log_remote_peer_name( int client_sock, bool is_open ){
-    char ipstr[INET6_ADDRSTRLEN];
+    replay_loading = true;
+    crowded = replay_busy > 1;
+    pthread_mutex_unlock( &replay_lock );
 
-    struct sockaddr_storage addr;
-    socklen_t len;
-    getpeername( client_sock, (struct sockaddr*)&addr, &len );
-    struct sockaddr_in *s = (struct sockaddr_in *)&addr;
-    inet_ntop(AF_INET, &s->sin_addr, ipstr, sizeof( ipstr ));
+    if( crowded && cfg_->replay_window_us > 0 ){
+        struct timespec ts = {
+            .tv_sec = cfg_->replay_window_us / 1000000,
+            .tv_nsec = ( cfg_->replay_window_us % 1000000 ) * 1000L
+        };
 
-    if( is_open ){
-        syslog( LOG_DEBUG, "> Accepted connection from %s\n", ipstr );
-    }else{
-        syslog( LOG_DEBUG, "> Closed connection from %s\n", ipstr );
+        nanosleep( &ts, NULL );
     }
-}
 
-void* connection_handler( void* arg ){
-    char buf[ MAXLINE ];
-    struct ThreadData* td = ( struct ThreadData* )arg;
-    int n;
+    snap = replay_take();
+    pthread_mutex_lock( &replay_lock );
+    replay_loading = false;
 
-    for( ;; ){
-        if ( ( n = read( td->fd, buf, MAXLINE - 1 ) ) < 0 ) {
-            /* connection reset by client */
-            close( td->fd );
-            td->is_completed = 1;
-            log_remote_peer_name( td->fd, false );
-            break;
-        }else if( n == 0 ){// client disconnected
-            close( td->fd );
-            td->is_completed = 1;
-            log_remote_peer_name( td->fd, false );
-            break;
-        }else{
-            buf[ n ] = '\0';
-            process_message( td->fd, buf, n );
+    if( snap ){
+        replay_snapshots ++;
+
+        // the last snapshot keeps one reference of its own until it is replaced
+        if( replay_last ){
+            replay_put( replay_last );
         }
+
+        replay_last = snap;
+        atomic_fetch_add( &snap->refs, 1 );
     }
 
-    return NULL;
+    pthread_cond_broadcast( &replay_cond );
+    pthread_mutex_unlock( &replay_lock );
+    return snap;
 }
 
-static void add_thread( struct ThreadData* td ){
-    syslog( LOG_DEBUG, "> adding new thread %lu", td->p_tid );
-    slist_data_t* datap = malloc(sizeof(slist_data_t));
-    datap->td = td;
-    SLIST_INSERT_HEAD( &thrd_head, datap, entries );
-    thread_clients ++;
-}
+/*
+ * Takes a snapshot of the log, from the mirror when it holds everything the backend would return,
+ * otherwise by reading the backend under write_lock chunk by chunk, up to REPLAY_SNAPSHOT_MAX.  log_gen is sampled first, so
+ * writes landing during the read may be included but none numbered up to gen is missed.
+ */
+static struct replay_snap* replay_take( void ){
+    struct replay_snap* snap = calloc( 1, sizeof( *snap ) );
+    size_t cap = 0;
+    ssize_t rn;
+    int rd_fd;
+
+    if( !snap ){
+        AESD_LOG( LOG_ERR, "Out of memory for a replay snapshot\n" );
+        return NULL;
+    }
 
-// https://man.archlinux.org/man/core/man-pages/SLIST_REMOVE.3.en
-static void do_maintenance(){
-    syslog( LOG_DEBUG, "> do maintenance" );
-    slist_data_t *item = NULL;
-    slist_data_t *tmp_item = NULL;
+    atomic_init( &snap->refs, 1 );
+    pthread_mutex_lock( &write_lock );
+    snap->gen = log_gen;
+    snap->base = log_start();
+    snap->from_mirror = cfg_->mirror_size > 0 && mirror_snapshot( snap->base, &snap->view );
+    pthread_mutex_unlock( &write_lock );
 
-    SLIST_FOREACH_SAFE( item, &thrd_head, entries, tmp_item ) {
-        struct ThreadData* td = item->td;
+    if( snap->from_mirror ){
+        snap->ok = true;
+        return snap;
+    }
 
-        if( td->is_completed ){
-            pthread_t tid = td->p_tid;
-            pthread_join( tid, NULL );
-            SLIST_REMOVE( &thrd_head, item, slist_data_s, entries );
-            free( td );
-            free( item );
-            syslog( LOG_DEBUG, "> Thrd %lu completed.", tid );
-            thread_clients --;
+    if( !log_reader_open( &rd_fd ) ){
+        return snap;
+    }
+
+    for( ;; ){
+        if( snap->len == cap ){
+            size_t ncap = cap ? cap * 2 : cfg_->buffsize;
+            char* data;
+
+            if( cap >= REPLAY_SNAPSHOT_MAX ){
+                AESD_LOG( LOG_DEBUG, "> replay snapshot capped at %d bytes, streaming the rest\n", REPLAY_SNAPSHOT_MAX );
+                snap->ok = snap->partial = true;
+                break;
+            }
+
+            ncap = ncap < REPLAY_SNAPSHOT_MAX ? ncap : REPLAY_SNAPSHOT_MAX;
+            data = realloc( snap->data, ncap );
+
+            if( !data ){
+                AESD_LOG( LOG_ERR, "Out of memory for a replay snapshot\n" );
+                break;
+            }
+
+            snap->data = data;
+            cap = ncap;
+        }
+
+        pthread_mutex_lock( &write_lock );
+        rn = log_pread( rd_fd, snap->data + snap->len, cap - snap->len, snap->base + snap->len );
+        pthread_mutex_unlock( &write_lock );
+
+        if( rn < 0 ){
+            AESD_LOG( LOG_ERR, "read returned %zd, err: %s\n", rn, strerror( errno ) );
+            break;
+        }
+
+        if( rn == 0 ){
+            snap->ok = true;
+            break;
         }
+
+        snap->len += rn;
     }
-}
 
-static int write_safe( char const* buf, int len ){
-    int rc = pthread_mutex_lock( &write_lock );
+    if( rd_fd >= 0 ){
+        close( rd_fd );
+    }
 
-    if( 0 != rc ){
-        syslog( LOG_ERR, "> Failed to lock write lock" );
-        return -1;
+    if( !snap->ok ){
+        free( snap->data );
+        snap->data = NULL;
+        snap->len = 0;
     }
 
-    log_fd = open( filename_, O_RDWR, S_IRUSR | S_IWUSR );
+    return snap;
+}
 
-    if( log_fd < 0 ){
-        syslog( LOG_ERR, "Cannot create %s, err: %s\n", filename_, strerror( errno ) );
-        return -1;
+static void replay_put( struct replay_snap* snap ){
+    if( atomic_fetch_sub( &snap->refs, 1 ) != 1 ){
+        return;
     }
 
-    int nbytes = write( log_fd, buf, len );
-    pthread_mutex_unlock( &write_lock );
-    close( log_fd );
-    return nbytes;
+    if( snap->from_mirror ){
+        aesd_mirror_release( &snap->view );
+    }
+
+    free( snap->data );
+    free( snap );
 }
 
-static void process_message( int clientfd, char const* buf, int len ){   
+/*
+ * Streams the log from offset @param from on straight from the backend, for what a snapshot could
+ * not hold.  write_lock is held only while a chunk is read.
+ */
+static uint8_t stream_file_to_client( struct ThreadData* td, uint64_t from, struct aesd_frame const* req ){
+    int rd_fd;
+    uint64_t off = from > log_start() ? from : log_start();
+    ssize_t rn = 0;
+
+    if( !log_reader_open( &rd_fd ) ){
+        return AESD_STATUS_FAILED;
+    }
+
     do{
-        if( len <= 0 ){
-            syslog( LOG_ERR, "> Invalid len %d", len );
+        if( 0 != pthread_mutex_lock( &write_lock ) ){
+            AESD_LOG( LOG_ERR, "> Failed to lock write lock" );
             break;
         }
 
-        unsigned seek_cmd, seek_off;
-
-        if( parse_aesdchar_ioseek( buf, &seek_cmd, &seek_off ) ){
-            struct aesd_seekto seek_to_cmd = {
-                .write_cmd = seek_cmd,
-                .write_cmd_offset = seek_off
-            };
+        rn = log_pread( rd_fd, td->xbuf, cfg_->buffsize, off );
+        pthread_mutex_unlock( &write_lock );
+        AESD_LOG( LOG_DEBUG, "> dump_file_to_client: off = %llu, read chunk = %zd\n", ( unsigned long long )off, rn );
 
-            syslog( LOG_DEBUG, "seek_cmd: %u, seek_off: %u", seek_cmd, seek_off );
-            log_fd = open( filename_, O_RDWR );
+        if( rn < 0 ){
+            AESD_LOG( LOG_ERR, "read returned %zd, err: %s\n", rn, strerror( errno ) );
+            break;
+        }
 
-            if( log_fd < 0 ){
-                syslog( LOG_ERR, "Cannot open ioctl %s, err: %s\n", filename_, strerror( errno ) );
-                return;
-            }
+        if( rn > 0 && !reply_chunk( td, req, td->xbuf, rn ) ){
+            break;
+        }
 
-            if( ioctl( log_fd, AESDCHAR_IOCSEEKTO, &seek_to_cmd ) == -1 ){
-                syslog( LOG_ERR, "> Failed to send AESDCHAR_IOCSEEKTO command - %s", strerror( errno ) );
-            }else{
-                int rn;
-
-                do{
-                    char tmpbuf[ BUFFSIZE ];
-                    memset( tmpbuf, 0, sizeof( tmpbuf ) );
-                    rn = read( log_fd, tmpbuf, sizeof( tmpbuf ) );
-                    // tmpbuf[rn ] = '\0';
-                    syslog( LOG_DEBUG, ">> seek dump_file_to_client: buf = %s\n", tmpbuf );
-
-                    if( rn > 0 ){
-                        // printf( "> chunk to send (%s)\n", tmpbuf );
-                        int wr_rc = write( clientfd, tmpbuf, rn );
-
-                        if( wr_rc < 0 ){
-                            syslog( LOG_ERR, "> write back failed with %s", strerror( errno ) );
-                        }
-                    }
-                }while( rn > 0 );
-            }
+        off += rn;
+    }while( rn > 0 );
 
-            close( log_fd );
-        }else{
-            syslog( LOG_DEBUG, "> process_message %s, %d\n", buf, len );
-            int nbytes;
+    if( rd_fd >= 0 ){
+        close( rd_fd );
+    }
 
-            nbytes = write_safe( buf, len );
+    return rn < 0 ? AESD_STATUS_FAILED : AESD_STATUS_OK;
+}
 
-            if( nbytes < 0 ){
-                syslog( LOG_ERR, "Failed to write log data, err: %s\n", strerror( errno ) );
-                break;
-            }
+/**
+ * Opens a descriptor of its own for reading the device, @param rd_fd is -1 for a data file log.
+ * @return false when the device cannot be opened.
+ */
+static bool log_reader_open( int* rd_fd ){
+    *rd_fd = backend_is_file ? -1 : open( filename_, O_RDONLY );
 
-            file_size += len;
-            char const* nl = strchr( buf, '\n' );
+    if( !backend_is_file && *rd_fd < 0 ){
+        AESD_LOG( LOG_ERR, "Cannot open %s, err: %s\n", filename_, strerror( errno ) );
+        return false;
+    }
 
-            if( nl ){
-                dump_file_to_client( clientfd );
-            }   
-        }
-    }while( 0 );
+    return true;
 }
 
-static void dump_file_to_client( int fd_client ){
-    int rc = pthread_mutex_lock( &write_lock );
+// reads from log offset @param off, a data file through the segment log
+static ssize_t log_pread( int rd_fd, char* buf, size_t len, uint64_t off ){
+    ssize_t rn = backend_is_file ? aesd_seglog_pread( &seglog, buf, len, off ) : pread( rd_fd, buf, len, off );
 
-    if( 0 != rc ){
-        syslog( LOG_ERR, "> Failed to lock write lock" );
-        return;
+    aesd_count( AESD_CTR_SYSCALLS, 1 );
+
+    if( rn < 0 ){
+        aesd_count( AESD_CTR_READ_ERRORS, 1 );
     }
 
-    log_fd = open( filename_, O_RDWR, S_IRUSR | S_IWUSR );
+    return rn;
+}
 
-    if( log_fd < 0 ){
-        syslog( LOG_ERR, "Cannot create %s, err: %s\n", filename_, strerror( errno ) );
-        pthread_mutex_unlock( &write_lock );
-        return;
+/**
+ * Writes all of @param buf, retrying short writes.
+ * @return false when the client connection failed.
+ */
+static bool write_all( int fd, char const* buf, size_t len ){
+    while( len > 0 ){
+        ssize_t n = write( fd, buf, len );
+
+        aesd_count( AESD_CTR_SYSCALLS, 1 );
+
+        if( n < 0 ){
+            if( errno == EINTR ){
+                continue;
+            }
+
+            AESD_LOG( LOG_ERR, "> write back failed with %s", strerror( errno ) );
+            return false;
+        }
+
+        buf += n;
+        len -= n;
     }
 
-    // fsync( log_fd );
-    // rc = lseek( log_fd, 0, SEEK_SET );
+    return true;
+}
 
-    // if( rc < 0 ){
-    //     syslog( LOG_ERR, "Failed to seek to file start" );
-    // }else
-    {
-        int bytes_left = file_size;
-        int rn = 0;
+/**
+ * As write_all() with send() @param flags, e.g. MSG_MORE while more of a reply follows.
+ */
+static bool send_all( int fd, char const* buf, size_t len, int flags ){
+    while( len > 0 ){
+        ssize_t n = send( fd, buf, len, flags );
 
-        do{
-            char tmpbuf[ BUFFSIZE ];
-            memset( tmpbuf, 0, sizeof( tmpbuf ) );
-            rn = read( log_fd, tmpbuf, sizeof( tmpbuf ) );
-            // tmpbuf[rn ] = '\0';
-            syslog( LOG_DEBUG, "> dump_file_to_client: file_size = %d, bytes_left = %d, read chunk = %d\n", file_size, bytes_left, rn );
-
-            if( rn > 0 ){
-                // printf( "> chunk to send (%s)\n", tmpbuf );
-                int wr_rc = write( fd_client, tmpbuf, rn );
-
-                if( wr_rc < 0 ){
-                    syslog( LOG_ERR, "> write back failed with %s", strerror( errno ) );
-                }
+        aesd_count( AESD_CTR_SYSCALLS, 1 );
 
-                bytes_left -= rn;
-            }else{
-                syslog( LOG_ERR, "read returned %d, err: %s\n", rn, strerror( errno ) );
-                break;//????
+        if( n < 0 ){
+            if( errno == EINTR ){
+                continue;
             }
-        }while( rn > 0 );
 
-        // lseek( log_fd, 0, SEEK_SET );
-        // lseek( log_fd, file_size, SEEK_SET );
-        close( log_fd );
+            AESD_LOG( LOG_ERR, "> write back failed with %s", strerror( errno ) );
+            return false;
+        }
+
+        buf += n;
+        len -= n;
     }
 
-    pthread_mutex_unlock( &write_lock );
+    return true;
 }
 
 static void make_daemon( void )
@@ -448,7 +1734,7 @@ static void make_daemon( void )
     
     /* An error occurred */
     if (pid < 0){
-        syslog( LOG_ERR, "fork failed" );
+        AESD_LOG( LOG_ERR, "fork failed" );
         exit(EXIT_FAILURE);
     }
     
@@ -483,7 +1769,7 @@ static void make_daemon( void )
     int ch_ret = chdir("/");
 
     if( ch_ret < 0 ){
-        syslog( LOG_ERR, "Failed to change dir" );
+        AESD_LOG( LOG_ERR, "Failed to change dir" );
         exit(EXIT_FAILURE);
     }
     
@@ -493,42 +1779,10 @@ static void make_daemon( void )
     close( STDERR_FILENO );
 }
 
-#ifndef USE_AESD_CHAR_DEVICE
 static void timer_handler() {
-    time_t anytime;
-    struct tm *current;
     char time_str[ 64 ];
-    memset( time_str, 0, sizeof( time_str ) );
-    time(&anytime);
-
-    current = localtime(&anytime);
-    strftime( time_str, 64, "timestamp:%Y-%m-%d %H:%M:%S\n", current );
-    syslog( LOG_DEBUG, "%s", time_str );
-    write_safe( time_str, strlen( time_str ) );
-    // domaintenace = true;
-}
-#endif
-
-static bool parse_aesdchar_ioseek( char const* buffer, unsigned int *write_cmd, unsigned int *write_cmd_offset ){
-    return sscanf( buffer, "AESDCHAR_IOCSEEKTO:%u,%u", write_cmd, write_cmd_offset ) == 2;
-}
-// https://opensource.com/article/21/10/linux-timers
-// https://stackoverflow.com/questions/55666829/counting-time-with-timer-in-c
-// static bool start_timer( void ){
-//     memset(&sev, 0, sizeof(struct sigevent));
-//     sev.sigev_notify            = SIGEV_THREAD;
-//     sev.sigev_notify_function   = &timer_handler;
-//     // sev.sigev_value.sival_ptr = &info;
-
-//     if( timer_create( CLOCK_REALTIME, &sev, &timer_id ) != 0 ) {
-//          syslog( LOG_ERR, "timer_create failed" );
-//          return false;
-//     }
-
-//     if( timer_settime(timer_id, 0, &its, NULL) != 0 ){
-//         syslog( LOG_ERR, "timer_settime" );
-//         return false;
-//     }
-
-//     return true;
-// }
\ No newline at end of file
+    size_t len = aesd_timestamp_format( time_str, sizeof( time_str ) );
+
+    AESD_LOG( LOG_DEBUG, "%s", time_str );
+    write_safe( time_str, len, NULL );
+}
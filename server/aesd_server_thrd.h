@@ -1,7 +1,8 @@
 #pragma once
 #include <stdbool.h>
+#include "aesd_config.h"
 
-bool aesd_thrd_initialize( char const* filename, bool is_daemon );
+bool aesd_thrd_initialize( struct aesd_config const* cfg );
 
 void aesd_thrd_run();
 
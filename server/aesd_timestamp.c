@@ -0,0 +1,53 @@
+#include "aesd_timestamp.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+int aesd_timestamp_timer_open( unsigned interval_s ){
+    struct itimerspec its = {
+        .it_interval = { .tv_sec = interval_s },
+        .it_value = { .tv_sec = interval_s }
+    };
+    int tfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+
+    if( tfd < 0 ){
+        syslog( LOG_ERR, "timerfd_create failed, err: %s\n", strerror( errno ) );
+        return -1;
+    }
+
+    if( timerfd_settime( tfd, 0, &its, NULL ) < 0 ){
+        syslog( LOG_ERR, "timerfd_settime failed, err: %s\n", strerror( errno ) );
+        close( tfd );
+        return -1;
+    }
+
+    return tfd;
+}
+
+bool aesd_timestamp_timer_fired( int tfd ){
+    uint64_t expirations = 0;
+
+    // expirations missed while the loop was busy collapse into one record
+    return read( tfd, &expirations, sizeof( expirations ) ) == sizeof( expirations ) && expirations > 0;
+}
+
+long aesd_timestamp_now_ms( void ){
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+size_t aesd_timestamp_format( char* buf, size_t size ){
+    time_t anytime;
+    struct tm current;
+
+    time( &anytime );
+    localtime_r( &anytime, &current );
+    return strftime( buf, size, "timestamp:%Y-%m-%d %H:%M:%S\n", &current );
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Periodic timestamp records.  The timer is a timerfd on CLOCK_MONOTONIC that the engines add to
+ * their poll or epoll set, so records are written at a fixed cadence however busy the sockets are.
+ */
+
+/**
+ * @return a non blocking timerfd expiring every @param interval_s seconds, or -1 on error.
+ */
+int aesd_timestamp_timer_open( unsigned interval_s );
+
+/**
+ * Consumes the pending expirations of @param tfd.
+ * @return true when the timer fired at least once since the last call.
+ */
+bool aesd_timestamp_timer_fired( int tfd );
+
+/**
+ * Formats the record "timestamp:%Y-%m-%d %H:%M:%S\n" for the current local time into @param buf.
+ * @return the record length.
+ */
+size_t aesd_timestamp_format( char* buf, size_t size );
+
+/**
+ * @return CLOCK_MONOTONIC in milliseconds, for deadlines and latency reports.
+ */
+long aesd_timestamp_now_ms( void );
@@ -1,10 +1,25 @@
+#define _GNU_SOURCE
 #include "aesdsocket.h"
 #include "aesdsocket_cfg.h"
+#include "aesd_timestamp.h"
+#include "aesd_handover.h"
+#include "aesd_logger.h"
+#include "aesd_proto.h"
+#include "aesd_cmd.h"
+#include "aesd_index.h"
+#include "aesd_seglog.h"
+#include "aesd_latency.h"
+#include "aesd_metrics.h"
+#include "aesd_ratelimit.h"
+#include "../aesd-char-driver/aesd_ioctl.h"
 #include <string.h>
 #include <sys/socket.h>	/* basic socket definitions */
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 
 #include <syslog.h>
 
@@ -17,30 +32,134 @@
 #include <stdio.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
+#include <stdint.h>
 
-static char buf[ MAXLINE ];
+static struct aesd_config const* cfg_ = NULL;
+static char*        buf = NULL;     /* cfg maxline bytes, client input */
+static char*        xbuf = NULL;    /* cfg buffsize bytes, replay chunks when sendfile is unavailable */
+static bool         backend_is_file = false;
 
 static struct sockaddr_in cliaddr, servaddr;
-static int maxi, listenfd, connfd, sockfd;
-static int nready;
+static int listenfds[ AESD_HANDOVER_MAX_FDS ], connfd;
+static unsigned     nlisten = 0;    /* one, or all of a multi worker predecessor */
 static  socklen_t clilen;
-static ssize_t      n;
-static int          log_fd = -1;
-static int          file_size = 0;
+static int          log_fd = -1;     /* the char device */
+static struct aesd_seglog seglog;   /* file backends */
+static uint64_t     file_size = 0;  /* log offset after our last write */
 static const int	on = 1;
+static int          epfd = -1;
+static bool         sendfile_ok = true;
+static int          timer_fd = -1;
+static int          ctl_fd = -1;
+static int          stats_fd = -1;  /* --stats-socket listener */
+static bool         handed_over = false;
+static struct aesd_index rec_index;         /* file backends: record offsets */
+static bool         index_on = false;
 
-#define  OPEN_MAX 256
-static struct pollfd client[OPEN_MAX];
+#define MAX_EVENTS      256     /* events taken per epoll_wait */
+#define CONN_INIT_CAP   64      /* initial connection table size, doubled on demand */
+#define LISTEN_SLOT     UINT32_MAX
+#define TIMER_SLOT      ( UINT32_MAX - 1 )
+#define CTL_SLOT        ( UINT32_MAX - 2 )
+#define STATS_SLOT      ( UINT32_MAX - 3 )
+
+/*
+ * A range of the log that still has to be sent to a client.  Replies are queued as references into
+ * the log instead of copies, the bytes are fetched from log_fd when the socket can take them.
+ * Framed replies carry their header, and any payload not taken from the log, in data.
+ */
+struct aesd_outref {
+    off_t   off;
+    size_t  len;
+    char*   data;       /* owned, sent before the range */
+    size_t  data_len;
+    size_t  data_off;   /* bytes of data already sent */
+};
+
+/*
+ * Connection table indexed by slot, the slot travels in epoll_event.data so dispatch never scans.
+ * Free slots are kept on a stack, so accept and close are O(1).
+ */
+struct aesd_conn {
+    int                 fd;
+    uint32_t            events;     /* currently registered epoll events */
+    struct aesd_outref* outq;       /* pending replies, outq_head is the oldest */
+    uint32_t            outq_head;
+    uint32_t            outq_len;
+    uint32_t            outq_cap;
+    size_t              out_bytes;  /* bytes referenced by outq */
+    bool                answered;   /* at least one reply was queued, the client is not mid request */
+    bool                negotiated; /* the first bytes told whether the client speaks frames */
+    bool                binary;     /* framed protocol, see aesd_proto.h */
+    char*               inbuf;      /* framed clients: cfg maxline bytes, a partial frame */
+    size_t              in_len;     /* bytes kept in inbuf, or in pend while negotiating */
+    char                pend[ AESD_PROTO_MAGIC_LEN ];  /* first bytes that may still become the magic */
+    struct aesd_trace   trace;
+    struct aesd_client_limit limit;
+    uint64_t            wake_ns;    /* over its rate limit, not read from until then, 0 = not throttled */
+    bool                throttle_queued;    /* the slot is in throttled[] */
+};
+
+static struct aesd_conn*    conns = NULL;
+static uint32_t*            free_slots = NULL;
+static uint32_t             conns_cap = 0;
+static uint32_t             free_top = 0;
+static uint32_t             conns_active = 0;
+static uint32_t*            throttled = NULL;   /* slots waiting for their rate limit, conns_cap entries */
+static uint32_t             throttled_len = 0;
+static struct aesd_ratelimit limiter;
+static bool                 draining = false;
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void log_remote_peer_name( int client_sock, bool is_open );
-static void process_message( int clientfd, char const* buf, int len );
+static bool conns_grow( void );
+static void accept_clients( void );
+static void accept_from( int listenfd );
+static void close_client( uint32_t slot );
+static void raise_fd_limit( void );
+static void process_message( uint32_t slot, char const* buf, int len );
 static void make_daemon();
-static void dump_file_to_client( int fd );
+static bool write_log( char const* buf, int len );
+static bool outq_push( struct aesd_conn* c, off_t off, size_t len, char* data, size_t data_len );
+static void outq_clear( struct aesd_conn* c );
+static bool negotiate( uint32_t slot, char* in, size_t len );
+static bool process_frames( uint32_t slot );
+static bool serve_frame( uint32_t slot, struct aesd_frame const* f, char const* payload );
+static bool queue_frame( uint32_t slot, struct aesd_frame const* req, uint8_t status,
+                         char const* payload, size_t plen, off_t off, size_t len );
+static uint64_t log_size( void );
+static uint64_t log_start( void );
+static bool seek_offset( unsigned cmd, unsigned off, uint64_t* pos, uint8_t* status );
+static int format_stats( char* buf, size_t size );
+static void serve_stats( void );
+static bool queue_text( uint32_t slot, char const* text, size_t len );
+static void cmd_seekto( uint32_t slot, struct aesd_cmd const* cmd );
+static void cmd_stats( uint32_t slot, struct aesd_cmd const* cmd );
+static void cmd_size( uint32_t slot, struct aesd_cmd const* cmd );
+static void cmd_replay_from( uint32_t slot, struct aesd_cmd const* cmd );
+static void cmd_tail( uint32_t slot, struct aesd_cmd const* cmd );
+static void cmd_latency( uint32_t slot, struct aesd_cmd const* cmd );
+
+static void ( * const cmd_handlers[ AESD_CMD_COUNT ] )( uint32_t slot, struct aesd_cmd const* cmd ) = {
+    [ AESD_CMD_SEEKTO ] = cmd_seekto,
+    [ AESD_CMD_STATS ] = cmd_stats,
+    [ AESD_CMD_SIZE ] = cmd_size,
+    [ AESD_CMD_REPLAY_FROM ] = cmd_replay_from,
+    [ AESD_CMD_TAIL ] = cmd_tail,
+    [ AESD_CMD_LATENCY ] = cmd_latency
+};
+static bool flush_client( uint32_t slot );
+static void update_events( uint32_t slot );
+static void write_timestamp( void );
+static void drain_clients( void );
+static void serve_client( uint32_t slot, uint32_t revents );
+static void throttle_check( uint32_t slot );
+static int throttle_timeout( void );
+static void throttle_resume( bool all );
 
 static char const* filename_ = NULL;
-volatile sig_atomic_t sigint_triggered = 0;
-volatile sig_atomic_t sigterm_triggered = 0;
+static volatile sig_atomic_t sigint_triggered = 0;
+static volatile sig_atomic_t sigterm_triggered = 0;
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -54,230 +173,1225 @@ void aesd_signal_triggered( int sig ){
     }
 }
 
-bool aesd_initialize( char const* filename, bool is_daemon ){
-    filename_ = filename;
-    log_fd = open( filename, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR );
+bool aesd_initialize( struct aesd_config const* cfg ){
+    struct stat st;
+    cfg_ = cfg;
+    filename_ = cfg->backend;
+    buf = malloc( cfg->maxline );
+    xbuf = malloc( cfg->buffsize );
 
-    if( log_fd < 0 ){
-        syslog( LOG_ERR, "Cannot create %s, err: %s\n", filename, strerror( errno ) );
+    if( !buf || !xbuf ){
+        AESD_LOG( LOG_ERR, "Out of memory for io buffers\n" );
         return false;
     }
 
-    listenfd = socket( AF_INET, SOCK_STREAM, 0 );
-
-    if( listenfd < 0 ){
-        syslog( LOG_ERR, "Failed to create socket\n" );
+    if( !aesd_ratelimit_init( &limiter, ( struct aesd_limit ){ cfg->client_rate, cfg->client_burst },
+                              ( struct aesd_limit ){ cfg->ip_rate, cfg->ip_burst } ) ){
+        AESD_LOG( LOG_ERR, "Out of memory for the rate limits\n" );
         return false;
     }
 
-    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
-    memset( &servaddr, 0, sizeof( servaddr ) );
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = htonl( INADDR_ANY );
-    servaddr.sin_port = htons( SERV_PORT );
-    int rc = bind( listenfd, ( struct sockaddr* )&servaddr, sizeof( servaddr ) );
+    // anything but an existing device is a data file, kept in segments when configured
+    backend_is_file = cfg->segment_size > 0 || stat( filename_, &st ) != 0 || S_ISREG( st.st_mode );
 
-    if( rc < 0 ){
-        syslog( LOG_ERR, "Failed to bind to 9000 port\n" );
+    if( !backend_is_file && ( log_fd = open( filename_, O_RDWR | O_APPEND ) ) < 0 ){
+        AESD_LOG( LOG_ERR, "Cannot open %s, err: %s\n", filename_, strerror( errno ) );
         return false;
     }
 
-    if( is_daemon ){
+    if( !backend_is_file ){
+        file_size = log_size();
+    }
+
+    if( backend_is_file ){
+        if( !aesd_seglog_open( &seglog, filename_, cfg->segment_size, cfg->retain_bytes, cfg->retain_secs ) ){
+            AESD_LOG( LOG_ERR, "Cannot open the log %s\n", filename_ );
+            return false;
+        }
+
+        file_size = aesd_seglog_end( &seglog );
+
+        // the device locates records itself, a data file needs the index for seeks
+        if( !aesd_index_open( &rec_index, cfg->index_file, &seglog ) ){
+            AESD_LOG( LOG_ERR, "Cannot set up the record index\n" );
+            return false;
+        }
+
+        index_on = true;
+    }
+
+    if( cfg->takeover ){
+        int fds[ AESD_HANDOVER_MAX_FDS ];
+        int n = aesd_handover_takeover( cfg->control_socket, fds, AESD_HANDOVER_MAX_FDS );
+
+        if( n <= 0 ){
+            return false;
+        }
+
+        // closing the listeners of a multi worker server would reset the connections queued on them
+        for( int i = 0; i < n; i ++ ){
+            listenfds[ nlisten ++ ] = fds[ i ];
+        }
+    }else{
+        int listenfd = socket( AF_INET, SOCK_STREAM, 0 );
+
+        if( listenfd < 0 ){
+            AESD_LOG( LOG_ERR, "Failed to create socket\n" );
+            return false;
+        }
+
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        memset( &servaddr, 0, sizeof( servaddr ) );
+        servaddr.sin_family = AF_INET;
+        servaddr.sin_addr.s_addr = htonl( INADDR_ANY );
+        servaddr.sin_port = htons( cfg->port );
+        int rc = bind( listenfd, ( struct sockaddr* )&servaddr, sizeof( servaddr ) );
+
+        if( rc < 0 ){
+            AESD_LOG( LOG_ERR, "Failed to bind to %d port\n", cfg->port );
+            return false;
+        }
+
+        listenfds[ nlisten ++ ] = listenfd;
+    }
+
+    if( cfg->daemon ){
         make_daemon();
     }
 
-    listen( listenfd, LISTENQ );
-    client[0].fd = listenfd;
-    client[0].events = POLLIN;
-    
-    for ( int i = 1; i < OPEN_MAX; i++ ){
-        client[i].fd = -1; /* -1 indicates available entry */
+    // after make_daemon(), the sync thread would not survive its fork
+    if( !aesd_durability_start( &cfg->durability, backend_is_file ? aesd_seglog_fd( &seglog ) : log_fd ) ){
+        return false;
+    }
+
+    for( unsigned i = 0; i < nlisten; i ++ ){
+        listen( listenfds[ i ], cfg->backlog );
+        fcntl( listenfds[ i ], F_SETFL, fcntl( listenfds[ i ], F_GETFL ) | O_NONBLOCK );
+    }
+
+    raise_fd_limit();
+    epfd = epoll_create1( EPOLL_CLOEXEC );
+
+    if( epfd < 0 ){
+        AESD_LOG( LOG_ERR, "epoll_create1 failed, err: %s\n", strerror( errno ) );
+        return false;
+    }
+
+    for( unsigned i = 0; i < nlisten; i ++ ){
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = LISTEN_SLOT };
+
+        if( epoll_ctl( epfd, EPOLL_CTL_ADD, listenfds[ i ], &ev ) < 0 ){
+            AESD_LOG( LOG_ERR, "Failed to register listen socket, err: %s\n", strerror( errno ) );
+            return false;
+        }
+    }
+
+    if( cfg->timestamps ){
+        struct epoll_event tev = { .events = EPOLLIN, .data.u32 = TIMER_SLOT };
+        timer_fd = aesd_timestamp_timer_open( cfg->timer_interval );
+
+        if( timer_fd < 0 || epoll_ctl( epfd, EPOLL_CTL_ADD, timer_fd, &tev ) < 0 ){
+            AESD_LOG( LOG_ERR, "Failed to register timestamp timer\n" );
+            return false;
+        }
+    }
+
+    if( cfg->control_socket ){
+        struct epoll_event cev = { .events = EPOLLIN, .data.u32 = CTL_SLOT };
+        ctl_fd = aesd_handover_listen( cfg->control_socket );
+
+        if( ctl_fd < 0 || epoll_ctl( epfd, EPOLL_CTL_ADD, ctl_fd, &cev ) < 0 ){
+            AESD_LOG( LOG_ERR, "Failed to register control socket\n" );
+            return false;
+        }
+    }
+
+    if( cfg->stats_socket ){
+        struct epoll_event sev = { .events = EPOLLIN, .data.u32 = STATS_SLOT };
+        stats_fd = aesd_metrics_listen( cfg->stats_socket );
+
+        if( stats_fd < 0 || epoll_ctl( epfd, EPOLL_CTL_ADD, stats_fd, &sev ) < 0 ){
+            AESD_LOG( LOG_ERR, "Failed to register stats socket\n" );
+            return false;
+        }
     }
- 
-    maxi = 0; /* max index into client[] array */
+
+    if( !conns_grow() ){
+        return false;
+    }
+
+    // the predecessor stops accepting once told that the listener is served here
+    aesd_handover_ack();
     return true;
 }
 
 void aesd_run(){
-    syslog( LOG_DEBUG, "aesd_run" );
+    struct epoll_event events[ MAX_EVENTS ];
+    AESD_LOG( LOG_DEBUG, "aesd_run" );
 
     for( ;; ){
-        int i = 1;
-        nready = poll( client, maxi + 1, INFTIM );
+        int nready = epoll_wait( epfd, events, MAX_EVENTS, throttle_timeout() );
+
+        aesd_latency_poll();
+        throttle_resume( false );
 
         if ( sigint_triggered ) {
-            syslog( LOG_DEBUG, "sigint triggered, exiting...\n" );
+            AESD_LOG( LOG_DEBUG, "sigint triggered, exiting...\n" );
             break;
         }
 
         if ( sigterm_triggered ) {
-            syslog( LOG_DEBUG, "sigterm triggered\n" );
+            AESD_LOG( LOG_DEBUG, "sigterm triggered\n" );
             break;
         }
 
-        if ( nready == -1 && errno != EINTR ) {
-            syslog( LOG_ERR, "poll failed" );
+        if ( nready == -1 ) {
+            if( errno != EINTR ){
+                AESD_LOG( LOG_ERR, "epoll_wait failed, err: %s", strerror( errno ) );
+            }
+
             continue;
         }
 
-        if ( client[0].revents & POLLIN ) {
-            clilen = sizeof( cliaddr );
-            connfd = accept( listenfd, (SA *) &cliaddr, &clilen );
-            log_remote_peer_name( connfd, true );
-            
-            for( i = 1; i < OPEN_MAX; i ++ ){
-                if( client[ i ].fd < 0 ){
-                    client[ i ].fd = connfd;
-                    break;
-                }
-            }//for
+        for( int i = 0; i < nready; i ++ ){
+            uint32_t slot = events[ i ].data.u32;
 
-            if( i == OPEN_MAX ){
-                syslog( LOG_ERR, "aesd server reached max clients num\n" );
-                break;
+            if( slot == LISTEN_SLOT ){
+                accept_clients();
+                continue;
             }
 
-            client[ i ].events = POLLIN;
-
-            if( i > maxi ){
-                maxi = i;
-            }
+            if( slot == TIMER_SLOT ){
+                if( aesd_timestamp_timer_fired( timer_fd ) && conns_active > 0 ){
+                    write_timestamp();
+                }
 
-            if( -- nready <= 0 ){
-                continue;/* no more readable descriptors */
+                continue;
             }
-        }//client[0]
 
-        for( i = 1; i <= maxi; i ++ ){
-            if( ( sockfd = client[ i ].fd ) < 0 ){
+            if( slot == STATS_SLOT ){
+                serve_stats();
                 continue;
             }
 
-            if (client[i].revents & (POLLIN | POLLERR)) {
-                if ( ( n = read( sockfd, buf, MAXLINE ) ) < 0 ) {
-                    if (errno == ECONNRESET) {
-                         /* connection reset by client */
-                        close(sockfd);
-                        client[ i ].fd = -1;
-                        log_remote_peer_name( connfd, false );
-                    }else{
-                        syslog( LOG_ERR, "aesd server failed to read\n" );
-                        break;
+            if( slot == CTL_SLOT ){
+                if( aesd_handover_serve( ctl_fd, listenfds, nlisten ) ){
+                    AESD_LOG( LOG_INFO, "Listener handed over to a successor, draining\n" );
+                    handed_over = true;
+
+                    // the successor rotates the segments from now on
+                    if( backend_is_file ){
+                        aesd_seglog_follow( &seglog );
                     }
-                }else if( n == 0 ){// client disconnected
-                    close( sockfd );
-                    client[ i ].fd = -1;
-                    log_remote_peer_name( connfd, false );
-                }else{
-                    buf[ n ] = '\0';
-                    process_message( sockfd, buf, n );
-                }
 
-                if ( -- nready <= 0 ){
-                    break;				/* no more readable descriptors */
+                    break;
                 }
+
+                continue;
             }
-        }// for
+
+            serve_client( slot, events[ i ].events );
+        }
+
+        if( handed_over ){
+            break;
+        }
     }//while true
 }
 
 void aesd_shutdown(){
-    syslog( LOG_DEBUG, "aesd_shutdown" );
-    close( log_fd );
-    close( listenfd );
-    remove( filename_ );
+    AESD_LOG( LOG_DEBUG, "aesd_shutdown" );
+    drain_clients();
+
+    for( uint32_t i = 0; i < conns_cap; i ++ ){
+        if( conns[ i ].fd >= 0 ){
+            close( conns[ i ].fd );
+        }
+
+        outq_clear( &conns[ i ] );
+        free( conns[ i ].outq );
+        free( conns[ i ].inbuf );
+    }
+
+    free( conns );
+    free( free_slots );
+    free( throttled );
+    conns = NULL;
+    free_slots = NULL;
+    throttled = NULL;
+    conns_cap = free_top = conns_active = throttled_len = 0;
+    aesd_ratelimit_free( &limiter );
+    close( epfd );
+
+    if( timer_fd >= 0 ){
+        close( timer_fd );
+        timer_fd = -1;
+    }
+
+    aesd_durability_stop();
+
+    if( index_on ){
+        aesd_index_close( &rec_index );
+        index_on = false;
+    }
+
+    if( !backend_is_file ){
+        close( log_fd );
+    }
+
+    free( buf );
+    free( xbuf );
+    buf = xbuf = NULL;
+
+    if( ctl_fd >= 0 ){
+        close( ctl_fd );
+        ctl_fd = -1;
+
+        // after a handover the path belongs to the successor
+        if( !handed_over ){
+            unlink( cfg_->control_socket );
+        }
+    }
+
+    if( stats_fd >= 0 ){
+        close( stats_fd );
+        stats_fd = -1;
+
+        if( !handed_over ){
+            unlink( cfg_->stats_socket );
+        }
+    }
+
+    // never unlink the char device node, only the data file, nor the log a successor appends to
+    if( backend_is_file && !handed_over ){
+        aesd_seglog_remove( &seglog );
+
+        if( cfg_->index_file ){
+            unlink( cfg_->index_file );
+        }
+    }
+
+    if( backend_is_file ){
+        aesd_seglog_close( &seglog );
+    }
 }
 
 
 //////////////////////////////////////////////////////////////////////////////////////////////
+/*
+ * Sends pending replies on EPOLLOUT, then reads and commits whatever the client sent.
+ */
+static void serve_client( uint32_t slot, uint32_t revents ){
+    if( revents & EPOLLOUT ){
+        if( !flush_client( slot ) ){
+            close_client( slot );
+            return;
+        }
+
+        update_events( slot );
+    }
+
+    if( !( revents & ( EPOLLIN | EPOLLERR | EPOLLHUP ) ) ||
+        conns[ slot ].fd < 0 || !( conns[ slot ].events & EPOLLIN ) ){
+        return;
+    }
+
+    struct aesd_conn* c = &conns[ slot ];
+    // framed clients keep partial frames in their own buffer, text is taken in one piece
+    char* in = c->binary ? c->inbuf : buf;
+
+    if( !c->negotiated ){
+        memcpy( buf, c->pend, c->in_len );
+    }
+
+    ssize_t n = read( c->fd, in + c->in_len, cfg_->maxline - 1 - c->in_len );
+
+    aesd_count( AESD_CTR_SYSCALLS, 1 );
+
+    if( n < 0 ){
+        if( errno == EINTR || errno == EAGAIN ){
+            return;
+        }
+
+        if( errno != ECONNRESET ){
+            AESD_LOG( LOG_ERR, "aesd server failed to read, err: %s\n", strerror( errno ) );
+        }
+
+        close_client( slot );
+    }else if( n == 0 ){// client disconnected
+        close_client( slot );
+    }else{
+        aesd_trace_input( &c->trace );
+        aesd_ratelimit_charge( &limiter, &c->limit, n );
+        c->in_len += n;
+
+        if( !c->negotiated && !negotiate( slot, in, c->in_len ) ){
+            return;
+        }
+
+        if( c->binary ){
+            if( !process_frames( slot ) ){
+                flush_client( slot );
+                close_client( slot );
+                return;
+            }
+        }else{
+            buf[ c->in_len ] = '\0';
+            process_message( slot, buf, c->in_len );
+            c->in_len = 0;
+        }
+
+        if( !flush_client( slot ) ){
+            close_client( slot );
+            return;
+        }
+
+        throttle_check( slot );
+        update_events( slot );
+    }
+}
+
+/*
+ * Stops accepting, then gives the clients up to the drain timeout to finish the request in
+ * flight.  A client is closed as soon as it was answered and has no reply pending, clients that
+ * connected but did not complete a request yet are still served until the deadline.
+ */
+static void drain_clients( void ){
+    struct epoll_event events[ MAX_EVENTS ];
+    long start = aesd_timestamp_now_ms();
+    long now = start;
+    uint32_t total = conns_active;
+
+    for( unsigned i = 0; i < nlisten; i ++ ){
+        close( listenfds[ i ] );
+    }
+
+    if( timer_fd >= 0 ){
+        close( timer_fd );
+        timer_fd = -1;
+    }
+
+    // the request in flight is finished before the deadline, whatever it cost
+    draining = true;
+    throttle_resume( true );
+
+    for( uint32_t i = 0; i < conns_cap; i ++ ){
+        if( conns[ i ].fd >= 0 && conns[ i ].answered && conns[ i ].outq_len == 0 ){
+            close_client( i );
+        }
+    }
+
+    while( conns_active > 0 && now - start < ( long )cfg_->drain_timeout_ms ){
+        int nready = epoll_wait( epfd, events, MAX_EVENTS, cfg_->drain_timeout_ms - ( now - start ) );
+
+        for( int i = 0; i < nready; i ++ ){
+            uint32_t slot = events[ i ].data.u32;
+
+            if( slot >= conns_cap || conns[ slot ].fd < 0 ){
+                continue;
+            }
+
+            serve_client( slot, events[ i ].events );
+
+            if( conns[ slot ].fd >= 0 && conns[ slot ].answered && conns[ slot ].outq_len == 0 ){
+                close_client( slot );
+            }
+        }
+
+        now = aesd_timestamp_now_ms();
+    }
+
+    AESD_LOG( LOG_INFO, "Drained %u connections in %ld ms, %u cut off at the deadline",
+            total, aesd_timestamp_now_ms() - start, conns_active );
+}
+
+static bool conns_grow( void ){
+    uint32_t new_cap = conns_cap ? conns_cap * 2 : CONN_INIT_CAP;
+    struct aesd_conn* c = realloc( conns, new_cap * sizeof( *c ) );
+
+    if( !c ){
+        AESD_LOG( LOG_ERR, "Failed to grow connection table to %u\n", new_cap );
+        return false;
+    }
+
+    conns = c;
+    uint32_t* fs = realloc( free_slots, new_cap * sizeof( *fs ) );
+
+    if( !fs ){
+        AESD_LOG( LOG_ERR, "Failed to grow free slot stack to %u\n", new_cap );
+        return false;
+    }
+
+    free_slots = fs;
+    fs = realloc( throttled, new_cap * sizeof( *fs ) );
+
+    if( !fs ){
+        AESD_LOG( LOG_ERR, "Failed to grow throttle list to %u\n", new_cap );
+        return false;
+    }
+
+    throttled = fs;
+
+    // push new slots so that the lowest index is handed out first
+    for( uint32_t i = new_cap; i > conns_cap; i -- ){
+        memset( &conns[ i - 1 ], 0, sizeof( struct aesd_conn ) );
+        conns[ i - 1 ].fd = -1;
+        free_slots[ free_top ++ ] = i - 1;
+    }
+
+    conns_cap = new_cap;
+    return true;
+}
+
+// listeners share LISTEN_SLOT, the few taken over from a multi worker server are all tried
+static void accept_clients( void ){
+    for( unsigned i = 0; i < nlisten; i ++ ){
+        accept_from( listenfds[ i ] );
+    }
+}
+
+static void accept_from( int listenfd ){
+    for( ;; ){
+        clilen = sizeof( cliaddr );
+        connfd = accept4( listenfd, (SA *) &cliaddr, &clilen, SOCK_CLOEXEC | SOCK_NONBLOCK );
+
+        if( connfd < 0 ){
+            if( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ){
+                AESD_LOG( LOG_ERR, "accept failed, err: %s\n", strerror( errno ) );
+            }
+
+            return;
+        }
+
+        if( free_top == 0 && !conns_grow() ){
+            AESD_LOG( LOG_ERR, "aesd server out of connection slots, dropping client\n" );
+            close( connfd );
+            continue;
+        }
+
+        uint32_t slot = free_slots[ -- free_top ];
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = slot };
+
+        if( epoll_ctl( epfd, EPOLL_CTL_ADD, connfd, &ev ) < 0 ){
+            AESD_LOG( LOG_ERR, "Failed to register client, err: %s\n", strerror( errno ) );
+            free_slots[ free_top ++ ] = slot;
+            close( connfd );
+            continue;
+        }
+
+        aesd_count( AESD_CTR_ACCEPTS, 1 );
+        aesd_ratelimit_attach( &limiter, &conns[ slot ].limit, cliaddr.sin_addr );
+        conns[ slot ].fd = connfd;
+        conns[ slot ].events = EPOLLIN;
+        aesd_trace_start( &conns[ slot ].trace );
+        conns_active ++;
+        log_remote_peer_name( connfd, true );
+    }
+}
+
+static void close_client( uint32_t slot ){
+    int fd = conns[ slot ].fd;
+    log_remote_peer_name( fd, false );
+    // closing the descriptor also removes it from the epoll set
+    close( fd );
+    conns[ slot ].fd = -1;
+    // a queued throttle entry is dropped by throttle_resume()
+    conns[ slot ].wake_ns = 0;
+    aesd_ratelimit_detach( &limiter, &conns[ slot ].limit );
+    outq_clear( &conns[ slot ] );
+    conns[ slot ].answered = false;
+    conns[ slot ].negotiated = conns[ slot ].binary = false;
+    conns[ slot ].in_len = 0;
+    free_slots[ free_top ++ ] = slot;
+    conns_active --;
+}
+
+// every connection needs a descriptor, lift the soft limit as far as the hard limit allows
+static void raise_fd_limit( void ){
+    struct rlimit rl;
+
+    if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < rl.rlim_max ){
+        rl.rlim_cur = rl.rlim_max;
+
+        if( setrlimit( RLIMIT_NOFILE, &rl ) < 0 ){
+            AESD_LOG( LOG_ERR, "Failed to raise descriptor limit, err: %s\n", strerror( errno ) );
+        }
+    }
+}
+
 static void log_remote_peer_name( int client_sock, bool is_open ){
     char ipstr[INET6_ADDRSTRLEN];
 
     struct sockaddr_storage addr;
-    socklen_t len;
+    socklen_t len = sizeof( addr );
     getpeername( client_sock, (struct sockaddr*)&addr, &len );
     struct sockaddr_in *s = (struct sockaddr_in *)&addr;
     inet_ntop(AF_INET, &s->sin_addr, ipstr, sizeof( ipstr ));
 
     if( is_open ){
-        syslog( LOG_DEBUG, "> Accepted connection from %s\n", ipstr );
+        AESD_LOG( LOG_DEBUG, "> Accepted connection from %s\n", ipstr );
     }else{
-        syslog( LOG_DEBUG, "> Closed connection from %s\n", ipstr );
+        AESD_LOG( LOG_DEBUG, "> Closed connection from %s\n", ipstr );
     }
 }
 
-static void process_message( int clientfd, char const* buf, int len ){
+/*
+ * Commits everything read from a client in one batch: the whole chunk goes to the log with a single
+ * write, the durability policy decides whether that is synced, then one reply per newline is
+ * queued.  Every reply is a prefix of the log ending at its own line, taken from the same snapshot.
+ */
+static void process_message( uint32_t slot, char const* buf, int len ){
+    struct aesd_cmd cmd;
+
     if( len <= 0 ){
-        syslog( LOG_ERR, "> Invalid len %d", len );
+        AESD_LOG( LOG_ERR, "> Invalid len %d", len );
         return;
     }
 
-    syslog( LOG_DEBUG, "> process_message %s, %d\n", buf, len );
-    //printf( "> process_message %s, %d\n", buf, len );
-    int nbytes;
-    char const* nl = strchr( buf, '\n' );
+    if( aesd_cmd_parse( buf, len, &cmd ) != AESD_CMD_NONE && cmd_handlers[ cmd.id ] ){
+        aesd_trace_ready( &conns[ slot ].trace );
+        cmd_handlers[ cmd.id ]( slot, &cmd );
+        conns[ slot ].answered = true;
+        return;
+    }
 
-    if( nl ){
-        int partial_pos = nl - buf;// + '\n'
-        // syslog( LOG_DEBUG, "nl found at %d pos", partial_pos );
-        nbytes = write( log_fd, buf, partial_pos + 1 );
+    bool complete = memchr( buf, '\n', len ) != NULL;
 
-        if( nbytes < 0 ){
-            syslog( LOG_ERR, "Failed to write log data, err: %s\n", strerror( errno ) );
-            return;
+    if( complete ){
+        aesd_trace_ready( &conns[ slot ].trace );
+    }
+
+    if( !write_log( buf, len ) ){
+        return;
+    }
+
+    // the device also holds what others wrote before and drops old entries, ask it where our lines ended
+    uint64_t start = log_start();
+    uint64_t base = backend_is_file ? file_size - len : aesd_cmd_reply_base( buf, len, log_size(), start );
+
+    aesd_durability_commit();
+
+    if( complete ){
+        aesd_trace_commit( &conns[ slot ].trace );
+    }
+
+    for( char const* p = buf, *end = buf + len; ( p = memchr( p, '\n', end - p ) ) != NULL; p ++ ){
+        uint64_t reply_end = base + ( p - buf ) + 1;
+
+        if( !outq_push( &conns[ slot ], start, reply_end - start, NULL, 0 ) ){
+            AESD_LOG( LOG_ERR, "Failed to queue reply of %llu bytes", ( unsigned long long )( reply_end - start ) );
+            break;
+        }
+
+        conns[ slot ].answered = true;
+    }
+}
+
+/**
+ * Looks at the first bytes of a connection, a client starting with the magic speaks frames.
+ * @return false while the bytes so far could still become the magic, they are kept in pend, or
+ * when the client had to be closed.
+ */
+static bool negotiate( uint32_t slot, char* in, size_t len ){
+    struct aesd_conn* c = &conns[ slot ];
+
+    if( len < AESD_PROTO_MAGIC_LEN && aesd_proto_is_magic( in, len ) ){
+        memcpy( c->pend, in, len );
+        return false;
+    }
+
+    c->negotiated = true;
+
+    if( !aesd_proto_is_magic( in, len ) ){
+        return true;
+    }
+
+    char* magic = malloc( AESD_PROTO_MAGIC_LEN );
+
+    if( !c->inbuf ){
+        c->inbuf = malloc( cfg_->maxline );
+    }
+
+    if( !c->inbuf || !magic ){
+        AESD_LOG( LOG_ERR, "Out of memory for a framed client\n" );
+        free( magic );
+        close_client( slot );
+        return false;
+    }
+
+    c->binary = true;
+    c->in_len = len - AESD_PROTO_MAGIC_LEN;
+    memcpy( c->inbuf, in + AESD_PROTO_MAGIC_LEN, c->in_len );
+    // replies are assembled with MSG_MORE, pipelined clients should not wait for delayed acks
+    setsockopt( c->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+    memcpy( magic, AESD_PROTO_MAGIC, AESD_PROTO_MAGIC_LEN );
+
+    if( !outq_push( c, 0, 0, magic, AESD_PROTO_MAGIC_LEN ) ){
+        close_client( slot );
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Serves every complete frame in the client buffer in order and keeps a partial one for the next
+ * read.  Replies are only queued here, they are sent in order by flush_client().
+ * @return false when the connection has to be closed.
+ */
+static bool process_frames( uint32_t slot ){
+    struct aesd_conn* c = &conns[ slot ];
+    struct aesd_frame f;
+    char const* payload;
+    size_t used = 0, n;
+
+    while( ( n = aesd_frame_next( c->inbuf + used, c->in_len - used, &f, &payload ) ) > 0 ){
+        if( used == 0 ){
+            aesd_trace_ready( &c->trace );
+        }
+
+        if( !serve_frame( slot, &f, payload ) ){
+            return false;
+        }
+
+        used += n;
+        c->answered = true;
+    }
+
+    // the header is in, the payload would never fit into the buffer
+    if( c->in_len - used >= AESD_FRAME_HDR_LEN && f.len > cfg_->maxline - 1 - AESD_FRAME_HDR_LEN ){
+        AESD_LOG( LOG_ERR, "> Frame of %u bytes above maxline, closing", f.len );
+        queue_frame( slot, &f, AESD_STATUS_TOO_LARGE, NULL, 0, 0, 0 );
+        return false;
+    }
+
+    c->in_len -= used;
+    memmove( c->inbuf, c->inbuf + used, c->in_len );
+    return true;
+}
+
+/**
+ * @return false when the reply could not be queued.
+ */
+static bool serve_frame( uint32_t slot, struct aesd_frame const* f, char const* payload ){
+    AESD_LOG( LOG_DEBUG, "> frame op %u, seq %llu, %u bytes\n", f->op, ( unsigned long long )f->seq, f->len );
+
+    switch( f->op ){
+    case AESD_OP_APPEND:
+        if( f->len > 0 ){
+            if( !write_log( payload, f->len ) ){
+                return queue_frame( slot, f, AESD_STATUS_FAILED, NULL, 0, 0, 0 );
+            }
+
+            aesd_durability_commit();
+            aesd_trace_commit( &conns[ slot ].trace );
         }
 
-        file_size += partial_pos + 1;
-        dump_file_to_client( clientfd );
-        int bytes_left = len - ( partial_pos + 1 );
+        return queue_frame( slot, f, AESD_STATUS_OK, NULL, 0, 0, 0 );
+    case AESD_OP_REPLAY_FROM: {
+        uint64_t from, start = log_start(), end = log_size();
 
-        if( bytes_left > 0 ){
-            process_message( clientfd, buf + partial_pos + 1, bytes_left );
+        if( f->len != 8 ){
+            return queue_frame( slot, f, AESD_STATUS_BAD_REQUEST, NULL, 0, 0, 0 );
         }
-    }else{
-        // syslog( LOG_DEBUG, "nl not found" );
-        nbytes = write( log_fd, buf, len );
+
+        from = aesd_proto_get_u64( ( uint8_t const* )payload );
+        from = from < end ? from : end;
+        from = from > start ? from : start;
+        return queue_frame( slot, f, AESD_STATUS_OK, NULL, 0, from, end - from );
+    }
+    case AESD_OP_STATS: {
+        char stats[ 128 ];
+
+        return queue_frame( slot, f, AESD_STATUS_OK, stats, format_stats( stats, sizeof( stats ) ), 0, 0 );
+    }
+    case AESD_OP_SEEK: {
+        uint64_t pos;
+        uint8_t status;
+
+        if( f->len != 8 ){
+            return queue_frame( slot, f, AESD_STATUS_BAD_REQUEST, NULL, 0, 0, 0 );
+        }
+
+        if( !seek_offset( aesd_proto_get_u32( ( uint8_t const* )payload ),
+                          aesd_proto_get_u32( ( uint8_t const* )payload + 4 ), &pos, &status ) ){
+            return queue_frame( slot, f, status, NULL, 0, 0, 0 );
+        }
+
+        return queue_frame( slot, f, AESD_STATUS_OK, NULL, 0, pos, log_size() - pos );
+    }
+    default:
+        return queue_frame( slot, f, AESD_STATUS_BAD_REQUEST, NULL, 0, 0, 0 );
+    }
+}
+
+/**
+ * Queues a single frame reply to @param req: @param payload is copied behind the header, the log
+ * range [ @param off, @param off + @param len ) follows it.
+ */
+static bool queue_frame( uint32_t slot, struct aesd_frame const* req, uint8_t status,
+                         char const* payload, size_t plen, off_t off, size_t len ){
+    struct aesd_frame f = { req->op | AESD_OP_REPLY, status, 0, plen + len, req->seq };
+    char* data = malloc( AESD_FRAME_HDR_LEN + plen );
+
+    if( !data ){
+        AESD_LOG( LOG_ERR, "Out of memory for a reply frame\n" );
+        return false;
+    }
+
+    aesd_frame_encode( &f, ( uint8_t* )data );
+    memcpy( data + AESD_FRAME_HDR_LEN, payload, plen );
+    return outq_push( &conns[ slot ], off, len, data, AESD_FRAME_HDR_LEN + plen );
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// text protocol commands, see aesd_cmd.h
+
+static void cmd_seekto( uint32_t slot, struct aesd_cmd const* cmd ){
+    uint64_t pos, end;
+    uint8_t status;
+
+    if( cmd->arg[ 0 ] > UINT32_MAX || cmd->arg[ 1 ] > UINT32_MAX || !seek_offset( cmd->arg[ 0 ], cmd->arg[ 1 ], &pos, &status ) ){
+        return;
+    }
+
+    end = log_size();
+
+    if( pos < end && !outq_push( &conns[ slot ], pos, end - pos, NULL, 0 ) ){
+        AESD_LOG( LOG_ERR, "Failed to queue reply of %llu bytes", ( unsigned long long )( end - pos ) );
+    }
+}
+
+static void cmd_stats( uint32_t slot, struct aesd_cmd const* cmd ){
+    char stats[ 128 ];
+
+    queue_text( slot, stats, format_stats( stats, sizeof( stats ) ) );
+}
+
+static void cmd_size( uint32_t slot, struct aesd_cmd const* cmd ){
+    char size[ 32 ];
+
+    queue_text( slot, size, snprintf( size, sizeof( size ), "%llu\n", ( unsigned long long )log_size() ) );
+}
+
+static void cmd_replay_from( uint32_t slot, struct aesd_cmd const* cmd ){
+    uint64_t end = log_size(), from = cmd->arg[ 0 ] > log_start() ? cmd->arg[ 0 ] : log_start();
+
+    if( from < end && !outq_push( &conns[ slot ], from, end - from, NULL, 0 ) ){
+        AESD_LOG( LOG_ERR, "Failed to queue reply of %llu bytes", ( unsigned long long )( end - from ) );
+    }
+}
+
+static void cmd_tail( uint32_t slot, struct aesd_cmd const* cmd ){
+    uint64_t from, end = log_size();
+
+    // a data file is only found through its index, the device is read backwards
+    if( index_on ){
+        from = aesd_index_tail( &rec_index, cmd->arg[ 0 ] );
+    }else if( backend_is_file || !aesd_cmd_tail_offset( log_fd, end, cmd->arg[ 0 ], xbuf, cfg_->buffsize, &from ) ){
+        AESD_LOG( LOG_ERR, "read of log failed, err: %s\n", strerror( errno ) );
+        return;
+    }
+
+    if( from < end && !outq_push( &conns[ slot ], from, end - from, NULL, 0 ) ){
+        AESD_LOG( LOG_ERR, "Failed to queue reply of %llu bytes", ( unsigned long long )( end - from ) );
+    }
+}
+
+static void cmd_latency( uint32_t slot, struct aesd_cmd const* cmd ){
+    char text[ 1024 ];
+    int len = aesd_latency_format( text, sizeof( text ) );
+
+    queue_text( slot, text, ( size_t )len < sizeof( text ) ? ( size_t )len : sizeof( text ) - 1 );
+}
+
+static void serve_stats( void ){
+    struct aesd_gauges g = {
+        .engine = "epoll",
+        .backend = backend_is_file ? "file" : "device",
+        .connections = conns_active,
+        .log_start = log_start(),
+        .log_end = log_size()
+    };
+
+    aesd_metrics_serve( stats_fd, &g );
+}
+
+static int format_stats( char* buf, size_t size ){
+    return snprintf( buf, size, "connections %u\nbytes %llu\n", conns_active, ( unsigned long long )log_size() );
+}
+
+// queues a copy of @param text, a reply that is not part of the log
+static bool queue_text( uint32_t slot, char const* text, size_t len ){
+    char* data = malloc( len );
+
+    if( !data ){
+        AESD_LOG( LOG_ERR, "Out of memory for a reply\n" );
+        return false;
+    }
+
+    memcpy( data, text, len );
+    return outq_push( &conns[ slot ], 0, 0, data, len );
+}
+
+// where a replay ends: the end of the data file log, or what the device holds right now
+static uint64_t log_size( void ){
+    struct aesd_info info;
+
+    if( backend_is_file ){
+        return file_size;
+    }
+
+    return ioctl( log_fd, AESDCHAR_IOCGINFO, &info ) == 0 ? info.size : 0;
+}
+
+// where a replay starts, retention may have deleted the beginning of a data file log
+static uint64_t log_start( void ){
+    return backend_is_file ? aesd_seglog_start( &seglog ) : 0;
+}
+
+/**
+ * Locates byte @param off of write command @param cmd as AESDCHAR_IOCSEEKTO does: through the record
+ * index for a data file, the device is asked on a descriptor of its own so the log position stays.
+ * @return false with @param status set when the position cannot be served.
+ */
+static bool seek_offset( unsigned cmd, unsigned off, uint64_t* pos, uint8_t* status ){
+    struct aesd_seekto seek_to_cmd = {
+        .write_cmd = cmd,
+        .write_cmd_offset = off
+    };
+    off_t where = -1;
+    int seek_fd;
+
+    if( backend_is_file ){
+        *status = index_on ? AESD_STATUS_BAD_REQUEST : AESD_STATUS_UNSUPPORTED;
+        return index_on && aesd_index_seek( &rec_index, cmd, off, pos );
+    }
+
+    seek_fd = open( filename_, O_RDWR | O_CLOEXEC );
+
+    if( seek_fd < 0 ){
+        AESD_LOG( LOG_ERR, "Cannot open ioctl %s, err: %s\n", filename_, strerror( errno ) );
+        *status = AESD_STATUS_FAILED;
+        return false;
+    }
+
+    if( ioctl( seek_fd, AESDCHAR_IOCSEEKTO, &seek_to_cmd ) == -1 ){
+        AESD_LOG( LOG_ERR, "> Failed to send AESDCHAR_IOCSEEKTO command - %s", strerror( errno ) );
+        *status = errno == EINVAL ? AESD_STATUS_BAD_REQUEST : AESD_STATUS_FAILED;
+    }else if( ( where = lseek( seek_fd, 0, SEEK_CUR ) ) < 0 ){
+        *status = AESD_STATUS_FAILED;
+    }
+
+    close( seek_fd );
+    *pos = where;
+    return where >= 0;
+}
+
+// timestamp records take the same commit path as client data, only no reply is queued
+static void write_timestamp( void ){
+    char time_str[ 64 ];
+    size_t len = aesd_timestamp_format( time_str, sizeof( time_str ) );
+
+    AESD_LOG( LOG_DEBUG, "%s", time_str );
+
+    if( write_log( time_str, len ) ){
+        aesd_durability_commit();
+    }
+}
+
+static bool write_log( char const* buf, int len ){
+    char const* record = buf;
+    int total = len;
+
+    while( len > 0 ){
+        // during a handover two servers append to the file, file_size is where our bytes ended
+        ssize_t nbytes = backend_is_file ? aesd_seglog_append( &seglog, buf, len, &file_size )
+                                         : write( log_fd, buf, len );
+
+        aesd_count( AESD_CTR_SYSCALLS, 1 );
 
         if( nbytes < 0 ){
-            syslog( LOG_ERR, "Failed to write log data, err: %s\n", strerror( errno ) );
-            return;
+            if( errno == EINTR ){
+                continue;
+            }
+
+            aesd_count( AESD_CTR_WRITE_ERRORS, 1 );
+            AESD_LOG( LOG_ERR, "Failed to write log data, err: %s\n", strerror( errno ) );
+            return false;
         }
 
-        file_size += len;
-    }   
+        buf += nbytes;
+        len -= nbytes;
+
+        if( !backend_is_file ){
+            file_size += nbytes;
+        }
+    }
+
+    if( index_on && !aesd_index_append( &rec_index, file_size - total, record, total ) ){
+        AESD_LOG( LOG_WARNING, "Record index disabled, seeks on the data file fail from now on\n" );
+        aesd_index_close( &rec_index );
+        index_on = false;
+    }
+
+    aesd_count_commit( record, total );
+    return true;
 }
 
-static void dump_file_to_client( int fd_client ){
-    fsync( log_fd );
-    int rc = lseek( log_fd, 0, SEEK_SET );
+/**
+ * Queues the log range [ @param off, @param off + @param len ) behind @param data, which the
+ * queue owns from here on, even when false is returned.
+ */
+static bool outq_push( struct aesd_conn* c, off_t off, size_t len, char* data, size_t data_len ){
+    if( c->outq_len == c->outq_cap ){
+        uint32_t new_cap = c->outq_cap ? c->outq_cap * 2 : 4;
+        struct aesd_outref* q = malloc( new_cap * sizeof( *q ) );
 
-    if( rc < 0 ){
-        syslog( LOG_ERR, "Failed to seek to file start" );
-    }else{
-        int bytes_left = file_size;
-
-        while( bytes_left > 0 ){
-            char tmpbuf[ BUFFSIZE ];
-            memset( tmpbuf, 0, sizeof( tmpbuf ) );
-            int rn = read( log_fd, tmpbuf, sizeof( tmpbuf ) );
-            // tmpbuf[rn ] = '\0';
-            syslog( LOG_DEBUG, "> dump_file_to_client: file_size = %d, bytes_left = %d, read chunk = %d\n", file_size, bytes_left, rn );
-            // printf( "> chunk to send (%s)", tmpbuf );
-
-            if( rn > 0 ){
-                write( fd_client, tmpbuf, rn );
-                bytes_left -= rn;
-            }else{
-                syslog( LOG_ERR, "read returned %d, err: %s\n", rn, strerror( errno ) );
-                break;//????
+        if( !q ){
+            free( data );
+            return false;
+        }
+
+        for( uint32_t i = 0; i < c->outq_len; i ++ ){
+            q[ i ] = c->outq[ ( c->outq_head + i ) % c->outq_cap ];
+        }
+
+        free( c->outq );
+        c->outq = q;
+        c->outq_head = 0;
+        c->outq_cap = new_cap;
+    }
+
+    c->outq[ ( c->outq_head + c->outq_len ) % c->outq_cap ] = ( struct aesd_outref ){ off, len, data, data_len, 0 };
+    c->outq_len ++;
+    c->out_bytes += len + data_len;
+    // a replay costs the client what it takes from the log
+    aesd_ratelimit_charge( &limiter, &c->limit, len );
+    return true;
+}
+
+static void outq_clear( struct aesd_conn* c ){
+    for( uint32_t i = 0; i < c->outq_len; i ++ ){
+        free( c->outq[ ( c->outq_head + i ) % c->outq_cap ].data );
+    }
+
+    c->outq_head = c->outq_len = 0;
+    c->out_bytes = 0;
+}
+
+/**
+ * Sends as much of the queued replies as the socket accepts without blocking.
+ * @return false when the connection failed and has to be closed.
+ */
+static bool flush_client( uint32_t slot ){
+    struct aesd_conn* c = &conns[ slot ];
+    size_t turn = 0;
+
+    while( c->outq_len > 0 ){
+        struct aesd_outref* ref = &c->outq[ c->outq_head ];
+        ssize_t sent = -1;
+
+        // round robin, a large replay leaves the other ready clients their turn, EPOLLOUT brings it back
+        if( turn >= TURN_QUANTUM ){
+            return true;
+        }
+
+        if( ref->data_off < ref->data_len ){
+            // the header stays corked until the range behind it follows
+            sent = send( c->fd, ref->data + ref->data_off, ref->data_len - ref->data_off, ref->len > 0 ? MSG_MORE : 0 );
+            aesd_count( AESD_CTR_SYSCALLS, 1 );
+
+            if( sent < 0 ){
+                if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ){
+                    return true;
+                }
+
+                AESD_LOG( LOG_ERR, "> write back failed with %s", strerror( errno ) );
+                return false;
             }
+
+            ref->data_off += sent;
+            c->out_bytes -= sent;
+            turn += sent;
+
+            if( ref->data_off < ref->data_len ){
+                continue;
+            }
+        }
+
+        if( ref->len == 0 ){
+            sent = 0;
+        }else if( backend_is_file ){
+            sent = aesd_seglog_sendfile( &seglog, c->fd, ref->off, ref->len );
+            aesd_count( AESD_CTR_SYSCALLS, 1 );
+        }else if( sendfile_ok ){
+            off_t off = ref->off;
+            sent = sendfile( c->fd, log_fd, &off, ref->len );
+            aesd_count( AESD_CTR_SYSCALLS, 1 );
+
+            if( sent < 0 && ( errno == EINVAL || errno == ENOSYS ) ){
+                sendfile_ok = false;  // backend without splice support, e.g. the char device
+            }
+        }
+
+        if( sent < 0 && !sendfile_ok ){
+            ssize_t rn = pread( log_fd, xbuf, ref->len < cfg_->buffsize ? ref->len : cfg_->buffsize, ref->off );
+
+            aesd_count( AESD_CTR_SYSCALLS, 1 + ( rn > 0 ) );
+
+            if( rn < 0 ){
+                aesd_count( AESD_CTR_READ_ERRORS, 1 );
+                AESD_LOG( LOG_ERR, "read of log failed, err: %s\n", strerror( errno ) );
+                return false;
+            }
+
+            sent = rn == 0 ? 0 : write( c->fd, xbuf, rn );
         }
 
-        lseek( log_fd, 0, SEEK_SET );
-        lseek( log_fd, file_size, SEEK_SET );
+        if( sent < 0 ){
+            if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ){
+                return true;
+            }
+
+            AESD_LOG( LOG_ERR, "> write back failed with %s", strerror( errno ) );
+            return false;
+        }
+
+        if( sent == 0 && ref->len > 0 && ref->data ){
+            // the frame header promised these bytes, the stream cannot be resynchronized
+            AESD_LOG( LOG_ERR, "> log shrank under a framed reply, closing\n" );
+            return false;
+        }
+
+        if( sent == 0 ){
+            // the log no longer holds the reference, the device dropped old records or retention a segment
+            c->out_bytes -= ref->len;
+            ref->len = 0;
+        }else{
+            ref->off += sent;
+            ref->len -= sent;
+            c->out_bytes -= sent;
+            turn += sent;
+            aesd_count( AESD_CTR_REPLAY_BYTES, sent );
+        }
+
+        if( ref->len == 0 ){
+            free( ref->data );
+            c->outq_head = ( c->outq_head + 1 ) % c->outq_cap;
+            c->outq_len --;
+        }
+    }
+
+
+    // the reply of the request in flight is out
+    if( c->trace.ready != 0 ){
+        aesd_trace_done( &c->trace );
+    }
+
+    return true;
+}
+
+/**
+ * Waits for EPOLLOUT while replies are pending and stops reading from a client whose backlog
+ * is above the configured high water mark, until it drained to a quarter of it.
+ */
+static void update_events( uint32_t slot ){
+    struct aesd_conn* c = &conns[ slot ];
+    uint32_t events = c->events & EPOLLIN;
+
+    if( c->out_bytes > cfg_->outq_high_water ){
+        events = 0;
+    }else if( c->out_bytes <= cfg_->outq_high_water / 4 ){
+        events = EPOLLIN;
+    }
+
+    if( c->wake_ns != 0 ){
+        events &= ~EPOLLIN;
+    }
+
+    if( c->outq_len > 0 ){
+        events |= EPOLLOUT;
+    }
+
+    if( events != c->events ){
+        struct epoll_event ev = { .events = events, .data.u32 = slot };
+
+        if( epoll_ctl( epfd, EPOLL_CTL_MOD, c->fd, &ev ) < 0 ){
+            AESD_LOG( LOG_ERR, "epoll_ctl failed, err: %s\n", strerror( errno ) );
+            return;
+        }
+
+        c->events = events;
     }
 }
 
+/**
+ * Stops reading from a client over its rate limit until its buckets refilled, its pending replies
+ * are still sent.
+ */
+static void throttle_check( uint32_t slot ){
+    struct aesd_conn* c = &conns[ slot ];
+    uint64_t delay;
+
+    if( draining || !aesd_ratelimit_on( &limiter ) || ( delay = aesd_ratelimit_delay( &limiter, &c->limit ) ) == 0 ){
+        return;
+    }
+
+    c->wake_ns = aesd_latency_now() + delay;
+    aesd_count( AESD_CTR_THROTTLED, 1 );
+
+    if( !c->throttle_queued ){
+        c->throttle_queued = true;
+        throttled[ throttled_len ++ ] = slot;
+    }
+}
+
+// epoll_wait() timeout until the first throttled client may be read from again
+static int throttle_timeout( void ){
+    uint64_t now, first = UINT64_MAX;
+
+    if( throttled_len == 0 ){
+        return INFTIM;
+    }
+
+    for( uint32_t i = 0; i < throttled_len; i ++ ){
+        uint64_t wake = conns[ throttled[ i ] ].wake_ns;
+
+        first = wake != 0 && wake < first ? wake : first;
+    }
+
+    now = aesd_latency_now();
+    return first == UINT64_MAX ? 0 : first <= now ? 0 : ( first - now ) / 1000000 + 1;
+}
+
+/**
+ * Reads again from the throttled clients whose time came, from all of them with @param all.
+ */
+static void throttle_resume( bool all ){
+    uint64_t now = aesd_latency_now();
+    uint32_t kept = 0;
+
+    for( uint32_t i = 0; i < throttled_len; i ++ ){
+        uint32_t slot = throttled[ i ];
+        struct aesd_conn* c = &conns[ slot ];
+
+        if( c->wake_ns != 0 && c->wake_ns > now && !all ){
+            throttled[ kept ++ ] = slot;
+            continue;
+        }
+
+        c->throttle_queued = false;
+
+        if( c->wake_ns != 0 ){
+            c->wake_ns = 0;
+            update_events( slot );
+        }
+    }
+
+    throttled_len = kept;
+}
+
 static void make_daemon()
 {
     pid_t pid;
@@ -287,7 +1401,7 @@ static void make_daemon()
     
     /* An error occurred */
     if (pid < 0){
-        syslog( LOG_ERR, "fork failed" );
+        AESD_LOG( LOG_ERR, "fork failed" );
         exit(EXIT_FAILURE);
     }
     
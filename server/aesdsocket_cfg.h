@@ -1,4 +1,5 @@
 #pragma once
+/* compile time defaults, every value can be overridden at runtime, see aesd_config.h */
 
 #define	MAXLINE		4096	/* max text line length */
 #define	MAXSOCKADDR  128	/* max socket address structure size */
@@ -6,10 +7,22 @@
 #define	LISTENQ		1024	/* 2nd argument to listen() */
 #define INFTIM        -1    /* infinite poll timeout */
 #define	SA	struct sockaddr
+#define OUTQ_HIGH_WATER (1024 * 1024) /* stop reading from a client with more pending replies */
 
 
 #define SERV_PORT   9000
 #define LOG_TIMER_INT   10
+#define MIRROR_SIZE     0   /* bytes of the log kept in memory for replays, 0 disables the mirror */
+#define REPLAY_WINDOW_US 500 /* while replays overlap, a new snapshot waits this long for more to join */
+#define REPLAY_SNAPSHOT_MAX ( 16 * 1024 * 1024 ) /* replays share at most this much, the rest is streamed per client */
+#define SEGMENT_SIZE    0   /* data file segment size in bytes, 0 keeps the log in one file */
+#define RETAIN_BYTES    0   /* segmented logs: delete old segments beyond this many bytes, 0 = keep all */
+#define RETAIN_SECS     0   /* segmented logs: delete segments last written longer ago, 0 = keep all */
+#define CLIENT_RATE     0   /* bytes per second a connection may send and have replayed, 0 = no limit */
+#define IP_RATE         0   /* as CLIENT_RATE, for all connections from one source address */
+#define TURN_QUANTUM    ( 64 * 1024 ) /* epoll engine: bytes sent to a client before the next ready one is served */
+#define DRAIN_TIMEOUT_MS 2000 /* time given to open connections to finish on SIGINT/SIGTERM */
+#define WORKERS         1   /* accepting threads, each with its own SO_REUSEPORT listener when above 1 */
 #define USE_AESD_CHAR_DEVICE 1
 
 #ifdef USE_AESD_CHAR_DEVICE
@@ -0,0 +1,88 @@
+/*
+ * Connections per second accepted by a running aesdsocket.
+ *
+ * usage: accept_bench [port] [client threads] [seconds]
+ * Every client thread connects and closes as fast as it can, the close resets the connection so
+ * the client side does not run out of ports in TIME_WAIT.  Compare the server started with -w 1
+ * against -w <cores> (optionally --worker-affinity).
+ * prints CSV: clients,seconds,connections,errors,conns_per_sec
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct sockaddr_in addr;
+static atomic_bool stop = false;
+static atomic_long connections = 0;
+static atomic_long errors = 0;
+
+static double now_s( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* client( void* arg ){
+    struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+    long ok = 0, failed = 0;
+
+    while( !atomic_load_explicit( &stop, memory_order_relaxed ) ){
+        int fd = socket( AF_INET, SOCK_STREAM, 0 );
+
+        if( fd < 0 ){
+            failed ++;
+            continue;
+        }
+
+        if( connect( fd, ( struct sockaddr* )&addr, sizeof( addr ) ) == 0 ){
+            ok ++;
+        }else{
+            failed ++;
+        }
+
+        setsockopt( fd, SOL_SOCKET, SO_LINGER, &lg, sizeof( lg ) );
+        close( fd );
+    }
+
+    atomic_fetch_add( &connections, ok );
+    atomic_fetch_add( &errors, failed );
+    return NULL;
+}
+
+int main( int argc, char** argv ){
+    int port = argc > 1 ? atoi( argv[ 1 ] ) : 9000;
+    int clients = argc > 2 ? atoi( argv[ 2 ] ) : 8;
+    double seconds = argc > 3 ? atof( argv[ 3 ] ) : 5;
+    pthread_t* tids = calloc( clients, sizeof( pthread_t ) );
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( port );
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+    double t0 = now_s();
+
+    for( int i = 0; i < clients; i ++ ){
+        pthread_create( &tids[ i ], NULL, client, NULL );
+    }
+
+    usleep( seconds * 1e6 );
+    atomic_store( &stop, true );
+
+    for( int i = 0; i < clients; i ++ ){
+        pthread_join( tids[ i ], NULL );
+    }
+
+    double total = now_s() - t0;
+    printf( "clients,seconds,connections,errors,conns_per_sec\n" );
+    printf( "%d,%.2f,%ld,%ld,%.0f\n", clients, total, atomic_load( &connections ), atomic_load( &errors ),
+            atomic_load( &connections ) / total );
+    free( tids );
+    return 0;
+}
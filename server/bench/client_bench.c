@@ -0,0 +1,141 @@
+/*
+ * Append and replay throughput of libaesdclient against a running aesdsocket or the device.
+ *
+ * usage: client_bench [target] [records] [depth] [threads]
+ * Every mode appends the given number of 64 byte records per thread: "sync" waits for each append
+ * to be acknowledged as hand written clients do, "pipelined" keeps up to depth appends in flight
+ * on one connection and "pool" does the same from several threads sharing a pool.  "replay" reads
+ * the whole log back once.  Each run grows the log, start the server on a fresh data file.
+ * prints CSV: mode,threads,depth,requests,bytes,seconds,requests_per_sec,mb_per_sec
+ */
+#include "../aesd_client.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RECORD_LEN  64
+
+static char const* target = "localhost:9000";
+static long records = 100000;
+static long depth = 64;
+static struct aesd_pool* pool;
+static atomic_long failures = 0;
+static char record[ RECORD_LEN ];
+
+static double now_s( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void done( void* arg, int status, char const* data, size_t len ){
+    if( status != 0 ){
+        atomic_fetch_add( &failures, 1 );
+    }
+
+    if( arg ){
+        *( size_t* )arg += len;
+    }
+}
+
+// appends with at most @param window requests in flight
+static void append_all( struct aesd_client* c, long n, long window ){
+    for( long i = 0; i < n; i ++ ){
+        while( ( long )aesd_client_pending( c ) >= window ){
+            if( aesd_client_poll( c, -1 ) < 0 ){
+                return;
+            }
+        }
+
+        if( aesd_client_append( c, record, sizeof( record ), done, NULL ) < 0 ){
+            atomic_fetch_add( &failures, 1 );
+        }
+    }
+
+    aesd_client_drain( c, -1 );
+}
+
+static void* pooled( void* arg ){
+    struct aesd_client* c = aesd_pool_get( pool );
+
+    if( !c ){
+        perror( "aesd_pool_get" );
+        atomic_fetch_add( &failures, records );
+        return NULL;
+    }
+
+    append_all( c, records, depth );
+    aesd_pool_put( pool, c );
+    return NULL;
+}
+
+static void report( char const* mode, int threads, long window, long requests, double bytes, double seconds ){
+    printf( "%s,%d,%ld,%ld,%.0f,%.3f,%.0f,%.2f\n", mode, threads, window, requests, bytes, seconds,
+            requests / seconds, bytes / seconds / 1e6 );
+}
+
+int main( int argc, char** argv ){
+    int threads = argc > 4 ? atoi( argv[ 4 ] ) : 4;
+    pthread_t* tids = calloc( threads, sizeof( pthread_t ) );
+    struct aesd_client* c;
+    size_t replayed = 0;
+    double t0;
+
+    target = argc > 1 ? argv[ 1 ] : target;
+    records = argc > 2 ? atol( argv[ 2 ] ) : records;
+    depth = argc > 3 ? atol( argv[ 3 ] ) : depth;
+    memset( record, 'x', sizeof( record ) - 1 );
+    record[ sizeof( record ) - 1 ] = '\n';
+
+    if( !tids || ( c = aesd_client_open( target, 0 ) ) == NULL ){
+        perror( target );
+        return 1;
+    }
+
+    printf( "mode,threads,depth,requests,bytes,seconds,requests_per_sec,mb_per_sec\n" );
+
+    t0 = now_s();
+    append_all( c, records, 1 );
+    report( "sync", 1, 1, records, records * RECORD_LEN, now_s() - t0 );
+
+    t0 = now_s();
+    append_all( c, records, depth );
+    report( "pipelined", 1, depth, records, records * RECORD_LEN, now_s() - t0 );
+
+    if( ( pool = aesd_pool_create( target, 0, threads ) ) != NULL ){
+        t0 = now_s();
+
+        for( int i = 0; i < threads; i ++ ){
+            pthread_create( &tids[ i ], NULL, pooled, NULL );
+        }
+
+        for( int i = 0; i < threads; i ++ ){
+            pthread_join( tids[ i ], NULL );
+        }
+
+        report( "pool", threads, depth, records * threads, ( double )records * threads * RECORD_LEN, now_s() - t0 );
+        aesd_pool_destroy( pool );
+    }
+
+    t0 = now_s();
+
+    if( aesd_client_replay_from( c, 0, done, &replayed ) < 0 || aesd_client_drain( c, -1 ) < 0 ){
+        atomic_fetch_add( &failures, 1 );
+    }
+
+    report( "replay", 1, 1, 1, replayed, now_s() - t0 );
+    aesd_client_close( c );
+    free( tids );
+
+    if( atomic_load( &failures ) > 0 ){
+        fprintf( stderr, "%ld requests failed\n", atomic_load( &failures ) );
+        return 1;
+    }
+
+    return 0;
+}
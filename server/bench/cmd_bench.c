@@ -0,0 +1,71 @@
+/*
+ * Per message cost of telling text protocol commands from log records: the sscanf() that
+ * parse_aesdchar_ioseek() ran on every message against the prefix check and command table of
+ * aesd_cmd.c.
+ *
+ * usage: cmd_bench [iterations]
+ * prints CSV: impl,input,messages,seconds,ns_per_message
+ */
+#include "../aesd_cmd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct input {
+    char const* name;
+    char const* msg;
+};
+
+static const struct input inputs[] = {
+    { "record", "2024-01-01 00:00:00 sensor 17 reading 42.125 status ok\n" },
+    { "record_A", "AESD test record starting like a command\n" },
+    { "seekto", "AESDCHAR_IOCSEEKTO:3,17\n" },
+    { "tail", "AESDCHAR_TAIL:10\n" },
+};
+
+static volatile unsigned sink;
+
+static double now_sec( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned parse_sscanf( char const* msg, size_t len ){
+    unsigned cmd, off;
+
+    return sscanf( msg, "AESDCHAR_IOCSEEKTO:%u,%u", &cmd, &off ) == 2 ? cmd + off : 0;
+}
+
+static unsigned parse_table( char const* msg, size_t len ){
+    struct aesd_cmd cmd;
+
+    return aesd_cmd_parse( msg, len, &cmd ) != AESD_CMD_NONE ? cmd.id : 0;
+}
+
+static void run( char const* impl, unsigned ( *parse )( char const*, size_t ), struct input const* in, long n ){
+    size_t len = strlen( in->msg );
+    double t0 = now_sec();
+
+    for( long i = 0; i < n; i ++ ){
+        sink += parse( in->msg, len );
+    }
+
+    double dt = now_sec() - t0;
+    printf( "%s,%s,%ld,%.6f,%.2f\n", impl, in->name, n, dt, dt * 1e9 / n );
+}
+
+int main( int argc, char** argv ){
+    long n = argc > 1 ? atol( argv[ 1 ] ) : 10000000;
+
+    printf( "impl,input,messages,seconds,ns_per_message\n" );
+
+    for( size_t i = 0; i < sizeof( inputs ) / sizeof( inputs[ 0 ] ); i ++ ){
+        run( "sscanf", parse_sscanf, &inputs[ i ], n );
+        run( "table", parse_table, &inputs[ i ], n );
+    }
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Commit latency and throughput of the aesd_durability policies.
+ *
+ * usage: durability_bench [path] [records]
+ * The default path is next to the server log, on the same filesystem as /var/tmp/aesdsocketdata.
+ * prints CSV: policy,records,seconds,records_per_sec,p50_us,p99_us,max_us
+ */
+#include "../aesd_durability.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_us( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double( const void* a, const void* b ){
+    double x = *( const double* )a, y = *( const double* )b;
+    return ( x > y ) - ( x < y );
+}
+
+int main( int argc, char** argv ){
+    char const* path = argc > 1 ? argv[ 1 ] : "/var/tmp/aesdsocketdata.bench";
+    long records = argc > 2 ? atol( argv[ 2 ] ) : 2000;
+    char const* policies[] = { "none", "interval=100", "interval=10", "every-record" };
+    char const record[] = "timestamp:2024-01-01 00:00:00 key=value other=thing\n";
+    double* lat = malloc( records * sizeof( double ) );
+
+    printf( "policy,records,seconds,records_per_sec,p50_us,p99_us,max_us\n" );
+
+    for( size_t p = 0; p < sizeof( policies ) / sizeof( policies[ 0 ] ); p ++ ){
+        struct aesd_durability d;
+        int fd = open( path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644 );
+
+        if( fd < 0 || !aesd_durability_parse( policies[ p ], &d ) || !aesd_durability_start( &d, fd ) ){
+            perror( path );
+            return 1;
+        }
+
+        double t0 = now_us();
+
+        for( long i = 0; i < records; i ++ ){
+            double s = now_us();
+
+            if( write( fd, record, sizeof( record ) - 1 ) < 0 ){
+                perror( "write" );
+                return 1;
+            }
+
+            aesd_durability_commit();
+            lat[ i ] = now_us() - s;
+        }
+
+        double total = now_us() - t0;
+        aesd_durability_stop();
+        close( fd );
+        qsort( lat, records, sizeof( double ), cmp_double );
+        printf( "%s,%ld,%.4f,%.0f,%.2f,%.2f,%.2f\n", policies[ p ], records, total / 1e6, records / ( total / 1e6 ),
+                lat[ records / 2 ], lat[ records * 99 / 100 ], lat[ records - 1 ] );
+    }
+
+    unlink( path );
+    free( lat );
+    return 0;
+}
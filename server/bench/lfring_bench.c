@@ -0,0 +1,124 @@
+/*
+ * Throughput of handing records to a log writer thread: the lock free rings of aesd_lfring.h
+ * against producers adding directly to an aesd_circular_buffer under a mutex, as aesdsocket does
+ * with write_lock.
+ *
+ * usage: lfring_bench [max_producers] [records_per_producer]
+ * prints CSV: impl,producers,records,seconds,mrecords_per_sec
+ */
+#include "../aesd_lfring.h"
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static struct aesd_buffer_entry     record = { "timestamp:2024-01-01 00:00:00\n", 30, 0 };
+static struct aesd_circular_buffer  circbuf;
+static pthread_mutex_t              write_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct aesd_spsc_ring        spsc;
+static struct aesd_mpsc_ring        mpsc;
+static long                         per_producer;
+
+static double now_sec( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* mutex_producer( void* arg ){
+    for( long i = 0; i < per_producer; i ++ ){
+        pthread_mutex_lock( &write_lock );
+        aesd_circular_buffer_add_entry( &circbuf, &record );
+        pthread_mutex_unlock( &write_lock );
+    }
+
+    return NULL;
+}
+
+static void* spsc_producer( void* arg ){
+    for( long i = 0; i < per_producer; i ++ ){
+        while( !aesd_spsc_push( &spsc, &record ) ){
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void* mpsc_producer( void* arg ){
+    for( long i = 0; i < per_producer; i ++ ){
+        while( !aesd_mpsc_push( &mpsc, &record ) ){
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+// the log writer: drains the ring into a private circular buffer, no lock needed
+static void drain( void* ( *pop )( void* ), void* ring, long total ){
+    long got = 0;
+
+    while( got < total ){
+        struct aesd_buffer_entry* e = pop( ring );
+
+        if( e ){
+            aesd_circular_buffer_add_entry( &circbuf, e );
+            got ++;
+        }else{
+            sched_yield();
+        }
+    }
+}
+
+static void* spsc_pop( void* r ){ return aesd_spsc_pop( r ); }
+static void* mpsc_pop( void* r ){ return aesd_mpsc_pop( r ); }
+
+static void run( char const* impl, int producers, void* ( *producer )( void* ),
+                 void* ( *pop )( void* ), void* ring ){
+    pthread_t tids[ producers ];
+    long total = per_producer * producers;
+    aesd_circular_buffer_init( &circbuf );
+    double t0 = now_sec();
+
+    for( int i = 0; i < producers; i ++ ){
+        pthread_create( &tids[ i ], NULL, producer, NULL );
+    }
+
+    if( pop ){
+        drain( pop, ring, total );
+    }
+
+    for( int i = 0; i < producers; i ++ ){
+        pthread_join( tids[ i ], NULL );
+    }
+
+    double dt = now_sec() - t0;
+    printf( "%s,%d,%ld,%.6f,%.3f\n", impl, producers, total, dt, total / dt / 1e6 );
+    fflush( stdout );
+}
+
+int main( int argc, char** argv ){
+    int max_producers = argc > 1 ? atoi( argv[ 1 ] ) : 8;
+    per_producer = argc > 2 ? atol( argv[ 2 ] ) : 1000000;
+
+    if( !aesd_spsc_init( &spsc, 4096 ) || !aesd_mpsc_init( &mpsc, 4096 ) ){
+        fprintf( stderr, "out of memory\n" );
+        return 1;
+    }
+
+    printf( "impl,producers,records,seconds,mrecords_per_sec\n" );
+    run( "spsc", 1, spsc_producer, spsc_pop, &spsc );
+
+    for( int p = 1; p <= max_producers; p ++ ){
+        run( "mutex", p, mutex_producer, NULL, NULL );
+        run( "mpsc", p, mpsc_producer, mpsc_pop, &mpsc );
+    }
+
+    aesd_spsc_destroy( &spsc );
+    aesd_mpsc_destroy( &mpsc );
+    return 0;
+}
@@ -5,18 +5,25 @@
 #include <syslog.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <stdio.h>
 
+#include "aesd_config.h"
+#include "aesd_latency.h"
 #include "aesd_server_thrd.h"
+#include "aesdsocket.h"
 #include "aesdsocket_cfg.h"
 
 
 void signal_handler( int signo );
 
+static struct aesd_config cfg;
+
 int main( int argc, char** argv ){
-    bool is_daemon = false;
+    aesd_config_defaults( &cfg );
 
-    if( argc > 1 && 0 == strcmp( "-d", argv[ 1 ] ) ){
-        is_daemon = true;
+    if( !aesd_config_parse( &cfg, argc, argv ) ){
+        aesd_config_free( &cfg );
+        return 1;
     }
 
     
@@ -33,21 +40,56 @@ int main( int argc, char** argv ){
         syslog( LOG_ERR, "failed to install signal handler for SIGUSR1" );
         return 1;
     }
+
+    // a latency dump must not fail the reads and writes it interrupts, only wake poll()
+    sa.sa_flags = SA_RESTART;
+
+    if ( -1 == sigaction( SIGUSR1, &sa, NULL ) ) {
+        syslog( LOG_ERR, "failed to install signal handler for SIGUSR1" );
+        return 1;
+    }
+
+    // a client that went away must fail the write, not kill the server
+    signal( SIGPIPE, SIG_IGN );
     
+    bool ok = cfg.engine == AESD_ENGINE_EPOLL ? aesd_initialize( &cfg ) : aesd_thrd_initialize( &cfg );
 
-    if( !aesd_thrd_initialize( LOG_PATH, is_daemon ) ){
+    if( !ok ){
         syslog( LOG_ERR, "Failed to initialize server" );
+        aesd_config_free( &cfg );
         return -1;
     }
 
-    aesd_thrd_run();
-    aesd_thrd_shutdown();
+    // after initialize, which may have daemonized, the drain thread would not survive the fork
+    if( !aesd_log_start( cfg.log_sink ) ){
+        syslog( LOG_ERR, "Failed to start the logger, logging synchronously" );
+    }
+
+    if( cfg.engine == AESD_ENGINE_EPOLL ){
+        aesd_run();
+        aesd_shutdown();
+    }else{
+        aesd_thrd_run();
+        aesd_thrd_shutdown();
+    }
+
+    aesd_log_stop();
+    aesd_config_free( &cfg );
     return 0;
 }
 
 void signal_handler( int signo ){
     if( signo == SIGINT || signo == SIGTERM ){
         syslog( LOG_DEBUG, "Caught signal, exiting" );
-        aesd_thrd_signal_triggered( signo );
+
+        if( cfg.engine == AESD_ENGINE_EPOLL ){
+            aesd_signal_triggered( signo );
+        }else{
+            aesd_thrd_signal_triggered( signo );
+        }
+    }
+
+    if( signo == SIGUSR1 ){
+        aesd_latency_signal();
     }
 }
@@ -0,0 +1,111 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../server/aesd_cmd.h"
+
+#define TEST_LOG    "/tmp/aesd_test_cmd.log"
+
+static enum aesd_cmd_id parse( char const* msg, struct aesd_cmd* cmd ){
+    return aesd_cmd_parse( msg, strlen( msg ), cmd );
+}
+
+void test_cmd_parses_every_command(){
+    struct aesd_cmd cmd;
+
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_SEEKTO, parse( "AESDCHAR_IOCSEEKTO:3,17\n", &cmd ) );
+    TEST_ASSERT_EQUAL_UINT64( 3, cmd.arg[ 0 ] );
+    TEST_ASSERT_EQUAL_UINT64( 17, cmd.arg[ 1 ] );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_STATS, parse( "AESDCHAR_STATS\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_SIZE, parse( "AESDCHAR_SIZE", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_REPLAY_FROM, parse( "AESDCHAR_REPLAY_FROM:0\n", &cmd ) );
+    TEST_ASSERT_EQUAL_UINT64( 0, cmd.arg[ 0 ] );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_TAIL, parse( "AESDCHAR_TAIL:10\n", &cmd ) );
+    TEST_ASSERT_EQUAL_UINT64( 10, cmd.arg[ 0 ] );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_LATENCY, parse( "AESDCHAR_LATENCY\n", &cmd ) );
+}
+
+void test_cmd_records_are_not_commands(){
+    struct aesd_cmd cmd;
+
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "hello\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_UNKNOWN\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "aesdchar_STATS\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, aesd_cmd_parse( "", 0, &cmd ) );
+}
+
+void test_cmd_missing_arguments(){
+    struct aesd_cmd cmd;
+
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_IOCSEEKTO:\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_IOCSEEKTO:1\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_IOCSEEKTO:1,\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_IOCSEEKTO:,1\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_REPLAY_FROM:\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_REPLAY_FROM\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_TAIL:-1\n", &cmd ) );
+}
+
+void test_cmd_trailing_bytes(){
+    struct aesd_cmd cmd;
+
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_STATS \n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_STATSX\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_STATS\n\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_IOCSEEKTO:1,2,3\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_TAIL:5x\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_TAIL:5\r\n", &cmd ) );
+    // the length decides, not a terminating zero
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, aesd_cmd_parse( "AESDCHAR_TAIL:5\0\n", 17, &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_TAIL, aesd_cmd_parse( "AESDCHAR_TAIL:56", 15, &cmd ) );
+    TEST_ASSERT_EQUAL_UINT64( 5, cmd.arg[ 0 ] );
+}
+
+void test_cmd_argument_overflow(){
+    struct aesd_cmd cmd;
+
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_REPLAY_FROM, parse( "AESDCHAR_REPLAY_FROM:18446744073709551615\n", &cmd ) );
+    TEST_ASSERT_EQUAL_UINT64( UINT64_MAX, cmd.arg[ 0 ] );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_REPLAY_FROM:18446744073709551616\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_TAIL:99999999999999999999\n", &cmd ) );
+    TEST_ASSERT_EQUAL_INT( AESD_CMD_NONE, parse( "AESDCHAR_IOCSEEKTO:1,18446744073709551616\n", &cmd ) );
+}
+
+void test_cmd_tail_offset(){
+    char const log[] = "one\ntwo\nthree\n";
+    char scratch[ 3 ];
+    uint64_t off;
+    FILE* f = fopen( TEST_LOG, "w+" );
+
+    TEST_ASSERT_NOT_NULL( f );
+    TEST_ASSERT_EQUAL_INT( sizeof( log ) - 1, fwrite( log, 1, sizeof( log ) - 1, f ) );
+    fflush( f );
+
+    // a scratch buffer smaller than a record makes the search cross reads
+    TEST_ASSERT_TRUE( aesd_cmd_tail_offset( fileno( f ), sizeof( log ) - 1, 1, scratch, sizeof( scratch ), &off ) );
+    TEST_ASSERT_EQUAL_UINT64( 8, off );
+    TEST_ASSERT_TRUE( aesd_cmd_tail_offset( fileno( f ), sizeof( log ) - 1, 2, scratch, sizeof( scratch ), &off ) );
+    TEST_ASSERT_EQUAL_UINT64( 4, off );
+    TEST_ASSERT_TRUE( aesd_cmd_tail_offset( fileno( f ), sizeof( log ) - 1, 5, scratch, sizeof( scratch ), &off ) );
+    TEST_ASSERT_EQUAL_UINT64( 0, off );
+    TEST_ASSERT_TRUE( aesd_cmd_tail_offset( fileno( f ), sizeof( log ) - 1, 0, scratch, sizeof( scratch ), &off ) );
+    TEST_ASSERT_EQUAL_UINT64( sizeof( log ) - 1, off );
+
+    fclose( f );
+    unlink( TEST_LOG );
+}
+
+void test_cmd_reply_base_of_a_partial_line(){
+    // the device already held 10 bytes, "x\n" completed a record and "y" is still buffered
+    TEST_ASSERT_EQUAL_UINT64( 10, aesd_cmd_reply_base( "x\ny", 3, 12, 0 ) );
+    TEST_ASSERT_EQUAL_UINT64( 10, aesd_cmd_reply_base( "x\n", 2, 12, 0 ) );
+    // "ab" of an earlier chunk was completed by this one
+    TEST_ASSERT_EQUAL_UINT64( 12, aesd_cmd_reply_base( "c\nd", 3, 14, 0 ) );
+    // the ring dropped the entries before ours
+    TEST_ASSERT_EQUAL_UINT64( 0, aesd_cmd_reply_base( "x\nyy\nz", 7, 3, 0 ) );
+    TEST_ASSERT_EQUAL_UINT64( 8, aesd_cmd_reply_base( "x\ny", 3, 9, 8 ) );
+}
@@ -0,0 +1,134 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../server/aesd_index.h"
+#include "../../server/aesd_seglog.h"
+
+#define TEST_LOG        "/tmp/aesd_test_index.log"
+#define TEST_SIDECAR    "/tmp/aesd_test_index.idx"
+
+static struct aesd_seglog seglog;
+static struct aesd_index idx;
+
+void setUp( void ){
+    unlink( TEST_LOG );
+    unlink( TEST_SIDECAR );
+    TEST_ASSERT_TRUE( aesd_seglog_open( &seglog, TEST_LOG, 0, 0, 0 ) );
+}
+
+void tearDown( void ){
+    aesd_index_close( &idx );
+    aesd_seglog_close( &seglog );
+    unlink( TEST_LOG );
+    unlink( TEST_SIDECAR );
+}
+
+// appends through the log only, the index does not see the bytes
+static uint64_t log_write( char const* s ){
+    uint64_t end;
+
+    TEST_ASSERT_EQUAL_INT( strlen( s ), aesd_seglog_append( &seglog, s, strlen( s ), &end ) );
+    return end;
+}
+
+// appends as the servers do, the log first and the index after the commit
+static void index_write( char const* s ){
+    uint64_t end = log_write( s );
+
+    TEST_ASSERT_TRUE( aesd_index_append( &idx, end - strlen( s ), s, strlen( s ) ) );
+}
+
+static void assert_seek( uint64_t record, uint64_t offset, uint64_t expected ){
+    uint64_t pos = UINT64_MAX;
+
+    TEST_ASSERT_TRUE_MESSAGE( aesd_index_seek( &idx, record, offset, &pos ), "seek failed" );
+    TEST_ASSERT_EQUAL_UINT64( expected, pos );
+}
+
+void test_index_seek_and_tail(){
+    uint64_t pos;
+
+    TEST_ASSERT_TRUE( aesd_index_open( &idx, NULL, &seglog ) );
+    index_write( "one\ntwo\n" );
+    index_write( "thr" );
+    index_write( "ee\n" );
+
+    assert_seek( 0, 0, 0 );
+    assert_seek( 1, 3, 7 );
+    assert_seek( 2, 5, 13 );
+    TEST_ASSERT_FALSE( aesd_index_seek( &idx, 1, 4, &pos ) );
+    TEST_ASSERT_FALSE( aesd_index_seek( &idx, 3, 0, &pos ) );
+
+    TEST_ASSERT_EQUAL_UINT64( 14, aesd_index_tail( &idx, 0 ) );
+    TEST_ASSERT_EQUAL_UINT64( 8, aesd_index_tail( &idx, 1 ) );
+    TEST_ASSERT_EQUAL_UINT64( 0, aesd_index_tail( &idx, 10 ) );
+
+    // a record still being written cannot be sought into
+    index_write( "fo" );
+    TEST_ASSERT_FALSE( aesd_index_seek( &idx, 3, 0, &pos ) );
+    TEST_ASSERT_EQUAL_UINT64( 8, aesd_index_tail( &idx, 1 ) );
+}
+
+void test_index_reads_back_bytes_written_behind_its_back(){
+    TEST_ASSERT_TRUE( aesd_index_open( &idx, NULL, &seglog ) );
+    index_write( "a\n" );
+    log_write( "bb\ncc" );
+    index_write( "c\nd\n" );
+
+    assert_seek( 1, 0, 2 );
+    assert_seek( 2, 2, 7 );
+    assert_seek( 3, 0, 9 );
+}
+
+void test_index_sidecar_survives_reopen(){
+    TEST_ASSERT_TRUE( aesd_index_open( &idx, TEST_SIDECAR, &seglog ) );
+    index_write( "a\nbb\n" );
+    aesd_index_close( &idx );
+
+    // written while no index was open, only this part is scanned on the next open
+    log_write( "ccc\n" );
+    TEST_ASSERT_TRUE( aesd_index_open( &idx, TEST_SIDECAR, &seglog ) );
+    TEST_ASSERT_TRUE( idx.map_fd >= 0 );
+    TEST_ASSERT_EQUAL_UINT64( 3, idx.count );
+    assert_seek( 1, 1, 3 );
+    assert_seek( 2, 0, 5 );
+
+    index_write( "d\n" );
+    assert_seek( 3, 0, 9 );
+}
+
+void test_index_sidecar_of_another_log_is_rebuilt(){
+    uint64_t pos;
+
+    TEST_ASSERT_TRUE( aesd_index_open( &idx, TEST_SIDECAR, &seglog ) );
+    index_write( "a\nbb\n" );
+    aesd_index_close( &idx );
+    aesd_seglog_close( &seglog );
+
+    // same name, other records: the newlines the sidecar expects are not there
+    unlink( TEST_LOG );
+    TEST_ASSERT_TRUE( aesd_seglog_open( &seglog, TEST_LOG, 0, 0, 0 ) );
+    log_write( "abcdefgh\n" );
+    TEST_ASSERT_TRUE( aesd_index_open( &idx, TEST_SIDECAR, &seglog ) );
+
+    TEST_ASSERT_EQUAL_UINT64( 1, idx.count );
+    assert_seek( 0, 8, 8 );
+    TEST_ASSERT_FALSE( aesd_index_seek( &idx, 1, 0, &pos ) );
+}
+
+void test_index_sidecar_of_a_shorter_log_is_rebuilt(){
+    TEST_ASSERT_TRUE( aesd_index_open( &idx, TEST_SIDECAR, &seglog ) );
+    index_write( "a\nbb\nccc\n" );
+    aesd_index_close( &idx );
+    aesd_seglog_close( &seglog );
+
+    unlink( TEST_LOG );
+    TEST_ASSERT_TRUE( aesd_seglog_open( &seglog, TEST_LOG, 0, 0, 0 ) );
+    log_write( "x\n" );
+    TEST_ASSERT_TRUE( aesd_index_open( &idx, TEST_SIDECAR, &seglog ) );
+
+    TEST_ASSERT_EQUAL_UINT64( 1, idx.count );
+    TEST_ASSERT_EQUAL_UINT64( 2, idx.end );
+}
@@ -0,0 +1,187 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include "../../server/aesd_seglog.h"
+
+#define TEST_LOG        "/tmp/aesd_test_seglog.log"
+#define REAP_WAIT_MS    5000
+
+static struct aesd_seglog seglog;
+
+static char const* segment_path( uint64_t start ){
+    static char path[ 64 ];
+
+    snprintf( path, sizeof( path ), TEST_LOG ".%016llx", ( unsigned long long )start );
+    return path;
+}
+
+static bool segment_exists( uint64_t start ){
+    return access( segment_path( start ), F_OK ) == 0;
+}
+
+static void remove_segments( void ){
+    for( uint64_t start = 0; start < 64; start ++ ){
+        unlink( segment_path( start ) );
+    }
+
+    unlink( TEST_LOG );
+}
+
+void setUp( void ){
+    remove_segments();
+}
+
+void tearDown( void ){
+    aesd_seglog_close( &seglog );
+    remove_segments();
+}
+
+static uint64_t append( char const* s ){
+    uint64_t end = 0;
+
+    TEST_ASSERT_EQUAL_INT( strlen( s ), aesd_seglog_append( &seglog, s, strlen( s ), &end ) );
+    return end;
+}
+
+static void assert_gone( uint64_t off ){
+    char buf[ 8 ];
+
+    TEST_ASSERT_EQUAL_INT( 0, aesd_seglog_pread( &seglog, buf, sizeof( buf ), off ) );
+}
+
+static void assert_read( uint64_t off, char const* expected ){
+    char buf[ 64 ];
+    ssize_t rn = aesd_seglog_pread( &seglog, buf, sizeof( buf ), off );
+
+    TEST_ASSERT_EQUAL_INT( strlen( expected ), rn );
+    TEST_ASSERT_EQUAL_MEMORY( expected, buf, rn );
+}
+
+// the reaper runs on its own thread, give it a few of its intervals
+static bool wait_for_start( uint64_t start ){
+    for( int ms = 0; ms < REAP_WAIT_MS; ms += 10 ){
+        if( aesd_seglog_start( &seglog ) == start ){
+            return true;
+        }
+
+        usleep( 10 * 1000 );
+    }
+
+    return false;
+}
+
+void test_seglog_single_file_without_segments(){
+    TEST_ASSERT_TRUE( aesd_seglog_open( &seglog, TEST_LOG, 0, 0, 0 ) );
+    TEST_ASSERT_EQUAL_UINT64( 6, append( "hello\n" ) );
+    TEST_ASSERT_EQUAL_UINT64( 12, append( "world\n" ) );
+    TEST_ASSERT_EQUAL_INT( 0, access( TEST_LOG, F_OK ) );
+    TEST_ASSERT_FALSE( segment_exists( 0 ) );
+    assert_read( 0, "hello\nworld\n" );
+}
+
+void test_seglog_rotates_at_record_boundaries(){
+    struct stat st;
+
+    TEST_ASSERT_TRUE( aesd_seglog_open( &seglog, TEST_LOG, 8, 0, 0 ) );
+
+    // a record longer than a segment is not split, the segment is sealed after its newline
+    TEST_ASSERT_EQUAL_UINT64( 10, append( "abcdefghij" ) );
+    TEST_ASSERT_EQUAL_UINT64( 11, append( "\n" ) );
+    TEST_ASSERT_FALSE( segment_exists( 11 ) );
+    TEST_ASSERT_EQUAL_UINT64( 13, append( "x\n" ) );
+    TEST_ASSERT_TRUE( segment_exists( 0 ) );
+    TEST_ASSERT_TRUE( segment_exists( 11 ) );
+    TEST_ASSERT_EQUAL_UINT64( 13, aesd_seglog_end( &seglog ) );
+
+    // reads stop at the end of a segment
+    assert_read( 0, "abcdefghij\n" );
+    assert_read( 5, "fghij\n" );
+    assert_read( 11, "x\n" );
+
+    // the sealed segment is read only
+    TEST_ASSERT_EQUAL_INT( 0, stat( segment_path( 0 ), &st ) );
+    TEST_ASSERT_FALSE( st.st_mode & S_IWUSR );
+}
+
+void test_seglog_reopen_keeps_offsets(){
+    TEST_ASSERT_TRUE( aesd_seglog_open( &seglog, TEST_LOG, 4, 0, 0 ) );
+    append( "aaaa\n" );
+    append( "bbbb\n" );
+    append( "cc" );
+    aesd_seglog_close( &seglog );
+
+    // the record cut short is finished in the segment it started in
+    TEST_ASSERT_TRUE( aesd_seglog_open( &seglog, TEST_LOG, 4, 0, 0 ) );
+    TEST_ASSERT_EQUAL_UINT64( 0, aesd_seglog_start( &seglog ) );
+    TEST_ASSERT_EQUAL_UINT64( 12, aesd_seglog_end( &seglog ) );
+    TEST_ASSERT_EQUAL_UINT64( 15, append( "cc\n" ) );
+    TEST_ASSERT_FALSE( segment_exists( 12 ) );
+    TEST_ASSERT_EQUAL_UINT64( 17, append( "d\n" ) );
+    TEST_ASSERT_TRUE( segment_exists( 15 ) );
+
+    assert_read( 0, "aaaa\n" );
+    assert_read( 5, "bbbb\n" );
+    assert_read( 10, "cccc\n" );
+    assert_read( 15, "d\n" );
+}
+
+void test_seglog_incomplete_segments_are_skipped(){
+    TEST_ASSERT_TRUE( aesd_seglog_open( &seglog, TEST_LOG, 4, 0, 0 ) );
+    append( "aaaa\n" );
+    append( "bbbb\n" );
+    append( "cccc\n" );
+    aesd_seglog_close( &seglog );
+
+    // a hole in the middle, only what follows it can be served
+    TEST_ASSERT_EQUAL_INT( 0, truncate( segment_path( 5 ), 2 ) );
+    TEST_ASSERT_TRUE( aesd_seglog_open( &seglog, TEST_LOG, 4, 0, 0 ) );
+    TEST_ASSERT_EQUAL_UINT64( 10, aesd_seglog_start( &seglog ) );
+    assert_gone( 0 );
+    assert_read( 10, "cccc\n" );
+}
+
+void test_seglog_retention_by_size(){
+    TEST_ASSERT_TRUE( aesd_seglog_open( &seglog, TEST_LOG, 4, 10, 0 ) );
+    append( "aaaa\n" );
+    append( "bbbb\n" );
+    TEST_ASSERT_EQUAL_UINT64( 0, aesd_seglog_start( &seglog ) );
+
+    // without the oldest segment the log still holds the 10 bytes to retain
+    append( "cccc\n" );
+    TEST_ASSERT_TRUE_MESSAGE( wait_for_start( 5 ), "the oldest segment was not deleted" );
+    TEST_ASSERT_FALSE( segment_exists( 0 ) );
+    TEST_ASSERT_TRUE( segment_exists( 5 ) );
+    assert_gone( 0 );
+    assert_read( 5, "bbbb\n" );
+
+    append( "dddd\n" );
+    TEST_ASSERT_TRUE_MESSAGE( wait_for_start( 10 ), "the next segment was not deleted" );
+    TEST_ASSERT_FALSE( segment_exists( 5 ) );
+    assert_read( 10, "cccc\n" );
+    TEST_ASSERT_EQUAL_UINT64( 20, aesd_seglog_end( &seglog ) );
+}
+
+void test_seglog_retention_by_age(){
+    struct utimbuf old = { time( NULL ) - 120, time( NULL ) - 120 };
+
+    TEST_ASSERT_TRUE( aesd_seglog_open( &seglog, TEST_LOG, 4, 0, 60 ) );
+    append( "aaaa\n" );
+    append( "bbbb\n" );
+    append( "cccc\n" );
+    TEST_ASSERT_EQUAL_UINT64( 0, aesd_seglog_start( &seglog ) );
+
+    TEST_ASSERT_EQUAL_INT( 0, utime( segment_path( 0 ), &old ) );
+    TEST_ASSERT_TRUE_MESSAGE( wait_for_start( 5 ), "the expired segment was not deleted" );
+    TEST_ASSERT_FALSE( segment_exists( 0 ) );
+    TEST_ASSERT_TRUE( segment_exists( 5 ) );
+
+    // the newer segments are not old enough yet
+    usleep( 1500 * 1000 );
+    TEST_ASSERT_EQUAL_UINT64( 5, aesd_seglog_start( &seglog ) );
+}
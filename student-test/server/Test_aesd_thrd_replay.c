@@ -0,0 +1,133 @@
+#include "unity.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../../server/aesd_config.h"
+#include "../../server/aesd_proto.h"
+#include "../../server/aesd_server_thrd.h"
+
+/*
+ * Runs the threaded engine in process on a data file and talks to it over loopback.
+ */
+
+#define TEST_PORT   9713
+#define TEST_LOG    "/tmp/aesd_test_thrd_replay.log"
+
+static struct aesd_config cfg;
+static pthread_t server_tid;
+
+static void on_signal( int sig ){
+    aesd_thrd_signal_triggered( sig );
+}
+
+static void* serve( void* arg ){
+    aesd_thrd_run();
+    return NULL;
+}
+
+static void start_server( void ){
+    struct sigaction sa = { .sa_handler = on_signal };
+
+    unlink( TEST_LOG );
+    aesd_config_defaults( &cfg );
+    free( cfg.backend );
+    cfg.backend = strdup( TEST_LOG );
+    cfg.port = TEST_PORT;
+    sigaction( SIGTERM, &sa, NULL );
+    signal( SIGPIPE, SIG_IGN );
+    TEST_ASSERT_TRUE_MESSAGE( aesd_thrd_initialize( &cfg ), "threaded engine failed to start" );
+    TEST_ASSERT_EQUAL_INT( 0, pthread_create( &server_tid, NULL, serve, NULL ) );
+}
+
+static void stop_server( void ){
+    pthread_kill( server_tid, SIGTERM );
+    pthread_join( server_tid, NULL );
+    aesd_thrd_shutdown();
+    aesd_config_free( &cfg );
+    unlink( TEST_LOG );
+}
+
+static int connect_server( void ){
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons( TEST_PORT ) };
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    TEST_ASSERT_TRUE( fd >= 0 );
+    TEST_ASSERT_EQUAL_INT_MESSAGE( 0, connect( fd, ( struct sockaddr* )&addr, sizeof( addr ) ), "connect failed" );
+    return fd;
+}
+
+static size_t read_exactly( int fd, char* buf, size_t len ){
+    size_t got = 0;
+    ssize_t n;
+
+    while( got < len && ( n = read( fd, buf + got, len - got ) ) > 0 ){
+        got += n;
+    }
+
+    return got;
+}
+
+/**
+ * Sends @param msg on a new connection, half closes it and reads the reply up to the close.
+ */
+static void request( char const* msg, char* reply, size_t size ){
+    int fd = connect_server();
+    size_t len = 0;
+    ssize_t n;
+
+    TEST_ASSERT_EQUAL_INT( strlen( msg ), write( fd, msg, strlen( msg ) ) );
+    shutdown( fd, SHUT_WR );
+
+    while( len < size - 1 && ( n = read( fd, reply + len, size - 1 - len ) ) > 0 ){
+        len += n;
+    }
+
+    reply[ len ] = '\0';
+    close( fd );
+}
+
+// a framed append, answered by an empty reply and no replay of the log
+static void append_framed( char const* data ){
+    uint8_t req[ AESD_PROTO_MAGIC_LEN + AESD_FRAME_HDR_LEN + 64 ], reply[ AESD_PROTO_MAGIC_LEN + AESD_FRAME_HDR_LEN ];
+    struct aesd_frame f = { AESD_OP_APPEND, 0, 0, strlen( data ), 1 };
+    int fd = connect_server();
+
+    memcpy( req, AESD_PROTO_MAGIC, AESD_PROTO_MAGIC_LEN );
+    aesd_frame_encode( &f, req + AESD_PROTO_MAGIC_LEN );
+    memcpy( req + AESD_PROTO_MAGIC_LEN + AESD_FRAME_HDR_LEN, data, f.len );
+    TEST_ASSERT_EQUAL_INT( sizeof( reply ) + f.len, write( fd, req, sizeof( reply ) + f.len ) );
+    TEST_ASSERT_EQUAL_INT( sizeof( reply ), read_exactly( fd, ( char* )reply, sizeof( reply ) ) );
+    aesd_frame_decode( reply + AESD_PROTO_MAGIC_LEN, &f );
+    TEST_ASSERT_EQUAL_INT( AESD_OP_APPEND | AESD_OP_REPLY, f.op );
+    TEST_ASSERT_EQUAL_INT( AESD_STATUS_OK, f.status );
+    close( fd );
+}
+
+/**
+ * A connection that never wrote must not be served the snapshot cached for an earlier replay when
+ * the log has grown since.
+ */
+void test_thrd_read_only_replay_sees_earlier_write(){
+    char reply[ 256 ];
+
+    start_server();
+    request( "a\n", reply, sizeof( reply ) );
+    TEST_ASSERT_EQUAL_STRING( "a\n", reply );
+
+    append_framed( "b\n" );
+
+    request( "AESDCHAR_REPLAY_FROM:0\n", reply, sizeof( reply ) );
+    TEST_ASSERT_EQUAL_STRING( "a\nb\n", reply );
+    request( "AESDCHAR_TAIL:1\n", reply, sizeof( reply ) );
+    TEST_ASSERT_EQUAL_STRING( "b\n", reply );
+    request( "AESDCHAR_IOCSEEKTO:1,0\n", reply, sizeof( reply ) );
+    TEST_ASSERT_EQUAL_STRING( "b\n", reply );
+    stop_server();
+}